@@ -0,0 +1,212 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+// process-bench の各計測で共通に使う、集計と出力の小道具
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+namespace bench {
+
+typedef std::chrono::steady_clock Clock;
+
+inline double seconds_since(Clock::time_point t0)
+{
+	return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+// 標本 (単位はそのまま) の要約。百分位数は nearest-rank 法
+struct Summary {
+	size_t count = 0;
+	double mean = 0;
+	double min = 0;
+	double p50 = 0;
+	double p90 = 0;
+	double p99 = 0;
+	double p999 = 0;
+	double max = 0;
+};
+
+inline Summary summarize(std::vector<double> samples)
+{
+	Summary s;
+	s.count = samples.size();
+	if (samples.empty()) return s;
+	std::sort(samples.begin(), samples.end());
+	auto rank = [&](double p) {
+		size_t i = (size_t)std::ceil(p * samples.size());
+		return samples[std::min(std::max<size_t>(i, 1), samples.size()) - 1];
+	};
+	double sum = 0;
+	for (double v : samples) {
+		sum += v;
+	}
+	s.mean = sum / samples.size();
+	s.min = samples.front();
+	s.p50 = rank(0.50);
+	s.p90 = rank(0.90);
+	s.p99 = rank(0.99);
+	s.p999 = rank(0.999);
+	s.max = samples.back();
+	return s;
+}
+
+// 現在の RSS (バイト)。取れなければ 0
+inline size_t current_rss()
+{
+	size_t rss = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp) {
+		unsigned long size = 0;
+		unsigned long resident = 0;
+		if (fscanf(fp, "%lu %lu", &size, &resident) == 2) {
+			rss = resident * (size_t)sysconf(_SC_PAGESIZE);
+		}
+		fclose(fp);
+	}
+	return rss;
+}
+
+// 最大 RSS (バイト) の記録を今の RSS に戻す。戻せなければ false
+// (Linux 4.0 以降の /proc/self/clear_refs。戻せない場合 peak_rss() はプロセス開始からの最大値になる)
+inline bool reset_peak_rss()
+{
+	FILE *fp = fopen("/proc/self/clear_refs", "w");
+	if (!fp) return false;
+	bool ok = fputs("5", fp) >= 0;
+	ok = fclose(fp) == 0 && ok;
+	return ok;
+}
+
+// 最大 RSS (バイト)
+inline size_t peak_rss()
+{
+	FILE *fp = fopen("/proc/self/status", "r");
+	if (fp) {
+		char line[256];
+		while (fgets(line, sizeof(line), fp)) {
+			unsigned long kb = 0;
+			if (sscanf(line, "VmHWM: %lu kB", &kb) == 1) {
+				fclose(fp);
+				return (size_t)kb << 10;
+			}
+		}
+		fclose(fp);
+	}
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+	return (size_t)ru.ru_maxrss;
+#else
+	return (size_t)ru.ru_maxrss << 10;
+#endif
+}
+
+// このプロセス (全スレッド、子は含まない) が使った CPU 時間 (秒)
+inline double cpu_seconds()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// "a,b,c" を分割する
+inline std::vector<std::string> split_list(char const *s)
+{
+	std::vector<std::string> out;
+	std::string cur;
+	for (; *s; s++) {
+		if (*s == ',') {
+			if (!cur.empty()) out.push_back(cur);
+			cur.clear();
+		} else {
+			cur += *s;
+		}
+	}
+	if (!cur.empty()) out.push_back(cur);
+	return out;
+}
+
+inline bool contains(std::vector<std::string> const &list, char const *name)
+{
+	return std::find(list.begin(), list.end(), name) != list.end();
+}
+
+// JSON を1行ずつ組み立てる最小限の書き手。値はすべて数値か ASCII の文字列
+class JsonObject {
+private:
+	std::string s_;
+
+	void key(char const *name)
+	{
+		s_ += s_.empty() ? "{" : ", ";
+		s_ += '"';
+		s_ += name;
+		s_ += "\": ";
+	}
+
+public:
+	JsonObject &add(char const *name, std::string const &value)
+	{
+		key(name);
+		s_ += '"';
+		for (char c : value) {
+			if (c == '"' || c == '\\') s_ += '\\';
+			s_ += c;
+		}
+		s_ += '"';
+		return *this;
+	}
+	JsonObject &add(char const *name, char const *value)
+	{
+		return add(name, std::string(value));
+	}
+	JsonObject &add(char const *name, double value)
+	{
+		char tmp[64];
+		snprintf(tmp, sizeof(tmp), "%.3f", value);
+		key(name);
+		s_ += tmp;
+		return *this;
+	}
+	JsonObject &add(char const *name, long long value)
+	{
+		key(name);
+		s_ += std::to_string(value);
+		return *this;
+	}
+	JsonObject &add_raw(char const *name, std::string const &json)
+	{
+		key(name);
+		s_ += json;
+		return *this;
+	}
+	std::string str() const
+	{
+		return s_.empty() ? "{}" : s_ + "}";
+	}
+};
+
+inline std::string json_array(std::vector<std::string> const &items)
+{
+	std::string s = "[\n";
+	for (size_t i = 0; i < items.size(); i++) {
+		s += "    ";
+		s += items[i];
+		s += i + 1 < items.size() ? ",\n" : "\n";
+	}
+	s += "  ]";
+	return s;
+}
+
+} // namespace bench
+
+#endif // BENCH_UTIL_H
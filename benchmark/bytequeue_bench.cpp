@@ -0,0 +1,122 @@
+// ByteQueue と従来の std::deque<char> の比較用マイクロベンチマーク。
+// リーダースレッドが read() した塊を積み、利用者が read_output() 相当で少しずつ取り出す
+// パターンと、全部積んでから wait() で結果ベクタへ移すパターンを測る。
+
+#include "ByteQueue.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+namespace {
+
+struct DequeQueue {
+	std::deque<char> q;
+	void append(char const *ptr, size_t len)
+	{
+		q.insert(q.end(), ptr, ptr + len);
+	}
+	size_t pop(char *dst, size_t len)
+	{
+		size_t n = std::min(len, q.size());
+		auto it = q.begin();
+		std::copy(it, it + n, dst);
+		q.erase(it, it + n);
+		return n;
+	}
+	void copy_to(std::vector<char> *out) const
+	{
+		out->insert(out->end(), q.begin(), q.end());
+	}
+};
+
+struct Result {
+	double seconds = 0;
+	unsigned long checksum = 0;
+};
+
+unsigned long sum(char const *p, size_t n, unsigned long h)
+{
+	for (size_t i = 0; i < n; i++) {
+		h = h * 31 + (unsigned char)p[i];
+	}
+	return h;
+}
+
+// 積む塊 write_size、取り出す塊 read_size で total バイトを流す
+template <typename Q> Result stream(size_t total, size_t write_size, size_t read_size)
+{
+	std::vector<char> src(write_size);
+	for (size_t i = 0; i < write_size; i++) {
+		src[i] = char('a' + i % 26);
+	}
+	std::vector<char> dst(read_size);
+	Q q;
+	Result r;
+	auto t0 = std::chrono::steady_clock::now();
+	size_t written = 0;
+	while (written < total) {
+		q.append(src.data(), write_size);
+		written += write_size;
+		// 書き込み2回に1回ずつ、溜まった分を読み切る
+		if ((written / write_size) % 2 == 0) {
+			while (size_t n = q.pop(dst.data(), read_size)) {
+				r.checksum = sum(dst.data(), std::min<size_t>(n, 16), r.checksum);
+			}
+		}
+	}
+	while (size_t n = q.pop(dst.data(), read_size)) {
+		r.checksum = sum(dst.data(), std::min<size_t>(n, 16), r.checksum);
+	}
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	return r;
+}
+
+template <typename Q> Result accumulate(size_t total, size_t write_size)
+{
+	std::vector<char> src(write_size, 'x');
+	Q q;
+	Result r;
+	auto t0 = std::chrono::steady_clock::now();
+	for (size_t written = 0; written < total; written += write_size) {
+		q.append(src.data(), write_size);
+	}
+	std::vector<char> out;
+	q.copy_to(&out);
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	r.checksum = out.size();
+	return r;
+}
+
+void report(char const *name, size_t total, Result const &deque, Result const &bq)
+{
+	double mb = total / (1024.0 * 1024.0);
+	printf("%-28s deque %8.1f MB/s   ByteQueue %8.1f MB/s   x%.1f%s\n", name, mb / deque.seconds, mb / bq.seconds, deque.seconds / bq.seconds, deque.checksum == bq.checksum ? "" : "   (checksum mismatch!)");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	size_t mb = argc > 1 ? strtoul(argv[1], nullptr, 10) : 256;
+	if (mb == 0) mb = 256;
+	size_t total = mb * 1024 * 1024;
+
+	struct {
+		char const *name;
+		size_t write_size;
+		size_t read_size;
+	} const cases[] = {
+		{ "stream 4K in / 1K out", 4096, 1024 },
+		{ "stream 64K in / 4K out", 65536, 4096 },
+		{ "stream 512 in / 64K out", 512, 65536 },
+	};
+	for (auto const &c : cases) {
+		report(c.name, total, stream<DequeQueue>(total, c.write_size, c.read_size), stream<ByteQueue>(total, c.write_size, c.read_size));
+	}
+	report("accumulate 64K + copy_to", total, accumulate<DequeQueue>(total, 65536), accumulate<ByteQueue>(total, 65536));
+	return 0;
+}
@@ -0,0 +1,57 @@
+// プロセス起動ライブラリ (POSIX) のベンチマーク。
+// 人が読む表を stderr へ、機械処理用の JSON を stdout へ出力する。
+//
+//   process-bench spawn [options]       起動から終了までのレイテンシ
+//   process-bench throughput [options]  出力の吸い出し速度
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+int spawn_bench_main(int argc, char **argv);
+int throughput_bench_main(char const *self, int argc, char **argv);
+int produce_main(int argc, char **argv);
+
+namespace {
+
+void usage()
+{
+	fprintf(stderr,
+		"usage: process-bench <benchmark> [options]\n"
+		"  spawn       spawn-to-exit latency percentiles\n"
+		"  throughput  output drain rate, parent CPU and peak RSS per backend and capture mode\n");
+}
+
+// 計測用の子として自分自身を起動するためのパス
+std::string self_path(char const *argv0)
+{
+#ifdef __linux__
+	char buf[PATH_MAX];
+	ssize_t n = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+	if (n > 0) return std::string(buf, (size_t)n);
+#endif
+	return argv0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		usage();
+		return 2;
+	}
+	if (strcmp(argv[1], "spawn") == 0) {
+		return spawn_bench_main(argc - 2, argv + 2);
+	}
+	if (strcmp(argv[1], "throughput") == 0) {
+		return throughput_bench_main(self_path(argv[0]).c_str(), argc - 2, argv + 2);
+	}
+	if (strcmp(argv[1], "produce") == 0) { // throughput の子
+		return produce_main(argc - 2, argv + 2);
+	}
+	usage();
+	return 2;
+}
@@ -0,0 +1,165 @@
+// 起動から終了までのレイテンシ。ProcessPosix / ProcessPosixPty で自明なコマンドを
+// 何千回も実行し、百分位数を求める。親の RSS を段階的に増やして、fork() が
+// ページテーブルを複製するコストと、posix_spawn やヘルパーがそれを避ける効果を見る。
+
+#include "BasicProcessPosix.h"
+#include "bench_util.h"
+#include <cstring>
+#include <memory>
+
+namespace {
+
+struct Options {
+	int iterations = 2000;
+	int warmup = 20;
+	std::vector<size_t> rss_mb = { 0, 256, 1024 };
+	std::vector<std::string> backends = { "posix", "pty" };
+	std::vector<std::string> methods = { "fork", "posix_spawn", "helper" };
+};
+
+struct Command {
+	char const *name;
+	char const *command;
+	char const *expected; // ProcessPosix の stdout (nullptr なら調べない)
+};
+
+Command const commands[] = {
+	{ "true", "/bin/true", "" },
+	{ "echo", "echo hello", "hello\n" },
+};
+
+struct Method {
+	char const *name;
+	ProcessPosixSpawner::Method method;
+};
+
+Method const methods[] = {
+	{ "fork", ProcessPosixSpawner::Method::Fork },
+	{ "posix_spawn", ProcessPosixSpawner::Method::PosixSpawn },
+	{ "helper", ProcessPosixSpawner::Method::Helper },
+};
+
+// 1回分の起動から終了までの時間 (マイクロ秒)。失敗したら負
+double run_once(bool pty, ProcessPosixSpawner::Method method, Command const &cmd)
+{
+	auto t0 = bench::Clock::now();
+	if (pty) {
+		ProcessPosixPty proc;
+		proc.set_spawn_method(method);
+		proc.start(cmd.command, { }, false);
+		int code = proc.wait();
+		double us = bench::seconds_since(t0) * 1e6;
+		return code == 0 ? us : -1;
+	}
+	ProcessPosix proc;
+	proc.set_spawn_method(method);
+	proc.start(cmd.command, false);
+	int code = proc.wait();
+	double us = bench::seconds_since(t0) * 1e6;
+	if (code != 0) return -1;
+	if (cmd.expected && proc.stdout_view() != cmd.expected) return -1;
+	return us;
+}
+
+bool parse(int argc, char **argv, Options *opt)
+{
+	for (int i = 0; i < argc; i++) {
+		char const *a = argv[i];
+		char const *v = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!v) {
+			fprintf(stderr, "missing value for %s\n", a);
+			return false;
+		}
+		if (strcmp(a, "--iterations") == 0) {
+			opt->iterations = std::max(1, atoi(v));
+		} else if (strcmp(a, "--warmup") == 0) {
+			opt->warmup = std::max(0, atoi(v));
+		} else if (strcmp(a, "--rss") == 0) {
+			opt->rss_mb.clear();
+			for (std::string const &s : bench::split_list(v)) {
+				opt->rss_mb.push_back(strtoul(s.c_str(), nullptr, 10));
+			}
+			std::sort(opt->rss_mb.begin(), opt->rss_mb.end());
+		} else if (strcmp(a, "--backend") == 0) {
+			opt->backends = bench::split_list(v);
+		} else if (strcmp(a, "--method") == 0) {
+			opt->methods = bench::split_list(v);
+		} else {
+			fprintf(stderr, "unknown option: %s\n", a);
+			return false;
+		}
+		i++;
+	}
+	return true;
+}
+
+} // namespace
+
+int spawn_bench_main(int argc, char **argv)
+{
+	Options opt;
+	if (!parse(argc, argv, &opt)) {
+		fprintf(stderr, "usage: process-bench spawn [--iterations N] [--warmup N] [--rss MB,MB,...] [--backend posix,pty] [--method fork,posix_spawn,helper]\n");
+		return 2;
+	}
+
+	std::vector<std::unique_ptr<char[]>> ballast;
+	size_t ballast_mb = 0;
+	std::vector<std::string> results;
+	fprintf(stderr, "%-6s %-12s %-5s %7s %9s %9s %9s %9s %9s %6s\n", "backend", "method", "cmd", "rss(MB)", "p50(us)", "p99(us)", "p999(us)", "mean(us)", "max(us)", "errors");
+	for (size_t mb : opt.rss_mb) {
+		// 親の RSS を増やす。実際に書き込んでページを割り当てさせる
+		if (mb > ballast_mb) {
+			size_t bytes = (mb - ballast_mb) << 20;
+			ballast.emplace_back(new char[bytes]);
+			memset(ballast.back().get(), 1, bytes);
+			ballast_mb = mb;
+		}
+		size_t rss = bench::current_rss();
+		for (char const *backend : { "posix", "pty" }) {
+			if (!bench::contains(opt.backends, backend)) continue;
+			bool pty = strcmp(backend, "pty") == 0;
+			for (Method const &m : methods) {
+				if (!bench::contains(opt.methods, m.name)) continue;
+				if (pty && m.method == ProcessPosixSpawner::Method::Helper) continue; // PTY では PosixSpawn と同じ
+				for (Command const &cmd : commands) {
+					for (int i = 0; i < opt.warmup; i++) {
+						run_once(pty, m.method, cmd);
+					}
+					std::vector<double> samples;
+					samples.reserve(opt.iterations);
+					long long errors = 0;
+					for (int i = 0; i < opt.iterations; i++) {
+						double us = run_once(pty, m.method, cmd);
+						if (us < 0) {
+							errors++;
+						} else {
+							samples.push_back(us);
+						}
+					}
+					bench::Summary s = bench::summarize(samples);
+					fprintf(stderr, "%-6s %-12s %-5s %7zu %9.1f %9.1f %9.1f %9.1f %9.1f %6lld\n", backend, m.name, cmd.name, rss >> 20, s.p50, s.p99, s.p999, s.mean, s.max, errors);
+					bench::JsonObject o;
+					o.add("backend", backend)
+						.add("method", m.name)
+						.add("command", cmd.command)
+						.add("ballast_mb", (long long)mb)
+						.add("rss_bytes", (long long)rss)
+						.add("iterations", (long long)opt.iterations)
+						.add("errors", errors)
+						.add("min_us", s.min)
+						.add("mean_us", s.mean)
+						.add("p50_us", s.p50)
+						.add("p90_us", s.p90)
+						.add("p99_us", s.p99)
+						.add("p999_us", s.p999)
+						.add("max_us", s.max);
+					results.push_back(o.str());
+				}
+			}
+		}
+	}
+
+	printf("{\n  \"benchmark\": \"spawn_latency\",\n  \"results\": %s\n}\n", bench::json_array(results).c_str());
+	return 0;
+}
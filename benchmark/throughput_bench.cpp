@@ -0,0 +1,203 @@
+// 出力の吸い出し速度。全力で書き続ける子 (process-bench produce) から N MB を読み取り、
+// バックエンドと取り込み方ごとに MB/s、親の CPU 時間、最大 RSS を測る。
+// リアクタの方式 (io_uring / epoll) は PROCESS_REACTOR_BACKEND で切り替えて比べる。
+
+#include "BasicProcessPosix.h"
+#include "ProcessPosixReactor.h"
+#include "bench_util.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+struct Options {
+	size_t size_mb = 1024;
+	std::vector<size_t> chunks = { 4096, 65536, 1 << 20 };
+	std::vector<std::string> modes;
+};
+
+struct Mode {
+	char const *backend;
+	char const *name;
+	char const *description;
+};
+
+Mode const modes[] = {
+	{ "posix", "vector", "ProcessPosix, output accumulated in memory (default)" },
+	{ "posix", "callback", "ProcessPosix, chunk callback only (set_accumulate_output(false))" },
+	{ "posix", "spill", "ProcessPosix, spilled to a temp file above 64 MB" },
+	{ "posix", "file", "ProcessPosix, Capture::File (child writes to memfd)" },
+	{ "pty", "vector", "ProcessPosixPty, result vector (read_output() queue capped at 1 MB)" },
+	{ "pty", "spill", "ProcessPosixPty, spilled to a temp file above 64 MB" },
+	{ "pty", "vt_stripped", "ProcessPosixPty, VT sequences stripped on the reactor thread" },
+};
+
+size_t const spill_threshold = 64 << 20;
+
+std::string mode_id(Mode const &m)
+{
+	return std::string(m.backend) + "/" + m.name;
+}
+
+char const *reactor_backend_name()
+{
+	switch (ProcessPosixReactor::instance().backend()) {
+	case ProcessPosixReactor::Backend::IoUring:
+		return "io_uring";
+	case ProcessPosixReactor::Backend::Epoll:
+		return "epoll";
+	case ProcessPosixReactor::Backend::Poll:
+		return "poll";
+	}
+	return "unknown";
+}
+
+struct Result {
+	size_t bytes = 0; // 受け取った量
+	double seconds = 0;
+	double cpu = 0;
+	size_t peak_rss = 0;
+	int exit_code = -1;
+};
+
+Result run(Mode const &m, std::string const &command)
+{
+	Result r;
+	bench::reset_peak_rss();
+	double cpu0 = bench::cpu_seconds();
+	auto t0 = bench::Clock::now();
+	if (strcmp(m.backend, "pty") == 0) {
+		ProcessPosixPty proc;
+		proc.set_max_output_queue_size(1 << 20);
+		if (strcmp(m.name, "spill") == 0) {
+			proc.set_spill_threshold(spill_threshold);
+		} else if (strcmp(m.name, "vt_stripped") == 0) {
+			proc.set_vt_stripped(true);
+		}
+		proc.start(command, { }, false);
+		r.exit_code = proc.wait();
+		r.seconds = bench::seconds_since(t0);
+		r.bytes = proc.stdout_view().size();
+	} else {
+		ProcessPosix proc;
+		size_t received = 0;
+		if (strcmp(m.name, "callback") == 0) {
+			proc.set_accumulate_output(false);
+			proc.set_stdout_callback([&](char const *, size_t len) {
+				received += len;
+			});
+		} else if (strcmp(m.name, "spill") == 0) {
+			proc.set_spill_threshold(spill_threshold);
+		} else if (strcmp(m.name, "file") == 0) {
+			proc.set_stdout_capture(ProcessPosix::Capture::File);
+		}
+		proc.start(command, false);
+		r.exit_code = proc.wait();
+		r.seconds = bench::seconds_since(t0);
+		r.bytes = strcmp(m.name, "callback") == 0 ? received : proc.stdout_view().size();
+	}
+	r.cpu = bench::cpu_seconds() - cpu0;
+	r.peak_rss = bench::peak_rss();
+	return r;
+}
+
+bool parse(int argc, char **argv, Options *opt)
+{
+	for (int i = 0; i < argc; i++) {
+		char const *a = argv[i];
+		char const *v = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!v) {
+			fprintf(stderr, "missing value for %s\n", a);
+			return false;
+		}
+		if (strcmp(a, "--size") == 0) {
+			opt->size_mb = std::max<size_t>(1, strtoul(v, nullptr, 10));
+		} else if (strcmp(a, "--chunk") == 0) {
+			opt->chunks.clear();
+			for (std::string const &s : bench::split_list(v)) {
+				size_t n = strtoul(s.c_str(), nullptr, 10);
+				if (n > 0) opt->chunks.push_back(n);
+			}
+		} else if (strcmp(a, "--mode") == 0) {
+			opt->modes = bench::split_list(v);
+		} else {
+			fprintf(stderr, "unknown option: %s\n", a);
+			return false;
+		}
+		i++;
+	}
+	return !opt->chunks.empty();
+}
+
+} // namespace
+
+// 子として動き、bytes バイトを chunk バイトずつ stdout へ書く
+int produce_main(int argc, char **argv)
+{
+	if (argc < 2) return 2;
+	unsigned long long total = strtoull(argv[0], nullptr, 10);
+	size_t chunk = std::max<size_t>(1, strtoul(argv[1], nullptr, 10));
+	// 改行を含む平文 (VT シーケンスは含まない)
+	std::vector<char> buf(chunk);
+	for (size_t i = 0; i < chunk; i++) {
+		buf[i] = i % 64 == 63 ? '\n' : char('a' + i % 26);
+	}
+	while (total > 0) {
+		size_t n = (size_t)std::min<unsigned long long>(total, chunk);
+		char const *p = buf.data();
+		while (n > 0) {
+			ssize_t w = write(STDOUT_FILENO, p, n);
+			if (w < 0 && errno == EINTR) continue;
+			if (w <= 0) return 1;
+			p += w;
+			n -= (size_t)w;
+			total -= (size_t)w;
+		}
+	}
+	return 0;
+}
+
+int throughput_bench_main(char const *self, int argc, char **argv)
+{
+	Options opt;
+	if (!parse(argc, argv, &opt)) {
+		fprintf(stderr, "usage: process-bench throughput [--size MB] [--chunk BYTES,BYTES,...] [--mode posix/vector,pty/spill,...]\n");
+		return 2;
+	}
+	size_t total = opt.size_mb << 20;
+	char const *reactor = reactor_backend_name();
+	fprintf(stderr, "reactor: %s, %zu MB per run\n", reactor, opt.size_mb);
+	fprintf(stderr, "%-18s %9s %10s %9s %10s %12s %6s\n", "mode", "chunk", "MB/s", "cpu(s)", "cpu/GB(s)", "peakRSS(MB)", "ok");
+
+	std::vector<std::string> results;
+	for (size_t chunk : opt.chunks) {
+		std::string command = std::string(self) + " produce " + std::to_string(total) + " " + std::to_string(chunk);
+		for (Mode const &m : modes) {
+			std::string id = mode_id(m);
+			if (!opt.modes.empty() && !bench::contains(opt.modes, id.c_str())) continue;
+			Result r = run(m, command);
+			bool ok = r.exit_code == 0 && r.bytes == total;
+			double mb = r.bytes / (1024.0 * 1024.0);
+			double mbps = r.seconds > 0 ? mb / r.seconds : 0;
+			double cpu_per_gb = mb > 0 ? r.cpu / (mb / 1024.0) : 0;
+			fprintf(stderr, "%-18s %9zu %10.1f %9.3f %10.3f %12.1f %6s\n", id.c_str(), chunk, mbps, r.cpu, cpu_per_gb, r.peak_rss / (1024.0 * 1024.0), ok ? "yes" : "NO");
+			bench::JsonObject o;
+			o.add("backend", m.backend)
+				.add("mode", m.name)
+				.add("description", m.description)
+				.add("chunk_bytes", (long long)chunk)
+				.add("bytes", (long long)r.bytes)
+				.add("expected_bytes", (long long)total)
+				.add("exit_code", (long long)r.exit_code)
+				.add("seconds", r.seconds)
+				.add("mb_per_s", mbps)
+				.add("parent_cpu_s", r.cpu)
+				.add("peak_rss_bytes", (long long)r.peak_rss);
+			results.push_back(o.str());
+		}
+	}
+
+	printf("{\n  \"benchmark\": \"throughput\",\n  \"reactor\": \"%s\",\n  \"results\": %s\n}\n", reactor, bench::json_array(results).c_str());
+	return 0;
+}
@@ -0,0 +1,185 @@
+// VtStripper の SIMD 版と、従来の1バイトずつ状態を進める実装の比較用マイクロベンチマーク。
+// 平文だけの出力、色付きの出力 (ls --color や grep --color 相当)、カーソル移動の多い
+// 全画面アプリの出力を、PTY から読み取るのと同じ程度の塊に分けて流す。
+
+#include "VtStripper.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+namespace {
+
+// 移行前の実装 (src/ProcessWinHelper.h にあったもの)
+class LegacyVtStripper {
+public:
+	std::string append(std::string_view input)
+	{
+		std::string output;
+		for (unsigned char c : input) {
+			switch (state_) {
+			case State::Text:
+				if (c == 0x1b) {
+					state_ = State::Escape;
+				} else {
+					output.push_back(static_cast<char>(c));
+				}
+				break;
+			case State::Escape:
+				if (c == '[') {
+					state_ = State::Csi;
+				} else if (c == ']') {
+					state_ = State::Osc;
+				} else if (c == 'P' || c == 'X' || c == '^' || c == '_') {
+					state_ = State::String;
+				} else if (c >= 0x20 && c <= 0x2f) {
+					state_ = State::EscapeIntermediate;
+				} else if (c == 0x1b) {
+					state_ = State::Escape;
+				} else {
+					state_ = State::Text;
+				}
+				break;
+			case State::EscapeIntermediate:
+				if (c >= 0x30 && c <= 0x7e) {
+					state_ = State::Text;
+				} else if (c == 0x1b) {
+					state_ = State::Escape;
+				}
+				break;
+			case State::Csi:
+				if (c >= 0x40 && c <= 0x7e) {
+					state_ = State::Text;
+				} else if (c == 0x1b) {
+					state_ = State::Escape;
+				}
+				break;
+			case State::Osc:
+				if (c == 0x07) {
+					state_ = State::Text;
+				} else if (c == 0x1b) {
+					state_ = State::OscEscape;
+				}
+				break;
+			case State::OscEscape:
+				if (c == '\\') {
+					state_ = State::Text;
+				} else if (c != 0x1b) {
+					state_ = State::Osc;
+				}
+				break;
+			case State::String:
+				if (c == 0x1b) {
+					state_ = State::StringEscape;
+				}
+				break;
+			case State::StringEscape:
+				if (c == '\\') {
+					state_ = State::Text;
+				} else if (c != 0x1b) {
+					state_ = State::String;
+				}
+				break;
+			}
+		}
+		return output;
+	}
+
+private:
+	enum class State {
+		Text,
+		Escape,
+		EscapeIntermediate,
+		Csi,
+		Osc,
+		OscEscape,
+		String,
+		StringEscape,
+	};
+
+	State state_ = State::Text;
+};
+
+struct Result {
+	double seconds = 0;
+	std::string output;
+};
+
+std::string make_plain(size_t size)
+{
+	std::string s;
+	unsigned n = 0;
+	while (s.size() < size) {
+		s += "drwxr-xr-x  2 user group  4096 Jan  1 00:00 directory-" + std::to_string(n++) + "\n";
+	}
+	return s;
+}
+
+std::string make_colored(size_t size)
+{
+	std::string s;
+	unsigned n = 0;
+	while (s.size() < size) {
+		s += "src/file" + std::to_string(n++) + ".cpp:\x1b[32m42\x1b[0m:  int \x1b[01;31m\x1b[Kmatch\x1b[m\x1b[K = compute(value);\n";
+	}
+	return s;
+}
+
+std::string make_fullscreen(size_t size)
+{
+	std::string s;
+	unsigned n = 0;
+	while (s.size() < size) {
+		s += "\x1b[" + std::to_string(n % 50 + 1) + ";1H\x1b[2K\x1b[7m" + std::to_string(n) + "\x1b[27m top\x1b]0;title\x07";
+		n++;
+	}
+	return s;
+}
+
+template <typename F> Result run(std::string const &input, size_t chunk, F fn)
+{
+	Result r;
+	r.output.reserve(input.size());
+	auto t0 = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < input.size(); i += chunk) {
+		size_t n = std::min(chunk, input.size() - i);
+		fn(input.data() + i, n, &r.output);
+	}
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	return r;
+}
+
+void bench(char const *name, std::string const &input, size_t chunk)
+{
+	LegacyVtStripper legacy;
+	Result a = run(input, chunk, [&](char const *ptr, size_t len, std::string *out) {
+		*out += legacy.append(std::string_view(ptr, len));
+	});
+	VtStripper simd;
+	Result b = run(input, chunk, [&](char const *ptr, size_t len, std::string *out) {
+		simd.append(ptr, len, out);
+	});
+	double mb = input.size() / (1024.0 * 1024.0);
+	printf("%-24s legacy %8.1f MB/s   VtStripper %8.1f MB/s   x%.1f%s\n", name, mb / a.seconds, mb / b.seconds, a.seconds / b.seconds, a.output == b.output ? "" : "   (output mismatch!)");
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+	size_t mb = argc > 1 ? strtoul(argv[1], nullptr, 10) : 64;
+	if (mb == 0) mb = 64;
+	size_t total = mb * 1024 * 1024;
+
+	std::string const plain = make_plain(total);
+	std::string const colored = make_colored(total);
+	std::string const fullscreen = make_fullscreen(total);
+	for (size_t chunk : { (size_t)4096, (size_t)65536 }) {
+		printf("chunk %zu bytes\n", chunk);
+		bench("  plain text", plain, chunk);
+		bench("  colored (grep --color)", colored, chunk);
+		bench("  full screen (top)", fullscreen, chunk);
+	}
+	return 0;
+}
@@ -0,0 +1,15 @@
+TARGET = bytequeue-bench
+DESTDIR = $$PWD/_bin
+TEMPLATE = app
+CONFIG -= qt
+CONFIG += console
+CONFIG += c++17
+CONFIG += release
+
+INCLUDEPATH += $$PWD/src
+
+HEADERS += \
+	src/ByteQueue.h
+
+SOURCES += \
+	benchmark/bytequeue_bench.cpp
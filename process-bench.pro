@@ -0,0 +1,21 @@
+TARGET = process-bench
+DESTDIR = $$PWD/_bin
+TEMPLATE = app
+CONFIG -= qt
+CONFIG += console
+CONFIG += c++17
+CONFIG += release
+
+PROCESS_SRC = $$PWD/src
+PROCESS_PRI = $$PROCESS_SRC/../process.pri
+INCLUDEPATH += $$PROCESS_SRC
+DISTFILES += $$PROCESS_PRI
+include($$PROCESS_PRI)
+
+HEADERS += \
+	benchmark/bench_util.h
+
+SOURCES += \
+	benchmark/process_bench.cpp \
+	benchmark/spawn_bench.cpp \
+	benchmark/throughput_bench.cpp
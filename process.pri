@@ -1,8 +1,22 @@
 
 SOURCES += $$PROCESS_SRC/AbstractProcess.cpp
+SOURCES += $$PROCESS_SRC/CaptureBuffer.cpp
+SOURCES += $$PROCESS_SRC/MultiPatternMatcher.cpp
 SOURCES += $$PROCESS_SRC/ProcessHelper.cpp
+SOURCES += $$PROCESS_SRC/ProcessMetrics.cpp
+SOURCES += $$PROCESS_SRC/ProcessTrace.cpp
+SOURCES += $$PROCESS_SRC/VtScreen.cpp
+SOURCES += $$PROCESS_SRC/VtStripper.cpp
 
 !win32:SOURCES += $$PROCESS_SRC/BasicProcessPosix.cpp
+!win32:SOURCES += $$PROCESS_SRC/ProcessPosixReactor.cpp
+!win32:SOURCES += $$PROCESS_SRC/ProcessPosixUring.cpp
+!win32:SOURCES += $$PROCESS_SRC/ProcessPosixSpawn.cpp
+!win32:SOURCES += $$PROCESS_SRC/ProcessSpawnHelper.cpp
+!win32:SOURCES += $$PROCESS_SRC/ProcessPool.cpp
+!win32:SOURCES += $$PROCESS_SRC/ProcessPipeline.cpp
+!win32:SOURCES += $$PROCESS_SRC/ProcessExpect.cpp
+!win32:SOURCES += $$PROCESS_SRC/TimerWheel.cpp
 
 win32 {
 	SOURCES += \
@@ -15,9 +29,24 @@ win32 {
 }
 
 HEADERS += $$PROCESS_SRC/AbstractProcess.h
+HEADERS += $$PROCESS_SRC/ByteQueue.h
+HEADERS += $$PROCESS_SRC/CaptureBuffer.h
+HEADERS += $$PROCESS_SRC/MultiPatternMatcher.h
 HEADERS += $$PROCESS_SRC/ProcessHelper.h
+HEADERS += $$PROCESS_SRC/ProcessMetrics.h
+HEADERS += $$PROCESS_SRC/ProcessTrace.h
+HEADERS += $$PROCESS_SRC/VtScreen.h
+HEADERS += $$PROCESS_SRC/VtStripper.h
 
 !win32:HEADERS += $$PROCESS_SRC/BasicProcessPosix.h
+!win32:HEADERS += $$PROCESS_SRC/ProcessPosixReactor.h
+!win32:HEADERS += $$PROCESS_SRC/ProcessPosixUring.h
+!win32:HEADERS += $$PROCESS_SRC/ProcessPosixSpawn.h
+!win32:HEADERS += $$PROCESS_SRC/ProcessSpawnHelper.h
+!win32:HEADERS += $$PROCESS_SRC/ProcessPool.h
+!win32:HEADERS += $$PROCESS_SRC/ProcessPipeline.h
+!win32:HEADERS += $$PROCESS_SRC/ProcessExpect.h
+!win32:HEADERS += $$PROCESS_SRC/TimerWheel.h
 
 win32 {
 	HEADERS += \
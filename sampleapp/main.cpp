@@ -66,8 +66,7 @@ int main_win(std::string const &cmd)
 	ProcessWin proc;
 	proc.start(cmd, false);
 	proc.wait();
-	auto vec = proc.stdout_bytes();
-	std::string_view view(vec.data(), vec.size());
+	std::string_view view = proc.stdout_view();
 	std::string str = std::string(view);
 	printf("[%s]\n", trimmed(str).c_str());
 	return 0;
@@ -122,8 +121,7 @@ int main_win_conpty(std::string const &cmd)
 	ProcessWinConPty proc;
 	proc.start(cmd, {}, false);
 	proc.wait();
-	auto vec = proc.stdout_bytes();
-	std::string_view view(vec.data(), vec.size());
+	std::string_view view = proc.stdout_view();
 	std::string str = std::string(view);
 	printf("[%s]\n", trimmed(str).c_str());
 	return 0;
@@ -166,8 +164,7 @@ int main_basic_posix(int /*argc*/, char ** /*argv*/)
 	ProcessPosix proc;
 	proc.start(cmd, false);
 	proc.wait();
-	auto vec = proc.stdout_bytes();
-	std::string_view view(vec.data(), vec.size());
+	std::string_view view = proc.stdout_view();
 	std::string str = std::string(view);
 	puts(str.c_str());
 	return 0;
@@ -180,8 +177,7 @@ int main_basic_posix_pty(int /*argc*/, char ** /*argv*/)
 	ProcessPosixPty proc;
 	proc.start(cmd, {}, false);
 	proc.wait();
-	auto vec = proc.stdout_bytes();
-	std::string_view view(vec.data(), vec.size());
+	std::string_view view = proc.stdout_view();
 	std::string str = std::string(view);
 	puts(str.c_str());
 	return 0;
@@ -1,16 +1,33 @@
 #include "AbstractProcess.h"
-#include <algorithm>
+#include "ProcessMetrics.h"
+
+void AbstractPtyProcess::begin_output()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	output_waiters_.reset();
+	if (screen_) {
+		screen_->reset();
+	}
+}
 
 void AbstractPtyProcess::write_output(char const *buf, size_t len)
 {
+	ProcessMetrics::add(ProcessMetrics::PtyOutputBytes, len);
+	if (output_fn_) {
+		output_fn_(buf, len);
+	}
 	std::lock_guard<std::mutex> lock(mutex_);
-	output_queue_.insert(output_queue_.end(), buf, buf + len);
-	if (max_output_queue_size_ > 0) {
-		while (output_queue_.size() > max_output_queue_size_) {
-			output_queue_.pop_front();
-		}
+	if (output_waiters_.feed(buf, len)) {
+		cond_.notify_all();
+	}
+	output_queue_.append(buf, len);
+	if (max_output_queue_size_ > 0 && output_queue_.size() > max_output_queue_size_) {
+		output_queue_.discard(output_queue_.size() - max_output_queue_size_);
+	}
+	output_vector_.append(buf, len);
+	if (screen_) {
+		screen_->feed(buf, len);
 	}
-	output_vector_.insert(output_vector_.end(), buf, buf + len);
 }
 
 int AbstractPtyProcess::pop_output(char *ptr, int len)
@@ -19,25 +36,96 @@ int AbstractPtyProcess::pop_output(char *ptr, int len)
 		return 0;
 	}
 	std::lock_guard<std::mutex> lock(mutex_);
-	int n = std::min(len, static_cast<int>(output_queue_.size()));
-	if (n > 0) {
-		auto it = output_queue_.begin();
-		std::copy(it, it + n, ptr);
-		output_queue_.erase(it, it + n);
+	return static_cast<int>(output_queue_.pop(ptr, static_cast<size_t>(len)));
+}
+
+void AbstractPtyProcess::finish_output()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	output_vector_.finish();
+	stdout_capture_ = std::move(output_vector_);
+	if (stdout_capture_.spilled()) {
+		stdout_bytes_.clear();
+	} else {
+		stdout_bytes_ = stdout_capture_.take_vector();
 	}
-	return n;
 }
 
-std::string AbstractPtyProcess::get_message() const // deprecated
+int AbstractPtyProcess::wait_for_any_output(std::vector<std::string> const &patterns, int timeout_ms)
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	return output_waiters_.wait(lock, cond_, patterns, output_vector_.view(), timeout_ms);
+}
+
+void AbstractPtyProcess::enable_screen(int rows, int cols, size_t scrollback_lines)
 {
 	std::lock_guard<std::mutex> lock(mutex_);
-	if (stdout_bytes_.empty()) return { };
-	return std::string(&stdout_bytes_[0], stdout_bytes_.size());
+	screen_ = std::make_unique<VtScreen>(rows, cols, scrollback_lines);
+	// cfmakeraw した PTY では \n に \r が付かないので、ログとして読めるよう LF で行頭へ戻す
+	screen_->set_newline_mode(true);
+}
+
+VtScreen::Snapshot AbstractPtyProcess::screen_snapshot(std::vector<int> *dirty_rows)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!screen_) {
+		if (dirty_rows) dirty_rows->clear();
+		return { };
+	}
+	if (dirty_rows) {
+		*dirty_rows = screen_->take_dirty_rows();
+	}
+	return screen_->snapshot();
+}
+
+std::string AbstractPtyProcess::screen_text() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return screen_ ? screen_->rendered_text() : std::string();
+}
+
+std::vector<char> const &AbstractPtyProcess::stdout_bytes() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (stdout_capture_.spilled() && stdout_bytes_.empty()) {
+		std::string_view v = stdout_capture_.view();
+		stdout_bytes_.assign(v.begin(), v.end());
+	}
+	return stdout_bytes_;
+}
+
+std::vector<char> AbstractPtyProcess::take_stdout()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	std::vector<char> v;
+	if (stdout_capture_.spilled()) {
+		v = stdout_capture_.take_vector();
+		stdout_bytes_.clear();
+	} else {
+		v.swap(stdout_bytes_);
+	}
+	return v;
+}
+
+std::string_view AbstractPtyProcess::stdout_view() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (stdout_capture_.spilled()) {
+		return stdout_capture_.view();
+	}
+	return { stdout_bytes_.data(), stdout_bytes_.size() };
+}
+
+std::string AbstractPtyProcess::get_message() const // deprecated
+{
+	std::string_view v = stdout_view();
+	return std::string(v.begin(), v.end());
 }
 
 void AbstractPtyProcess::clear_message()
 {
 	std::lock_guard<std::mutex> lock(mutex_);
 	output_vector_.clear();
+	stdout_capture_.clear();
 	stdout_bytes_.clear();
 }
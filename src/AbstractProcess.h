@@ -1,12 +1,20 @@
 #ifndef ABSTRACTPROCESS_H
 #define ABSTRACTPROCESS_H
 
+#include "ByteQueue.h"
+#include "CaptureBuffer.h"
+#include "MultiPatternMatcher.h"
 #include "ProcessHelper.h"
+#include "VtScreen.h"
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #ifdef APP_GUITAR
@@ -16,12 +24,30 @@
 
 class QString;
 
+// 終了したプロセスの資源使用量。POSIX では回収時に wait4() で得た rusage から作る。
+// (Windows のバックエンドでは取得しておらず、valid は false のまま)
+struct ProcessUsage {
+	bool valid = false;
+	double wall_seconds = 0; // 起動から回収まで
+	double user_cpu_seconds = 0;
+	double system_cpu_seconds = 0;
+	uint64_t max_rss_bytes = 0;
+	uint64_t minor_faults = 0; // ディスク I/O を伴わないページフォルト
+	uint64_t major_faults = 0;
+	uint64_t voluntary_context_switches = 0; // I/O 待ちなどで自分から譲った回数
+	uint64_t involuntary_context_switches = 0; // タイムスライスを使い切って奪われた回数
+};
+
 class AbstractProcess {
 public:
 	virtual ~AbstractProcess() { }
 
 	virtual void start(std::string const &command, bool use_input) = 0;
 	virtual int wait() = 0;
+	// 終了するまで最長 timeout 待つ。終了していれば wait() と同じく結果を取り込んで true を返す。
+	// 時間内に終わらなければ false (プロセスは動き続けるので、再び待つか stop() すること)。
+	// 実行中でなければ即座に true
+	virtual bool wait_for(std::chrono::milliseconds timeout) = 0;
 	virtual void stop() = 0;
 	virtual bool is_running() const = 0;
 	virtual int get_exit_code() const = 0;
@@ -31,6 +57,28 @@ public:
 
 	virtual std::vector<char> const &stdout_bytes() const = 0;
 	virtual std::vector<char> const &stderr_bytes() const = 0;
+
+	// wait() 後の結果をコピーせずに取り出す。以降 stdout_bytes()/stderr_bytes() は空になる。
+	virtual std::vector<char> take_stdout() = 0;
+	virtual std::vector<char> take_stderr() = 0;
+
+	// wait() 後に、終了したプロセスの資源使用量を返す
+	virtual ProcessUsage get_usage() const
+	{
+		return { };
+	}
+
+	// 出力を一時ファイルへ退避した場合は mmap した領域を指す（stdout_bytes() はコピーを作る）
+	virtual std::string_view stdout_view() const
+	{
+		std::vector<char> const &v = stdout_bytes();
+		return { v.data(), v.size() };
+	}
+	virtual std::string_view stderr_view() const
+	{
+		std::vector<char> const &v = stderr_bytes();
+		return { v.data(), v.size() };
+	}
 };
 
 class AbstractPtyProcess {
@@ -42,16 +90,24 @@ protected:
 
 	std::shared_ptr<void> user_data_;
 	std::function<void(bool, std::shared_ptr<void>)> completed_fn_;
+	std::function<void(char const *ptr, size_t len)> output_fn_;
 
-	std::deque<char> output_queue_; // for log
-	std::vector<char> output_vector_; // for result
-	std::vector<char> stdout_bytes_;
+	ByteQueue output_queue_; // for log
+	CaptureBuffer output_vector_; // for result
+	CaptureBuffer stdout_capture_; // 一時ファイルへ退避した結果 (退避していなければ空)
+	mutable std::vector<char> stdout_bytes_; // 退避した場合は stdout_bytes() で初めて作る
 	std::vector<char> stderr_bytes_;
 
 	size_t max_output_queue_size_ = 0; // 0 = unlimited
 
+	OutputWaitList output_waiters_; // wait_for_any_output()
+
+	std::unique_ptr<VtScreen> screen_; // enable_screen() で作る
+
+	void begin_output(); // start() で呼ぶ。出力待ちの状態を初期化する
 	void write_output(char const *buf, size_t len);
 	int pop_output(char *ptr, int len);
+	void finish_output(); // wait() で output_vector_ を結果 (stdout_bytes_) へ移す
 
 public:
 	virtual ~AbstractPtyProcess() { }
@@ -69,6 +125,14 @@ public:
 		max_output_queue_size_ = n;
 	}
 
+	// 結果バッファが bytes を超えたら、dir (空なら $TMPDIR か /tmp) の unlink 済み一時ファイルへ
+	// 退避する (0 = 退避しない)。退避した結果は stdout_view() で mmap した領域として参照できる。
+	void set_spill_threshold(size_t bytes, std::string const &dir = { })
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		output_vector_.set_spill_threshold(bytes, dir);
+	}
+
 	// start() 前に設定すること。実行中の変更はスレッドセーフではない。
 	void set_completion_callback(std::function<void(bool, std::shared_ptr<void>)> fn, std::shared_ptr<void> userdata)
 	{
@@ -76,30 +140,87 @@ public:
 		user_data_ = userdata;
 	}
 
+	// start() 前に設定すること。読み取った出力を塊ごとに、読み取ったスレッド
+	// (ProcessPosixPty ではリアクタスレッド) から渡す。出力が終わると (nullptr, 0) で呼ばれる。
+	void set_output_callback(std::function<void(char const *ptr, size_t len)> fn)
+	{
+		output_fn_ = fn;
+	}
+
+	// start() 前に設定すること。出力を端末エミュレータ (VtScreen) にも渡し、画面を再現する。
+	// 子から見える端末の大きさもこれに合わせる (対応するバックエンドのみ)。
+	// 出力から VT シーケンスを取り除く設定とは併用しないこと。
+	void enable_screen(int rows = 25, int cols = 80, size_t scrollback_lines = 10000);
+	bool screen_enabled() const
+	{
+		return screen_ != nullptr;
+	}
+	// 現在の画面。dirty_rows を渡すと、前回渡したとき以降に変化した行の番号も返す
+	// (UI はその行だけ描き直せばよい)。enable_screen() していなければ空
+	VtScreen::Snapshot screen_snapshot(std::vector<int> *dirty_rows = nullptr);
+	// スクロールバックと画面を合わせた、最終的に表示されているテキスト
+	std::string screen_text() const;
+
 	void notify_completed()
 	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			output_waiters_.close();
+		}
+		cond_.notify_all();
+		if (output_fn_) {
+			output_fn_(nullptr, 0);
+		}
 		if (completed_fn_) {
 			completed_fn_(true, user_data_);
 		}
 	}
 
+	// 出力に patterns のいずれかが現れるまで待ち、その番号を返す。timeout_ms (負なら無期限) が
+	// 過ぎるか、プロセスが終了するまでに現れなければ -1。前回見つかった位置より後ろだけを探すので、
+	// 続けて呼べば順に現れるプロンプトを1つずつ待てる。wait() より前に使うこと。
+	// (write_output() を使わない ProcessWinConPty では見つからない)
+	virtual int wait_for_any_output(std::vector<std::string> const &patterns, int timeout_ms = -1);
+
 	std::string get_message() const; // deprecated
 	void clear_message();
 
-	std::vector<char> const &stdout_bytes() const
-	{
-		return stdout_bytes_;
-	}
+	std::vector<char> const &stdout_bytes() const;
 	std::vector<char> const &stderr_bytes() const
 	{
 		return stderr_bytes_;
 	}
 
+	// wait() 後の結果をコピーせずに取り出す。以降 stdout_bytes()/stderr_bytes() は空になる。
+	// (一時ファイルへ退避していた場合のみコピーになる)
+	std::vector<char> take_stdout();
+	std::vector<char> take_stderr()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::vector<char> v;
+		v.swap(stderr_bytes_);
+		return v;
+	}
+
+	// 一時ファイルへ退避した場合は mmap した領域を指す
+	std::string_view stdout_view() const;
+	std::string_view stderr_view() const
+	{
+		return { stderr_bytes_.data(), stderr_bytes_.size() };
+	}
+
 	virtual void start(std::string const &cmd, std::string const &env, bool use_input) = 0;
 	virtual int wait() = 0;
+	// AbstractProcess::wait_for() と同じ
+	virtual bool wait_for(std::chrono::milliseconds timeout) = 0;
 	virtual void stop() = 0;
 	virtual bool is_running() const = 0;
 	virtual int get_exit_code() const = 0;
+	// wait() 後に、終了したプロセスの資源使用量を返す
+	virtual ProcessUsage get_usage() const
+	{
+		return { };
+	}
 	virtual void write_input(char const *ptr, int len) = 0;
 	virtual int read_output(char *ptr, int len) = 0;
 	virtual void close_input() = 0;
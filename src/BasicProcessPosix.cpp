@@ -1,7 +1,18 @@
 #include "BasicProcessPosix.h"
+#include "ByteQueue.h"
+#include "CaptureBuffer.h"
+#include "MultiPatternMatcher.h"
 #include "ProcessHelper.h"
+#include "ProcessMetrics.h"
+#include "ProcessPosixReactor.h"
+#include "ProcessPosixSpawn.h"
+#include "ProcessSpawnHelper.h"
+#include "ProcessTrace.h"
+#include "VtStripper.h"
+#include <algorithm>
+#include <chrono>
 #include <cstring>
-#include <deque>
+#include <memory>
 #include <mutex>
 
 #ifdef _WIN32
@@ -12,10 +23,13 @@
 #include <csignal>
 #include <cstdio>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <thread>
@@ -27,337 +41,710 @@
 
 #endif
 
-class OutputReaderThread {
+namespace {
+
+// 親側に残す fd が並行して起動された別の子プロセスへ継承されると、その子が
+// パイプの書き込み端を握ったままになり EOF を検出できなくなる。CLOEXEC で作っておく。
+int open_pipe(int fds[2])
+{
+#ifdef __linux__
+	return pipe2(fds, O_CLOEXEC);
+#else
+	if (pipe(fds) < 0) return -1;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+#endif
+}
+
+// 子の stdin/stdout/stderr に渡す fd は、付け替えの途中で標準入出力の番号と衝突しないよう 3 以上の
+// CLOEXEC な fd にしておく。fd は閉じない。失敗したら -1
+int dup_above_stdio(int fd)
+{
+	return fcntl(fd, F_DUPFD_CLOEXEC, 3);
+}
+
+int exit_code_from_status(int status)
+{
+	if (status < 0) return -1; // 回収できなかった
+	if (WIFEXITED(status)) return WEXITSTATUS(status);
+	if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+	return -1;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point t)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+}
+
+uint64_t nanoseconds_since(std::chrono::steady_clock::time_point t)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t).count();
+}
+
+using process::helper::wait_until;
+
+// 1回の writev() でまとめて送り出すチャンクの最大数 (ByteQueue の既定のチャンクで 1MB 分)
+size_t const InputIovecs = 64;
+
+} // namespace
+
+// ProcessPosix の1回分の実行状態。
+// I/O と子プロセスの回収は共有リアクタ (ProcessPosixReactor) が行うので、
+// リアクタのコールバックからも参照できるよう shared_ptr で寿命を管理する。
+class ProcessPosixJob : public std::enable_shared_from_this<ProcessPosixJob> {
+public:
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::condition_variable input_cond; // inq に空きができたか、stdin を閉じた
+	std::vector<std::string> argvec;
+	std::vector<char *> args;
+	ByteQueue inq;
+	// wait() でそのまま結果へ move するので、チャンク列ではなく連続領域 (または一時ファイル) に溜める
+	CaptureBuffer outq;
+	CaptureBuffer errq;
+	OutputWaitList stdout_waiters; // wait_for_any_output()
+	bool use_input = false;
+	ProcessPosixSpawner::Method spawn_method = ProcessPosixSpawner::Method::Fork;
+	int fd_in = -1; // 子の stdin へ書き込む端
+	int fd_out = -1;
+	int fd_err = -1;
+	std::atomic<pid_t> pid { 0 };
+	uint32_t helper_id = 0; // ProcessSpawnHelper 経由で起動した場合のセッションID
+	int exit_code = -1;
+	ProcessUsage usage;
+	std::chrono::steady_clock::time_point started;
+	std::chrono::steady_clock::time_point exited_at;
+	uint64_t trace_id = ProcessTrace::new_id();
+	int error_code = 0;
+	std::string error_message;
+	bool close_input_later = false;
+	bool flush_posted = false;
+	size_t input_limit = 0; // inq に溜める上限 (0 = 無制限)
+	// パイプを作らずに子へそのまま渡す fd (spawn() で閉じる)。-1 ならパイプ、InheritFd なら親のものを使わせる
+	static int const InheritFd = -2;
+	int stdin_file = -1;
+	int stdout_file = -1;
+	int stderr_file = -1;
+	std::string_view stdin_buffer; // パイプ経由で子の stdin へ流すメモリ (inq は使わない)
+	bool stdin_from_buffer = false;
+	bool done = false;
+	std::function<void()> completed_fn;
+	std::function<void(char const *ptr, size_t len)> stdout_fn;
+	std::function<void(char const *ptr, size_t len)> stderr_fn;
+	bool accumulate = true;
+	bool stdout_to_file = false; // ProcessPosix::Capture::File
+	bool stderr_to_file = false;
+
+	// 以下はリアクタスレッドからのみ触る
+	bool exited = false;
+	bool got_output = false;
+	bool timed_out = false; // 実行時間の上限で終了させた (done の後は他のスレッドから読んでよい)
+	uint64_t kill_timer = 0;
+	uint64_t timeout_timer = 0;
+	size_t stdin_buffer_sent = 0;
+
 private:
-	int fd;
-	std::thread thread_;
-	std::mutex *mutex_;
-	std::deque<char> *buffer_;
+	static ProcessPosixReactor &reactor()
+	{
+		return ProcessPosixReactor::instance();
+	}
 
-protected:
-	void run()
+	// mutex を保持して呼ぶこと
+	void close_input_now()
 	{
-		while (1) {
-			char buf[1024];
-			int n = read(fd, buf, sizeof(buf));
-			if (n < 1) break;
-			if (buffer_) {
-				std::lock_guard<std::mutex> lock(*mutex_);
-				buffer_->insert(buffer_->end(), buf, buf + n);
-			}
+		if (fd_in >= 0) {
+			reactor().unwatch_writable(fd_in);
+			close(fd_in);
+			fd_in = -1;
 		}
+		input_cond.notify_all();
 	}
 
-public:
-	OutputReaderThread(int fd, std::mutex *mutex, std::deque<char> *out)
-		: fd(fd)
-		, mutex_(mutex)
-		, buffer_(out)
+	// パイプが一杯。子が読み進めて書き込み可能になったら続きを書く
+	void flush_when_writable()
 	{
+		auto self = shared_from_this();
+		reactor().watch_writable(fd_in, [self]() {
+			self->flush_input();
+		});
 	}
-	~OutputReaderThread()
+
+	// stdin_buffer の残りをパイプへ書けるだけ書き、書き終えたら閉じる。Linux では vmsplice() で
+	// ユーザー空間のページをパイプに参照させるだけなので、コピーしない。mutex を保持して呼ぶこと
+	void flush_buffer()
 	{
-		stop();
+		while (stdin_buffer_sent < stdin_buffer.size()) {
+			char const *ptr = stdin_buffer.data() + stdin_buffer_sent;
+			size_t len = stdin_buffer.size() - stdin_buffer_sent;
+#ifdef __linux__
+			struct iovec iov = { const_cast<char *>(ptr), len };
+			ssize_t r = vmsplice(fd_in, &iov, 1, SPLICE_F_NONBLOCK);
+			if (r < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				r = write(fd_in, ptr, len);
+			}
+#else
+			ssize_t r = write(fd_in, ptr, len);
+#endif
+			if (r < 0) {
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					flush_when_writable();
+					return;
+				}
+				break; // EPIPE など。子は残りを読まない
+			}
+			ProcessTrace::record(ProcessTrace::Event::StdinWrite, trace_id, pid, (uint64_t)r);
+			ProcessMetrics::add(ProcessMetrics::StdinBytes, (uint64_t)r);
+			stdin_buffer_sent += (size_t)r;
+		}
+		close_input_now();
 	}
-	void start()
+
+	// リアクタスレッドで、溜まった入力を非ブロッキングの fd_in へ書けるだけ書く。
+	// チャンクは writev() でコピーせずにまとめて渡す
+	void flush_input()
 	{
-		stop();
-		thread_ = std::thread([this]() {
-			run();
-		});
+		std::lock_guard<std::mutex> lock(mutex);
+		flush_posted = false;
+		if (fd_in < 0) {
+			inq.clear();
+			input_cond.notify_all();
+			return;
+		}
+		if (stdin_from_buffer) {
+			flush_buffer();
+			return;
+		}
+		while (!inq.empty()) {
+			std::string_view spans[InputIovecs];
+			struct iovec iov[InputIovecs];
+			size_t n = inq.front_spans(spans, InputIovecs);
+			size_t total = 0;
+			for (size_t i = 0; i < n; i++) {
+				iov[i].iov_base = const_cast<char *>(spans[i].data());
+				iov[i].iov_len = spans[i].size();
+				total += spans[i].size();
+			}
+			ssize_t r = writev(fd_in, iov, (int)n);
+			if (r < 0) {
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					flush_when_writable();
+					return;
+				}
+				// EPIPE など。子プロセスが標準入力を閉じている（またはすでに終了した）。
+				// これ以上書き込めないので入力側を閉じて諦める。
+				close_input_now();
+				inq.clear();
+				return;
+			}
+			ProcessTrace::record(ProcessTrace::Event::StdinWrite, trace_id, pid, (uint64_t)r);
+			ProcessMetrics::add(ProcessMetrics::StdinBytes, (uint64_t)r);
+			inq.discard(r);
+			if (input_limit > 0) {
+				input_cond.notify_all();
+			}
+			if ((size_t)r < total) {
+				// 一部しか書けなかったのはパイプの空きが尽きたから。EAGAIN を確かめる write を省いて待つ
+				flush_when_writable();
+				return;
+			}
+		}
+		if (close_input_later) {
+			close_input_now();
+		}
 	}
-	void stop()
+
+	void trace_read(size_t len)
 	{
-		if (thread_.joinable()) {
-			thread_.join();
+		if (!ProcessTrace::enabled()) return;
+		if (!got_output) {
+			got_output = true;
+			ProcessTrace::record(ProcessTrace::Event::FirstByte, trace_id, pid);
 		}
+		ProcessTrace::record(ProcessTrace::Event::Read, trace_id, pid, len);
 	}
-	void wait()
+
+	// リアクタスレッド上で、読み取った塊ごとに呼ばれる
+	void on_stdout(char const *ptr, size_t len)
 	{
-		stop();
+		trace_read(len);
+		ProcessMetrics::add(ProcessMetrics::StdoutBytes, len);
+		if (stdout_fn) {
+			stdout_fn(ptr, len);
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if (stdout_waiters.feed(ptr, len)) {
+			cond.notify_all();
+		}
+		if (accumulate) {
+			outq.append(ptr, len);
+		}
 	}
-};
 
-class ProcessPosixThread {
-public:
-	std::thread thread;
-	std::mutex *mutex = nullptr;
-	std::vector<std::string> argvec;
-	std::vector<char *> args;
-	std::deque<char> inq;
-	std::deque<char> outq;
-	std::deque<char> errq;
-	bool use_input = false;
-	int fd_in_read = -1;
-	std::atomic<pid_t> pid { 0 };
-	std::atomic<long long> term_deadline_ms { 0 };
-	int exit_code = -1;
-	int error_code = 0;
-	std::string error_message;
-	bool close_input_later = false;
+	void on_stderr(char const *ptr, size_t len)
+	{
+		trace_read(len);
+		ProcessMetrics::add(ProcessMetrics::StderrBytes, len);
+		if (stderr_fn) {
+			stderr_fn(ptr, len);
+		}
+		if (accumulate) {
+			std::lock_guard<std::mutex> lock(mutex);
+			errq.append(ptr, len);
+		}
+	}
 
-protected:
-public:
-	void init(std::mutex *mutex, bool use_input)
+	void try_finish()
 	{
-		this->mutex = mutex;
-		this->use_input = use_input;
+		if (fd_out >= 0 || fd_err >= 0 || !exited) return;
+		reactor().cancel_timer(kill_timer);
+		kill_timer = 0;
+		reactor().cancel_timer(timeout_timer);
+		timeout_timer = 0;
+		// ProcessPosixPty と同じく、完了通知を済ませてから wait() を返す
+		if (completed_fn) {
+			uint64_t t = ProcessTrace::start_ns();
+			completed_fn();
+			ProcessTrace::complete(ProcessTrace::Event::Callback, trace_id, t);
+		}
+		ProcessTrace::end(trace_id, exit_code);
+		ProcessMetrics::record(ProcessMetrics::ExitLatency, nanoseconds_since(exited_at));
+		std::lock_guard<std::mutex> lock(mutex);
+		close_input_now();
+		stdout_waiters.close();
+		done = true;
+		cond.notify_all();
 	}
-	void reset()
+
+	void on_exit(int status, struct rusage const &ru)
 	{
-		argvec.clear();
-		args.clear();
-		inq.clear();
-		outq.clear();
-		errq.clear();
-		use_input = false;
-		fd_in_read = -1;
+		exit_code = exit_code_from_status(status);
+		if (status >= 0) {
+			ProcessPosixSpawner::make_usage(ru, seconds_since(started), &usage);
+		}
+		ProcessTrace::record(ProcessTrace::Event::Reap, trace_id, pid, (uint64_t)(int64_t)exit_code);
+		exited_at = std::chrono::steady_clock::now();
+		ProcessMetrics::add(ProcessMetrics::Exits);
+		ProcessMetrics::record_exit_code(exit_code);
+		ProcessMetrics::record(ProcessMetrics::RunTime, nanoseconds_since(started));
+		exited = true;
 		pid = 0;
-		term_deadline_ms = 0;
-		exit_code = -1;
-		close_input_later = false;
+		try_finish();
+	}
+
+	// 子の起動と入出力を常駐ヘルパーに任せる。出力と終了はフレームとして
+	// リアクタスレッドへ届くので、パイプの場合と同じ経路 (on_stdout/on_stderr) で処理する。
+	bool spawn_with_helper()
+	{
+		std::weak_ptr<ProcessPosixJob> weak = shared_from_this();
+		ProcessTrace::record(ProcessTrace::Event::Spawn, trace_id);
+		ProcessSpawnHelper::Request req;
+		req.argv = argvec;
+		ProcessSpawnHelper::Callbacks cb;
+		cb.on_stdout = [weak](char const *ptr, size_t len) {
+			if (auto self = weak.lock()) {
+				self->on_stdout(ptr, len);
+			}
+		};
+		cb.on_stderr = [weak](char const *ptr, size_t len) {
+			if (auto self = weak.lock()) {
+				self->on_stderr(ptr, len);
+			}
+		};
+		cb.on_exit = [weak](int status, struct rusage const &ru) {
+			if (auto self = weak.lock()) {
+				self->on_exit(status, ru);
+			}
+		};
+		helper_id = ProcessSpawnHelper::instance().spawn(req, cb);
+		if (helper_id == 0) {
+			error_code = EAGAIN;
+			error_message = "failed: spawn helper";
+			ProcessTrace::end(trace_id, -1);
+			ProcessMetrics::add(ProcessMetrics::SpawnFailures);
+			fprintf(stderr, "%s\n", error_message.c_str());
+			return false;
+		}
+		ProcessMetrics::add(ProcessMetrics::Spawns);
+		if (!use_input) {
+			ProcessSpawnHelper::instance().close_stdin(helper_id, true);
+		}
+		return true;
 	}
 
-protected:
-	void run()
+public:
+	bool spawn()
 	{
+		started = std::chrono::steady_clock::now();
+		if (ProcessTrace::enabled()) {
+			std::string label;
+			for (std::string const &a : argvec) {
+				if (!label.empty()) label += ' ';
+				label += a;
+			}
+			ProcessTrace::begin(trace_id, label);
+		}
+		if (spawn_method == ProcessPosixSpawner::Method::Helper) {
+			return spawn_with_helper();
+		}
+
 		exit_code = -1;
 		int const R = 0;
 		int const W = 1;
-		int const E = 2;
-		int stdin_pipe[3] = { -1, -1, -1 };
-		int stdout_pipe[3] = { -1, -1, -1 };
-		int stderr_pipe[3] = { -1, -1, -1 };
-		int fd_out_write;
-		int fd_err_write;
+		int stdin_pipe[2] = { -1, -1 };
+		int stdout_pipe[2] = { -1, -1 };
+		int stderr_pipe[2] = { -1, -1 };
 		pid_t child_pid;
 
-		// 子プロセスがstdinを閉じた後にwriteするとSIGPIPEが発生する。
-		// デフォルト動作ではホストプロセスごと終了してしまうため、このスレッドでは
-		// SIGPIPEをブロックし、writeのEPIPEエラーとしてハンドリングする。
-		{
-			sigset_t set;
-			sigemptyset(&set);
-			sigaddset(&set, SIGPIPE);
-			pthread_sigmask(SIG_BLOCK, &set, nullptr);
-		}
-
-		if (pipe(stdin_pipe) < 0) {
+		// 取り込まないストリームは子にそのまま渡すので、パイプを作らない
+		if (stdin_file == -1 && open_pipe(stdin_pipe) < 0) {
 			error_code = errno;
 			error_message = "failed: pipe (stdin)";
 			goto fail;
 		}
 
-		if (pipe(stdout_pipe) < 0) {
-			error_code = errno;
-			error_message = "failed: pipe (stdout)";
-			goto fail;
+		// Capture::File の場合は子の出力先を直接ファイルにする (作れなければパイプにする)
+		if (stdout_file == -1) {
+			if (stdout_to_file) {
+				stdout_pipe[W] = CaptureBuffer::create_file();
+			}
+			if (stdout_pipe[W] < 0 && open_pipe(stdout_pipe) < 0) {
+				error_code = errno;
+				error_message = "failed: pipe (stdout)";
+				goto fail;
+			}
 		}
 
-		if (pipe(stderr_pipe) < 0) {
-			error_code = errno;
-			error_message = "failed: pipe (stderr)";
-			goto fail;
+		if (stderr_file == -1) {
+			if (stderr_to_file) {
+				stderr_pipe[W] = CaptureBuffer::create_file();
+			}
+			if (stderr_pipe[W] < 0 && open_pipe(stderr_pipe) < 0) {
+				error_code = errno;
+				error_message = "failed: pipe (stderr)";
+				goto fail;
+			}
 		}
 
-		child_pid = fork();
+		{
+			// Params の -1 は親の fd をそのまま引き継ぐ
+			auto child_fd = [](int file, int pipe_end) {
+				if (file == InheritFd) return -1;
+				return file >= 0 ? file : pipe_end;
+			};
+			ProcessPosixSpawner::Params params;
+			params.argv = &args[0];
+			params.fd_in = child_fd(stdin_file, stdin_pipe[R]);
+			params.fd_out = child_fd(stdout_file, stdout_pipe[W]);
+			params.fd_err = child_fd(stderr_file, stderr_pipe[W]);
+			params.trace_id = trace_id;
+			uint64_t t = ProcessMetrics::now_ns();
+			child_pid = ProcessPosixSpawner::spawn(spawn_method, params);
+			ProcessMetrics::record(ProcessMetrics::SpawnLatency, ProcessMetrics::now_ns() - t);
+		}
 		if (child_pid < 0) {
 			error_code = errno;
 			error_message = "failed: fork";
 			goto fail;
 		}
+		pid = child_pid;
+		ProcessMetrics::add(ProcessMetrics::Spawns);
 
-		if (child_pid == 0) { // child
-			setenv("LANG", "C", 1);
-			close(stdin_pipe[W]);
-			close(stdout_pipe[R]);
-			close(stderr_pipe[R]);
-			dup2(stdin_pipe[R], R);
-			dup2(stdout_pipe[W], W);
-			dup2(stderr_pipe[W], E);
+		close_redirects();
+		if (stdin_pipe[R] >= 0) {
 			close(stdin_pipe[R]);
+		}
+		if (stdout_pipe[R] >= 0) {
 			close(stdout_pipe[W]);
-			close(stderr_pipe[E]);
-			if (execvp(args[0], &args[0]) < 0) {
-				close(stdin_pipe[R]);
-				close(stdout_pipe[W]);
-				close(stderr_pipe[E]);
-				// forkした子プロセス側なので、exit()（atexitハンドラやCライブラリの
-				// バッファを親と共有した状態でフラッシュしてしまう）ではなく_exit()を使う。
-				// またマルチスレッドの親からforkした直後はロック取得を伴うstdioが
-				// デッドロックしうるため、async-signal-safeなwrite(2)だけを使う。
-				char const msg[] = "failed: exec\n";
-				if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {
-					// 書けなくても終了コード127で十分失敗は伝わる
-				}
-				_exit(127);
-			}
+		} else if (stdout_pipe[W] >= 0) {
+			outq.adopt_file(stdout_pipe[W]);
 		}
-		pid = child_pid;
-
-		close(stdin_pipe[R]);
-		close(stdout_pipe[W]);
-		close(stderr_pipe[W]);
-		fd_in_read = stdin_pipe[W];
-		fd_out_write = stdout_pipe[R];
-		fd_err_write = stderr_pipe[R];
-
-		//
-
-		if (!use_input) {
-			closeInput();
+		if (stderr_pipe[R] >= 0) {
+			close(stderr_pipe[W]);
+		} else if (stderr_pipe[W] >= 0) {
+			errq.adopt_file(stderr_pipe[W]);
 		}
+		fd_in = stdin_pipe[W];
+		fd_out = stdout_pipe[R];
+		fd_err = stderr_pipe[R];
 
-		{
-			OutputReaderThread t1(fd_out_write, mutex, &outq);
-			OutputReaderThread t2(fd_err_write, mutex, &errq);
-			t1.start();
-			t2.start();
-
-			while (1) {
-				std::this_thread::sleep_for(std::chrono::milliseconds(1));
-				int status = 0;
-				pid_t wait_result = waitpid(child_pid, &status, WNOHANG);
-				if (wait_result == child_pid) {
-					if (WIFEXITED(status)) {
-						exit_code = WEXITSTATUS(status);
-						break;
-					}
-					if (WIFSIGNALED(status)) {
-						exit_code = 128 + WTERMSIG(status);
-						break;
-					}
-				} else if (wait_result < 0 && errno != EINTR) {
-					break;
-				}
-				{
-					// SIGTERM を無視する子のための SIGKILL エスカレーション
-					long long dl = term_deadline_ms.load();
-					if (dl != 0) {
-						long long now = std::chrono::duration_cast<std::chrono::milliseconds>(
-							std::chrono::steady_clock::now().time_since_epoch())
-											.count();
-						if (now >= dl) {
-							kill(child_pid, SIGKILL);
-							term_deadline_ms = 0;
-						}
-					}
-				}
-				{
-					std::lock_guard<std::mutex> lock(*mutex);
-					int n = inq.size();
-					if (n > 0) {
-						while (n > 0) {
-							char tmp[1024];
-							int l = n;
-							if (l > (int)sizeof(tmp)) {
-								l = sizeof(tmp);
-							}
-							std::copy(inq.begin(), inq.begin() + l, tmp);
-							if (fd_in_read != -1) {
-								ssize_t r = write(fd_in_read, tmp, l);
-								if (r < 0) {
-									// 子プロセスが標準入力を閉じている（またはすでに終了した）。
-									// これ以上書き込めないので入力側を閉じて諦める。
-									closeInput();
-									inq.clear();
-									break;
-								}
-								inq.erase(inq.begin(), inq.begin() + r);
-								n -= static_cast<int>(r);
-								continue;
-							}
-							inq.clear();
-							break;
-						}
-					} else if (close_input_later) {
-						closeInput();
-					}
-				}
-			}
-
-			t1.wait();
-			t2.wait();
+		// stdin への書き込みはリアクタスレッドで行うので、子が読まなくてもブロックしないようにする
+		if (fd_in >= 0) {
+			fcntl(fd_in, F_SETFL, fcntl(fd_in, F_GETFL, 0) | O_NONBLOCK);
 		}
-
-		close(fd_out_write);
-		close(fd_err_write);
-		pid = 0;
-		return;
+		return true;
 
 	fail:
 		// ここに到達するのはpipe()/fork()がこのプロセス（親側）で失敗した場合のみ。
 		// fdを使い果たした等の一時的な資源不足でホストアプリ全体を巻き込んで
 		// 終了させるべきではないので、exit()は呼ばずに失敗として呼び出し元へ返す。
+		close_redirects();
 		if (stdin_pipe[R] >= 0) close(stdin_pipe[R]);
 		if (stdin_pipe[W] >= 0) close(stdin_pipe[W]);
 		if (stdout_pipe[R] >= 0) close(stdout_pipe[R]);
 		if (stdout_pipe[W] >= 0) close(stdout_pipe[W]);
 		if (stderr_pipe[R] >= 0) close(stderr_pipe[R]);
 		if (stderr_pipe[W] >= 0) close(stderr_pipe[W]);
-		fd_in_read = -1;
 		pid = 0;
 		exit_code = -1;
+		ProcessTrace::end(trace_id, -1);
+		ProcessMetrics::add(ProcessMetrics::SpawnFailures);
 		fprintf(stderr, "%s\n", error_message.c_str());
+		return false;
 	}
 
-public:
-	ProcessPosixThread() = default;
-	~ProcessPosixThread()
+	// 子へ渡した (または渡せなかった) stdin_file/stdout_file/stderr_file を閉じる
+	void close_redirects()
+	{
+		for (int *fd : { &stdin_file, &stdout_file, &stderr_file }) {
+			if (*fd >= 0) {
+				close(*fd);
+				*fd = -1;
+			}
+		}
+	}
+
+	// spawn() に成功した後、fd と子プロセスをリアクタへ登録する
+	void start()
+	{
+		if (helper_id != 0) return;
+		auto self = shared_from_this();
+		reactor().post([self]() {
+			ProcessPosixReactor &r = reactor();
+			if (self->fd_out >= 0) {
+				r.add_reader(
+					self->fd_out,
+					[self](char const *ptr, size_t len) {
+						self->on_stdout(ptr, len);
+					},
+					[self](int) {
+						close(self->fd_out);
+						self->fd_out = -1;
+						self->try_finish();
+					});
+			}
+			if (self->fd_err >= 0) {
+				r.add_reader(
+					self->fd_err,
+					[self](char const *ptr, size_t len) {
+						self->on_stderr(ptr, len);
+					},
+					[self](int) {
+						close(self->fd_err);
+						self->fd_err = -1;
+						self->try_finish();
+					});
+			}
+			r.watch_child(self->pid, [self](int status, struct rusage const &ru) {
+				self->on_exit(status, ru);
+			});
+			if (self->use_input || self->stdin_from_buffer) {
+				self->flush_input();
+			} else {
+				std::lock_guard<std::mutex> lock(self->mutex);
+				self->close_input_now();
+			}
+		});
+	}
+
+	// inq へ積んだバイト数を返す。input_limit があれば、block なら空きができるのを待って全て積み、
+	// そうでなければ入るだけ積む。stdin を閉じた後は -1
+	int write_input(char const *ptr, int len, bool block)
 	{
-		terminate();
-		stop();
+		if (!ptr || len <= 0) return 0;
+		if (stdin_from_buffer) return -1;
+		if (helper_id != 0) {
+			ProcessSpawnHelper::instance().write_stdin(helper_id, ptr, len);
+			return len;
+		}
+		// リアクタスレッドで待つと、inq を送り出す者がいなくなる
+		bool bounded = input_limit > 0 && !reactor().in_reactor_thread();
+		std::unique_lock<std::mutex> lock(mutex);
+		int total = 0;
+		while (len > 0 && fd_in >= 0) {
+			size_t n = (size_t)len;
+			if (bounded) {
+				if (inq.size() >= input_limit) {
+					if (!block) break;
+					input_cond.wait(lock, [this]() {
+						return fd_in < 0 || inq.size() < input_limit;
+					});
+					continue;
+				}
+				n = std::min(n, input_limit - inq.size());
+			}
+			inq.append(ptr, n);
+			ptr += n;
+			len -= (int)n;
+			total += (int)n;
+			if (!flush_posted) {
+				flush_posted = true;
+				auto self = shared_from_this();
+				reactor().post([self]() {
+					self->flush_input();
+				});
+			}
+		}
+		return total == 0 && fd_in < 0 ? -1 : total;
 	}
-	void writeInput(char const *ptr, int len)
+
+	bool wait_input_space(std::chrono::milliseconds timeout)
 	{
-		if (!mutex || !ptr || len <= 0) return;
-		std::lock_guard<std::mutex> lock(*mutex);
-		inq.insert(inq.end(), ptr, ptr + len);
+		std::unique_lock<std::mutex> lock(mutex);
+		return wait_until(input_cond, lock, timeout, [this]() {
+			return fd_in < 0 || input_limit == 0 || inq.size() < input_limit;
+		}) && fd_in >= 0;
 	}
 
-	void closeInput()
+	size_t pending_input()
 	{
-		if (fd_in_read >= 0) {
-			close(fd_in_read);
-			fd_in_read = -1;
+		std::lock_guard<std::mutex> lock(mutex);
+		return inq.size();
+	}
+
+	void close_input(bool justnow)
+	{
+		if (helper_id != 0) {
+			ProcessSpawnHelper::instance().close_stdin(helper_id, justnow);
+			return;
+		}
+		auto self = shared_from_this();
+		if (justnow) {
+			reactor().post([self]() {
+				std::lock_guard<std::mutex> lock(self->mutex);
+				self->close_input_now();
+			});
+		} else {
+			std::lock_guard<std::mutex> lock(mutex);
+			close_input_later = true;
+			reactor().post([self]() {
+				self->flush_input();
+			});
 		}
 	}
-	void start()
+
+	void send_signal(int sig)
 	{
-		stop();
-		thread = std::thread([this]() {
-			run();
-		});
+		if (helper_id != 0) {
+			ProcessSpawnHelper::instance().kill(helper_id, sig);
+			return;
+		}
+		pid_t p = pid.load();
+		if (p > 0) {
+			kill(p, sig);
+		}
 	}
+
 	void terminate()
 	{
-		pid_t child_pid = pid.load();
-		if (child_pid > 0) {
-			kill(child_pid, SIGTERM);
+		if (pid.load() > 0 || helper_id != 0) {
+			send_signal(SIGTERM);
 			// SIGTERM を無視する子のために SIGKILL へのエスカレーション期限を設定する
-			auto dl = std::chrono::steady_clock::now() + std::chrono::seconds(2);
-			term_deadline_ms = std::chrono::duration_cast<std::chrono::milliseconds>(dl.time_since_epoch()).count();
+			auto self = shared_from_this();
+			reactor().post([self]() {
+				if (self->exited || self->kill_timer != 0) return;
+				self->kill_timer = reactor().add_timer(std::chrono::seconds(2), [self]() {
+					self->kill_timer = 0;
+					if (!self->exited) {
+						self->send_signal(SIGKILL);
+					}
+				});
+			});
 		}
-		closeInput();
+		close_input(true);
 	}
-	void stop()
+
+	// 起動から timeout が過ぎても終了していなければ、terminate() と同じく SIGTERM を送り、
+	// 応じなければ SIGKILL する
+	void set_deadline(std::chrono::milliseconds timeout)
 	{
-		if (thread.joinable()) {
-			thread.join();
-		}
+		auto self = shared_from_this();
+		auto when = std::chrono::steady_clock::now() + timeout;
+		reactor().post([self, when]() {
+			if (self->exited) return;
+			self->timeout_timer = reactor().add_timer(when - std::chrono::steady_clock::now(), [self]() {
+				self->timeout_timer = 0;
+				if (!self->exited) {
+					self->timed_out = true;
+					self->terminate();
+				}
+			});
+		});
 	}
+
 	void wait()
 	{
-		stop();
+		std::unique_lock<std::mutex> lock(mutex);
+		cond.wait(lock, [this]() {
+			return done;
+		});
+	}
+
+	bool wait_for(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		return wait_until(cond, lock, timeout, [this]() {
+			return done;
+		});
+	}
+
+	int wait_for_output(std::vector<std::string> const &patterns, int timeout_ms)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		return stdout_waiters.wait(lock, cond, patterns, outq.view(), timeout_ms);
 	}
 };
 
 struct ProcessPosix::Private {
-	std::mutex mutex;
-	ProcessPosixThread thread;
+	std::shared_ptr<ProcessPosixJob> job;
+	ProcessPosixSpawner::Method spawn_method = ProcessPosixSpawner::Method::Fork;
+	std::shared_ptr<void> user_data;
+	std::function<void(bool, std::shared_ptr<void>)> completed_fn;
+	std::function<void(char const *ptr, size_t len)> stdout_fn;
+	std::function<void(char const *ptr, size_t len)> stderr_fn;
+	bool accumulate = true;
+	ProcessPosix::Capture stdout_capture_mode = ProcessPosix::Capture::Pipe;
+	ProcessPosix::Capture stderr_capture_mode = ProcessPosix::Capture::Pipe;
+	size_t spill_threshold = 0;
+	std::string spill_dir;
+	std::chrono::milliseconds execution_timeout { 0 };
+	bool timed_out = false;
+	size_t input_limit = 0;
+	// stdin/stdout/stderr のつなぎ先
+	enum class Redirect {
+		Pipe, // stdin は write_input() のパイプ、stdout/stderr は Capture に従って取り込む
+		Path,
+		Fd,
+		Buffer, // stdin のみ
+		Null,
+		Inherit,
+	};
+	struct Stream {
+		Redirect redirect;
+		std::string path;
+		int fd;
+		bool append; // stdout/stderr の Path
+		Stream(Redirect redirect = Redirect::Pipe, std::string const &path = { }, int fd = -1, bool append = true)
+			: redirect(redirect)
+			, path(path)
+			, fd(fd)
+			, append(append)
+		{
+		}
+	};
+	Stream stdin_stream;
+	Stream stdout_stream;
+	Stream stderr_stream;
+	std::string_view stdin_buffer;
+	// 一時ファイルへ退避した結果。stdout_bytes()/stderr_bytes() は必要になるまで作らない
+	CaptureBuffer stdout_capture;
+	CaptureBuffer stderr_capture;
 	std::vector<char> stdout_bytes;
 	std::vector<char> stderr_bytes;
 	int exit_code = -1;
+	ProcessUsage usage;
 	int error_code = 0;
 	std::string error_message;
 };
@@ -369,13 +756,13 @@ ProcessPosix::ProcessPosix()
 
 ProcessPosix::~ProcessPosix()
 {
+	if (m->job) {
+		m->job->terminate();
+		m->job->wait();
+	}
 	delete m;
 }
 
-// コマンドライン文字列を空白で分割する簡易パーサ。
-// - ダブルクォート内は空白を含めて1引数として扱う。
-// - 連続する3つのダブルクォート (""" ) はリテラルの " 1個に展開する (独自仕様)。
-// - 空の引数 ("" 等) は結果に含まれない。
 void ProcessPosix::parse_args(std::string const &cmd, std::vector<std::string> *out)
 {
 	out->clear();
@@ -420,38 +807,195 @@ void ProcessPosix::start(std::string const &command, bool use_input)
 {
 	if (is_running()) return;
 	m->exit_code = -1;
+	m->usage = { };
+	m->timed_out = false;
 	m->error_code = 0;
 	m->error_message.clear();
-	parse_args(command, &m->thread.argvec);
-	if (m->thread.argvec.empty()) {
+	auto job = std::make_shared<ProcessPosixJob>();
+	parse_args(command, &job->argvec);
+	if (job->argvec.empty()) {
 		m->error_code = EINVAL;
 		m->error_message = "empty command or failed to parse arguments";
 		return;
 	}
-	for (std::string const &s : m->thread.argvec) {
-		m->thread.args.push_back(const_cast<char *>(s.c_str()));
+	for (std::string const &s : job->argvec) {
+		job->args.push_back(const_cast<char *>(s.c_str()));
+	}
+	job->args.push_back(nullptr);
+	job->use_input = use_input;
+	job->input_limit = m->input_limit;
+	job->spawn_method = m->spawn_method;
+	job->stdout_fn = m->stdout_fn;
+	job->stderr_fn = m->stderr_fn;
+	job->accumulate = m->accumulate;
+	job->stdout_to_file = m->stdout_capture_mode == Capture::File;
+	job->stderr_to_file = m->stderr_capture_mode == Capture::File;
+	job->outq.set_spill_threshold(m->spill_threshold, m->spill_dir);
+	job->errq.set_spill_threshold(m->spill_threshold, m->spill_dir);
+	if (!job->accumulate || m->spill_threshold > 0) {
+		// outq.view() は溜めていないか一時ファイルへ退避した後は空なので、待機用に末尾だけ持っておく
+		job->stdout_waiters.keep_tail();
+	}
+	if (m->completed_fn) {
+		auto fn = m->completed_fn;
+		auto userdata = m->user_data;
+		job->completed_fn = [fn, userdata]() {
+			fn(true, userdata);
+		};
+	}
+	if (m->stdin_stream.redirect == Private::Redirect::Buffer) {
+		job->stdin_buffer = m->stdin_buffer;
+		job->stdin_from_buffer = true;
+	}
+	struct {
+		Private::Stream const *stream;
+		int *file;
+		int flags;
+		char const *error;
+	} const redirects[] = {
+		{ &m->stdin_stream, &job->stdin_file, O_RDONLY, "failed: open stdin file" },
+		{ &m->stdout_stream, &job->stdout_file, O_WRONLY | O_CREAT, "failed: open stdout file" },
+		{ &m->stderr_stream, &job->stderr_file, O_WRONLY | O_CREAT, "failed: open stderr file" },
+	};
+	bool redirected = false;
+	for (auto const &r : redirects) {
+		int fd = -1;
+		switch (r.stream->redirect) {
+		case Private::Redirect::Pipe:
+		case Private::Redirect::Buffer:
+			continue;
+		case Private::Redirect::Inherit:
+			*r.file = ProcessPosixJob::InheritFd;
+			redirected = true;
+			continue;
+		case Private::Redirect::Path:
+			fd = open(r.stream->path.c_str(), r.flags | (r.flags == O_RDONLY ? 0 : r.stream->append ? O_APPEND : O_TRUNC) | O_CLOEXEC, 0644);
+			break;
+		case Private::Redirect::Null:
+			fd = open("/dev/null", (r.flags & O_WRONLY ? O_WRONLY : O_RDONLY) | O_CLOEXEC);
+			break;
+		case Private::Redirect::Fd:
+			fd = r.stream->fd;
+			break;
+		}
+		// 子の中で 0〜2 へ dup2 するときに他のストリームを潰さないよう、3 以上の CLOEXEC な fd にする
+		*r.file = fd < 0 ? -1 : dup_above_stdio(fd);
+		int err = errno;
+		if (fd >= 0 && r.stream->redirect != Private::Redirect::Fd) {
+			close(fd);
+		}
+		if (*r.file < 0) {
+			job->close_redirects();
+			m->error_code = err;
+			m->error_message = r.error;
+			return;
+		}
+		redirected = true;
+	}
+	if ((redirected || job->stdin_from_buffer) && job->spawn_method == ProcessPosixSpawner::Method::Helper) {
+		// ヘルパーには fd を渡せないので、自分で posix_spawn する
+		job->spawn_method = ProcessPosixSpawner::Method::PosixSpawn;
 	}
-	m->thread.args.push_back(nullptr);
 
-	m->thread.init(&m->mutex, use_input);
-	m->thread.start();
+	if (!job->spawn()) {
+		m->error_code = job->error_code;
+		m->error_message = std::move(job->error_message);
+		return;
+	}
+	m->job = job;
+	job->start();
+	if (m->execution_timeout.count() > 0) {
+		job->set_deadline(m->execution_timeout);
+	}
 }
 
-int ProcessPosix::wait()
+void ProcessPosix::set_spawn_method(ProcessPosixSpawner::Method method)
 {
-	m->thread.wait();
+	m->spawn_method = method;
+}
+
+void ProcessPosix::set_completion_callback(std::function<void(bool, std::shared_ptr<void>)> fn, std::shared_ptr<void> userdata)
+{
+	m->completed_fn = fn;
+	m->user_data = userdata;
+}
+
+void ProcessPosix::set_stdout_callback(std::function<void(char const *ptr, size_t len)> fn)
+{
+	m->stdout_fn = fn;
+}
 
-	m->stdout_bytes.clear();
-	m->stderr_bytes.clear();
-	if (!m->thread.outq.empty()) m->stdout_bytes.insert(m->stdout_bytes.end(), m->thread.outq.begin(), m->thread.outq.end());
-	if (!m->thread.errq.empty()) m->stderr_bytes.insert(m->stderr_bytes.end(), m->thread.errq.begin(), m->thread.errq.end());
-	m->exit_code = m->thread.exit_code;
-	m->error_code = m->thread.error_code;
-	m->error_message = std::move(m->thread.error_message);
-	m->thread.reset();
+void ProcessPosix::set_stderr_callback(std::function<void(char const *ptr, size_t len)> fn)
+{
+	m->stderr_fn = fn;
+}
+
+void ProcessPosix::set_accumulate_output(bool accumulate)
+{
+	m->accumulate = accumulate;
+}
+
+void ProcessPosix::set_spill_threshold(size_t bytes, std::string const &dir)
+{
+	m->spill_threshold = bytes;
+	m->spill_dir = dir;
+}
+
+void ProcessPosix::set_stdout_capture(Capture capture)
+{
+	m->stdout_capture_mode = capture;
+	m->stdout_stream = { };
+}
+
+void ProcessPosix::set_stderr_capture(Capture capture)
+{
+	m->stderr_capture_mode = capture;
+	m->stderr_stream = { };
+}
+
+int ProcessPosix::wait()
+{
+	std::shared_ptr<ProcessPosixJob> job = std::move(m->job);
+	if (!job) return m->exit_code;
+	job->wait();
+
+	// job はもう誰からも参照されないので、ロックせずに結果を移してよい
+	auto take = [](CaptureBuffer *from, CaptureBuffer *capture, std::vector<char> *bytes) {
+		from->finish();
+		*capture = std::move(*from);
+		if (capture->spilled()) {
+			bytes->clear();
+		} else {
+			*bytes = capture->take_vector();
+		}
+	};
+	take(&job->outq, &m->stdout_capture, &m->stdout_bytes);
+	take(&job->errq, &m->stderr_capture, &m->stderr_bytes);
+	m->exit_code = job->exit_code;
+	m->usage = job->usage;
+	m->timed_out = job->timed_out;
+	m->error_code = job->error_code;
+	m->error_message = std::move(job->error_message);
 	return m->exit_code;
 }
 
+bool ProcessPosix::wait_for(std::chrono::milliseconds timeout)
+{
+	if (m->job && !m->job->wait_for(timeout)) return false;
+	wait();
+	return true;
+}
+
+void ProcessPosix::set_execution_timeout(std::chrono::milliseconds timeout)
+{
+	m->execution_timeout = timeout;
+}
+
+bool ProcessPosix::timed_out() const
+{
+	return m->timed_out;
+}
+
 int ProcessPosix::get_error_code() const
 {
 	return m->error_code;
@@ -464,15 +1008,107 @@ std::string const &ProcessPosix::get_error_message() const
 
 void ProcessPosix::write_input(char const *ptr, int len)
 {
-	m->thread.writeInput(ptr, len);
+	if (m->job) {
+		m->job->write_input(ptr, len, true);
+	}
+}
+
+int ProcessPosix::try_write_input(char const *ptr, int len)
+{
+	return m->job ? m->job->write_input(ptr, len, false) : -1;
+}
+
+bool ProcessPosix::wait_input_space(std::chrono::milliseconds timeout)
+{
+	return m->job && m->job->wait_input_space(timeout);
+}
+
+size_t ProcessPosix::pending_input() const
+{
+	return m->job ? m->job->pending_input() : 0;
+}
+
+void ProcessPosix::set_input_limit(size_t bytes)
+{
+	m->input_limit = bytes;
+}
+
+void ProcessPosix::set_stdin_file(std::string const &path)
+{
+	m->stdin_stream = { Private::Redirect::Path, path };
+}
+
+void ProcessPosix::set_stdin_file(int fd)
+{
+	m->stdin_stream = { Private::Redirect::Fd, { }, fd };
+}
+
+void ProcessPosix::set_stdin_buffer(std::string_view data)
+{
+	m->stdin_stream = { Private::Redirect::Buffer };
+	m->stdin_buffer = data;
+}
+
+void ProcessPosix::set_stdin_null()
+{
+	m->stdin_stream = { Private::Redirect::Null };
+}
+
+void ProcessPosix::set_stdin_inherit()
+{
+	m->stdin_stream = { Private::Redirect::Inherit };
+}
+
+void ProcessPosix::set_stdin_pipe()
+{
+	m->stdin_stream = { };
+	m->stdin_buffer = { };
+}
+
+void ProcessPosix::set_stdout_file(std::string const &path, bool append)
+{
+	m->stdout_stream = { Private::Redirect::Path, path, -1, append };
+}
+
+void ProcessPosix::set_stdout_file(int fd)
+{
+	m->stdout_stream = { Private::Redirect::Fd, { }, fd };
+}
+
+void ProcessPosix::set_stdout_null()
+{
+	m->stdout_stream = { Private::Redirect::Null };
+}
+
+void ProcessPosix::set_stdout_inherit()
+{
+	m->stdout_stream = { Private::Redirect::Inherit };
+}
+
+void ProcessPosix::set_stderr_file(std::string const &path, bool append)
+{
+	m->stderr_stream = { Private::Redirect::Path, path, -1, append };
+}
+
+void ProcessPosix::set_stderr_file(int fd)
+{
+	m->stderr_stream = { Private::Redirect::Fd, { }, fd };
+}
+
+void ProcessPosix::set_stderr_null()
+{
+	m->stderr_stream = { Private::Redirect::Null };
+}
+
+void ProcessPosix::set_stderr_inherit()
+{
+	m->stderr_stream = { Private::Redirect::Inherit };
 }
 
 void ProcessPosix::close_input(bool justnow)
 {
-	if (justnow) {
-		m->thread.closeInput();
-	} else {
-		m->thread.close_input_later = true;
+	if (m->job) {
+		m->job->close_input(justnow);
 	}
 }
 
@@ -481,25 +1117,86 @@ void ProcessPosix::close_input()
 	close_input(true);
 }
 
+namespace {
+
+std::vector<char> const &materialize(CaptureBuffer const &capture, std::vector<char> *bytes)
+{
+	if (capture.spilled() && bytes->empty()) {
+		std::string_view v = capture.view();
+		bytes->assign(v.begin(), v.end());
+	}
+	return *bytes;
+}
+
+std::vector<char> take_capture(CaptureBuffer *capture, std::vector<char> *bytes)
+{
+	std::vector<char> v;
+	if (capture->spilled()) {
+		v = capture->take_vector();
+		bytes->clear();
+	} else {
+		v.swap(*bytes);
+	}
+	return v;
+}
+
+} // namespace
+
 std::vector<char> const &ProcessPosix::stdout_bytes() const
 {
-	return m->stdout_bytes;
+	return materialize(m->stdout_capture, &m->stdout_bytes);
 }
 
 std::vector<char> const &ProcessPosix::stderr_bytes() const
 {
-	return m->stderr_bytes;
+	return materialize(m->stderr_capture, &m->stderr_bytes);
+}
+
+std::vector<char> ProcessPosix::take_stdout()
+{
+	return take_capture(&m->stdout_capture, &m->stdout_bytes);
+}
+
+std::vector<char> ProcessPosix::take_stderr()
+{
+	return take_capture(&m->stderr_capture, &m->stderr_bytes);
+}
+
+std::string_view ProcessPosix::stdout_view() const
+{
+	if (m->stdout_capture.spilled()) return m->stdout_capture.view();
+	return { m->stdout_bytes.data(), m->stdout_bytes.size() };
+}
+
+std::string_view ProcessPosix::stderr_view() const
+{
+	if (m->stderr_capture.spilled()) return m->stderr_capture.view();
+	return { m->stderr_bytes.data(), m->stderr_bytes.size() };
+}
+
+int ProcessPosix::wait_for_any_output(std::vector<std::string> const &patterns, int timeout_ms)
+{
+	std::shared_ptr<ProcessPosixJob> job = m->job;
+	if (!job) return -1;
+	return job->wait_for_output(patterns, timeout_ms);
 }
 
 void ProcessPosix::stop()
 {
-	m->thread.terminate();
+	terminate();
 	wait();
 }
 
+void ProcessPosix::terminate()
+{
+	if (m->job) {
+		m->job->terminate();
+	}
+}
+
 bool ProcessPosix::is_running() const
 {
-	return m->thread.thread.joinable();
+	return m->job != nullptr;
 }
 
 int ProcessPosix::get_exit_code() const
@@ -507,6 +1204,11 @@ int ProcessPosix::get_exit_code() const
 	return m->exit_code;
 }
 
+ProcessUsage ProcessPosix::get_usage() const
+{
+	return m->usage;
+}
+
 //
 
 namespace {
@@ -550,15 +1252,68 @@ void make_argv(char *command, std::vector<char *> *out)
 
 // ProcessPosixPty
 
+// ProcessPosixPty の1回分の実行状態。SIGKILL エスカレーション用タイマーなど、
+// 実行完了後にリアクタ側から参照されうるものはここに置く。
+struct ProcessPosixPtyRun {
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::atomic<pid_t> pid { 0 };
+	bool done = false;
+
+	// 以下はリアクタスレッドからのみ触る
+	bool exited = false;
+	bool master_closed = false;
+	int status = -1;
+	struct rusage usage = { };
+	std::chrono::steady_clock::time_point started;
+	std::chrono::steady_clock::time_point exited_at;
+	double wall_seconds = 0; // 起動から回収まで (出力の読み切りは含まない)
+	uint64_t trace_id = ProcessTrace::new_id();
+	bool got_output = false;
+	bool timed_out = false; // 実行時間の上限で終了させた (done の後は他のスレッドから読んでよい)
+	uint64_t kill_timer = 0;
+	uint64_t drain_timer = 0;
+	uint64_t timeout_timer = 0;
+	bool vt_stripped = false;
+	VtStripper vt_stripper;
+	std::string vt_text;
+
+	// SIGTERM を送り、無視する子のため猶予時間後に SIGKILL へエスカレーションする
+	static void terminate(std::shared_ptr<ProcessPosixPtyRun> const &run)
+	{
+		pid_t pid = run->pid.load();
+		if (pid <= 0) return;
+		kill(pid, SIGTERM);
+		ProcessPosixReactor::instance().post([run]() {
+			if (run->exited || run->kill_timer != 0) return;
+			run->kill_timer = ProcessPosixReactor::instance().add_timer(std::chrono::seconds(2), [run]() {
+				run->kill_timer = 0;
+				pid_t pid = run->pid.load();
+				if (!run->exited && pid > 0) {
+					kill(pid, SIGKILL);
+				}
+			});
+		});
+	}
+};
+
 struct ProcessPosixPty::Private {
 	process::helper::PushDir pushd;
-	std::atomic<bool> interrupted { false };
 	std::mutex mutex;
-	std::thread thread;
+	std::shared_ptr<ProcessPosixPtyRun> run;
+	ProcessPosixSpawner::Method spawn_method = ProcessPosixSpawner::Method::Fork;
+	bool vt_stripped = false;
 	std::string command;
 	std::string env;
 	int pty_master = -1;
+	// まだ master へ送り出していない入力。master が一杯なら溜めておき、
+	// 書き込み可能になったらリアクタが flush_input() で送り出す
+	ByteQueue inq;
+	std::condition_variable input_cond; // inq が空になったか、master を閉じた
 	int exit_code = -1;
+	ProcessUsage usage;
+	std::chrono::milliseconds execution_timeout { 0 };
+	bool timed_out = false;
 	int error_code = 0;
 	std::string error_message;
 };
@@ -577,21 +1332,102 @@ ProcessPosixPty::~ProcessPosixPty()
 bool ProcessPosixPty::is_running() const
 {
 	// return QThread::isRunning();
-	return m->thread.joinable();
+	return m->run != nullptr;
 }
 
 void ProcessPosixPty::write_input(char const *ptr, int len)
 {
 	if (!ptr || len <= 0) return;
-	std::lock_guard<std::mutex> lock(m->mutex);
+	ProcessPosixReactor &reactor = ProcessPosixReactor::instance();
+	std::unique_lock<std::mutex> lock(m->mutex);
 	if (m->pty_master < 0) return;
-	while (len > 0) {
+	// 先に溜まっている分があれば、それを追い越さないよう後ろに積む
+	while (len > 0 && m->inq.empty()) {
 		ssize_t written = write(m->pty_master, ptr, static_cast<size_t>(len));
 		if (written < 0 && errno == EINTR) continue;
-		if (written <= 0) break;
+		if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		if (written <= 0) return;
+		if (ProcessTrace::enabled() && m->run) {
+			ProcessTrace::record(ProcessTrace::Event::StdinWrite, m->run->trace_id, m->run->pid, (uint64_t)written);
+		}
+		ProcessMetrics::add(ProcessMetrics::StdinBytes, (uint64_t)written);
 		ptr += written;
 		len -= static_cast<int>(written);
 	}
+	if (len > 0) {
+		bool idle = m->inq.empty();
+		m->inq.append(ptr, static_cast<size_t>(len));
+		if (idle) {
+			watch_input();
+		}
+	}
+	// 従来どおり書き切るまで待つ。子が読まずに終了した場合は finish() が残りを捨てて起こす。
+	// リアクタスレッドで待つと master を読み出す者がいなくなるので、溜めたまま戻る
+	if (!reactor.in_reactor_thread()) {
+		m->input_cond.wait(lock, [this]() {
+			return m->inq.empty();
+		});
+	}
+}
+
+// master が書き込み可能になったら flush_input() を呼ぶよう登録する。m->mutex を取った状態で呼ぶこと
+void ProcessPosixPty::watch_input()
+{
+	ProcessPosixReactor &reactor = ProcessPosixReactor::instance();
+	std::shared_ptr<ProcessPosixPtyRun> run = m->run;
+	if (!run || m->pty_master < 0) return;
+	if (reactor.in_reactor_thread()) {
+		reactor.watch_writable(m->pty_master, [this, run]() {
+			flush_input();
+		});
+		return;
+	}
+	// 登録までに finish() が master を閉じ、その番号が他の実行の fd に再利用されているかもしれない。
+	// リアクタスレッドで確かめ直してから登録する。finish() の後は this も破棄されうるので、
+	// 先に run->done を見る (done でなければ、デストラクタはリアクタが finish() するのを待っている)
+	reactor.post([this, run]() {
+		{
+			std::lock_guard<std::mutex> lock(run->mutex);
+			if (run->done) return;
+		}
+		std::lock_guard<std::mutex> lock(m->mutex);
+		if (!m->inq.empty()) {
+			watch_input();
+		}
+	});
+}
+
+// リアクタスレッドで、inq を master へ書けるだけ書く
+void ProcessPosixPty::flush_input()
+{
+	std::lock_guard<std::mutex> lock(m->mutex);
+	if (m->pty_master < 0) return;
+	while (!m->inq.empty()) {
+		std::string_view spans[InputIovecs];
+		struct iovec iov[InputIovecs];
+		size_t n = m->inq.front_spans(spans, InputIovecs);
+		for (size_t i = 0; i < n; i++) {
+			iov[i].iov_base = const_cast<char *>(spans[i].data());
+			iov[i].iov_len = spans[i].size();
+		}
+		ssize_t r = writev(m->pty_master, iov, (int)n);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				watch_input();
+				return;
+			}
+			// EIO など。子はもう読まない
+			m->inq.clear();
+			break;
+		}
+		if (ProcessTrace::enabled() && m->run) {
+			ProcessTrace::record(ProcessTrace::Event::StdinWrite, m->run->trace_id, m->run->pid, (uint64_t)r);
+		}
+		ProcessMetrics::add(ProcessMetrics::StdinBytes, (uint64_t)r);
+		m->inq.discard((size_t)r);
+	}
+	m->input_cond.notify_all();
 }
 
 int ProcessPosixPty::read_output(char *ptr, int len)
@@ -606,8 +1442,9 @@ void ProcessPosixPty::start(std::string const &cmd, std::string const &env, bool
 	if (is_running()) return;
 	m->command = cmd;
 	m->env = env;
-	m->interrupted = false;
 	m->exit_code = -1;
+	m->usage = { };
+	m->timed_out = false;
 	m->error_code = 0;
 	m->error_message.clear();
 	if (cmd.empty()) {
@@ -616,22 +1453,57 @@ void ProcessPosixPty::start(std::string const &cmd, std::string const &env, bool
 		return;
 	}
 	// QThread::start();
-	m->thread = std::thread([this]() {
-		run();
-	});
+	begin_output();
+	m->run = std::make_shared<ProcessPosixPtyRun>();
+	m->run->vt_stripped = m->vt_stripped;
+	run();
 }
 
-bool ProcessPosixPty::wait(unsigned long time)
+void ProcessPosixPty::set_spawn_method(ProcessPosixSpawner::Method method)
 {
-	(void)time;
-	if (m->thread.joinable()) {
-		m->thread.join();
-		std::lock_guard<std::mutex> lock(mutex_);
-		stdout_bytes_ = output_vector_;
+	m->spawn_method = method;
+}
+
+void ProcessPosixPty::set_vt_stripped(bool stripped)
+{
+	m->vt_stripped = stripped;
+}
+
+void ProcessPosixPty::set_execution_timeout(std::chrono::milliseconds timeout)
+{
+	m->execution_timeout = timeout;
+}
+
+bool ProcessPosixPty::timed_out() const
+{
+	return m->timed_out;
+}
+
+bool ProcessPosixPty::wait_for(std::chrono::milliseconds timeout)
+{
+	std::shared_ptr<ProcessPosixPtyRun> run = m->run;
+	if (run) {
+		{
+			std::unique_lock<std::mutex> lock(run->mutex);
+			bool done = wait_until(run->cond, lock, timeout, [&]() {
+				return run->done;
+			});
+			if (!done) return false;
+		}
+		m->run.reset();
+		finish_output();
 		// stderr_bytes_ =
-		return true;
 	}
-	return false;
+	return true;
+}
+
+bool ProcessPosixPty::wait(unsigned long time)
+{
+	if (!m->run) return false; // 従来どおり、実行していなければ false
+	if (time >= (unsigned long)LONG_MAX) {
+		return wait_for(std::chrono::milliseconds::max());
+	}
+	return wait_for(std::chrono::milliseconds((long long)time));
 }
 
 int ProcessPosixPty::wait()
@@ -651,16 +1523,76 @@ std::string const &ProcessPosixPty::get_error_message() const
 	return m->error_message;
 }
 
+// リアクタスレッド上で実行を完了させる。これ以降リアクタから this は参照されない。
+void ProcessPosixPty::finish()
+{
+	std::shared_ptr<ProcessPosixPtyRun> run = m->run;
+	ProcessPosixReactor &reactor = ProcessPosixReactor::instance();
+	reactor.cancel_timer(run->kill_timer);
+	reactor.cancel_timer(run->drain_timer);
+	reactor.cancel_timer(run->timeout_timer);
+	run->kill_timer = 0;
+	run->drain_timer = 0;
+	run->timeout_timer = 0;
+	m->timed_out = run->timed_out;
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		if (m->pty_master >= 0) {
+			reactor.remove_reader(m->pty_master);
+			reactor.unwatch_writable(m->pty_master);
+			m->inq.clear();
+			close(m->pty_master);
+			m->pty_master = -1;
+		}
+		m->input_cond.notify_all();
+	}
+	if (run->exited) {
+		m->exit_code = exit_code_from_status(run->status);
+		if (run->status >= 0) {
+			ProcessPosixSpawner::make_usage(run->usage, run->wall_seconds, &m->usage);
+		}
+		ProcessMetrics::record(ProcessMetrics::ExitLatency, nanoseconds_since(run->exited_at));
+	}
+
+	uint64_t t = ProcessTrace::start_ns();
+	notify_completed();
+	ProcessTrace::complete(ProcessTrace::Event::Callback, run->trace_id, t);
+	ProcessTrace::end(run->trace_id, m->exit_code);
+
+	std::lock_guard<std::mutex> lock(run->mutex);
+	run->done = true;
+	run->cond.notify_all();
+}
+
 void ProcessPosixPty::run()
 {
 	struct termios orig_termios = { };
 	struct winsize orig_winsize = { 25, 80, 0, 0 };
 
-	// TraceLogger trace;
-	// trace.begin("process", QString::fromStdString(m->command));
+	ProcessTrace::begin(m->run->trace_id, m->command);
+
+	ProcessPosixReactor &reactor = ProcessPosixReactor::instance();
+
+	// 起動に失敗した場合も、従来どおり完了通知は呼び出し元とは別スレッドから行う
+	auto fail = [&]() {
+		fprintf(stderr, "%s\n", m->error_message.c_str());
+		m->exit_code = -1;
+		ProcessMetrics::add(ProcessMetrics::SpawnFailures);
+		reactor.post([this]() {
+			finish();
+		});
+	};
 
 	tcgetattr(STDIN_FILENO, &orig_termios);
 	ioctl(STDIN_FILENO, TIOCGWINSZ, (char *)&orig_winsize);
+	{
+		// 画面を再現する場合は、子から見える端末の大きさをそれに合わせる
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (screen_) {
+			orig_winsize.ws_row = (unsigned short)screen_->rows();
+			orig_winsize.ws_col = (unsigned short)screen_->cols();
+		}
+	}
 
 	// argv は fork 前に構築する。fork 後の子プロセスで std::vector や文字列構築
 	// (malloc) を行うと、親の他スレッドが保持しているロックとデッドロックしうる。
@@ -671,8 +1603,7 @@ void ProcessPosixPty::run()
 	if (argv.empty()) {
 		m->error_code = EINVAL;
 		m->error_message = "empty command";
-		m->exit_code = -1;
-		notify_completed();
+		fail();
 		return;
 	}
 	argv.push_back(nullptr);
@@ -685,47 +1616,35 @@ void ProcessPosixPty::run()
 		// ここでforkに進むと、壊れたfdを子プロセスに渡してしまい原因不明な不具合になる。
 		m->error_code = errno;
 		m->error_message = "failed: posix_openpt/grantpt/unlockpt";
-		fprintf(stderr, "%s\n", m->error_message.c_str());
 		if (m->pty_master >= 0) {
 			close(m->pty_master);
 			m->pty_master = -1;
 		}
-		m->exit_code = -1;
-		notify_completed();
+		fail();
 		return;
 	}
-
-	pid_t pid = fork();
-	if (pid < 0) {
+	// 並行して起動される別の子プロセスへ master が継承されないようにする
+	fcntl(m->pty_master, F_SETFD, FD_CLOEXEC);
+	// リアクタへの登録 (add_reader()) は post してから行われるので、それより前に write_input() が
+	// 呼ばれても (ProcessPool がリアクタスレッドで起動した場合など) write() でブロックしないようにする
+	fcntl(m->pty_master, F_SETFL, fcntl(m->pty_master, F_GETFL, 0) | O_NONBLOCK);
+
+	// 端末の属性はデバイス側の状態なので、子を起動する前に親でスレーブを開いて設定しておく
+	std::string pts_name;
+	{
+		char const *name = ptsname(m->pty_master);
+		if (name) pts_name = name;
+	}
+	int pty_slave = pts_name.empty() ? -1 : open(pts_name.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (pty_slave < 0) {
 		m->error_code = errno;
-		m->error_message = "failed: fork";
-		fprintf(stderr, "%s\n", m->error_message.c_str());
+		m->error_message = "failed: open pty slave";
 		close(m->pty_master);
 		m->pty_master = -1;
-		m->exit_code = -1;
-		notify_completed();
+		fail();
 		return;
 	}
-	if (pid == 0) {
-		// fork 後の子プロセス。malloc/stdio などロック取得を伴うAPIは
-		// デッドロックの危険があるため最小限に留める。
-		setsid();
-		setenv("LANG", "C", 1);
-		if (!envcopy.empty()) {
-			putenv(envcopy.data());
-		}
-
-		char *pts_name = ptsname(m->pty_master);
-		int pty_slave = pts_name ? open(pts_name, O_RDWR) : -1;
-		close(m->pty_master);
-		if (pty_slave < 0) {
-			char const msg[] = "failed: open pty slave\n";
-			if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {
-				// ignore
-			}
-			_exit(127);
-		}
-
+	{
 		struct termios tio;
 		memset(&tio, 0, sizeof(tio));
 		cfmakeraw(&tio);
@@ -734,130 +1653,136 @@ void ProcessPosixPty::run()
 		tio.c_lflag |= ECHO;
 		tcsetattr(pty_slave, TCSANOW, &tio);
 		ioctl(pty_slave, TIOCSWINSZ, &orig_winsize);
+	}
 
-		dup2(pty_slave, STDIN_FILENO);
-		dup2(pty_slave, STDOUT_FILENO);
-		dup2(pty_slave, STDERR_FILENO);
-		close(pty_slave);
-
-		if (!change_dir_.empty()) {
-			chdir(change_dir_.c_str());
-		}
-
-		execvp(argv[0], argv.data());
+	ProcessPosixSpawner::Params params;
+	params.argv = argv.data();
+	params.tty = pts_name.c_str();
+	params.change_dir = change_dir_.c_str();
+	char const *envlist[] = { envcopy.c_str(), nullptr };
+	params.env = envlist;
+	params.trace_id = m->run->trace_id;
+	m->run->started = std::chrono::steady_clock::now();
+	pid_t pid = ProcessPosixSpawner::spawn(m->spawn_method, params);
+	int spawn_error = errno;
+	ProcessMetrics::record(ProcessMetrics::SpawnLatency, nanoseconds_since(m->run->started));
+	// 親がスレーブを開いたままだと、子の終了後も master が EIO にならない
+	close(pty_slave);
+	if (pid < 0) {
+		m->error_code = spawn_error;
+		m->error_message = "failed: fork";
+		close(m->pty_master);
+		m->pty_master = -1;
+		fail();
+		return;
+	}
 
-		// execvp()は成功すれば戻らない。ここに来るのは失敗した場合のみ。
-		// 何もせず抜けると、フォークされたこの子プロセスがスレッド関数の
-		// 残りを実行し続け（このプロセスにとっては唯一のスレッドなので）
-		// 最終的に終了コード0で静かに終了してしまい、呼び出し元からは
-		// コマンドが成功したように見えてしまう。
-		{
-			char const msg[] = "failed: exec\n";
-			if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {
-				// ignore
-			}
+	std::shared_ptr<ProcessPosixPtyRun> run = m->run;
+	run->pid = pid;
+	int master = m->pty_master;
+	ProcessMetrics::add(ProcessMetrics::Spawns);
+	auto deadline = run->started + m->execution_timeout;
+	bool has_deadline = m->execution_timeout.count() > 0;
+
+	reactor.post([this, run, master, deadline, has_deadline]() {
+		ProcessPosixReactor &reactor = ProcessPosixReactor::instance();
+
+		if (has_deadline) {
+			run->timeout_timer = reactor.add_timer(deadline - std::chrono::steady_clock::now(), [run]() {
+				run->timeout_timer = 0;
+				if (!run->exited) {
+					run->timed_out = true;
+					ProcessPosixPtyRun::terminate(run);
+				}
+			});
 		}
-		_exit(127);
 
-	} else {
-
-		bool ok = false;
-		bool child_reaped = false;
-
-		while (1) {
-			// if (isInterruptionRequested()) break;
-			if (m->interrupted) break;
-			int status = 0;
-			int r = waitpid(pid, &status, WNOHANG);
-			if (r < 0) break;
-			if (r > 0) {
-				child_reaped = true;
-				if (WIFEXITED(status)) {
-					m->exit_code = WEXITSTATUS(status);
-					ok = true;
-				} else if (WIFSIGNALED(status)) {
-					m->exit_code = 128 + WTERMSIG(status);
-				}
-				// 子が終了してもPTYバッファに出力が残っている場合があるため、
-				// master が EIO/EOF になるまで読み切ってから抜ける
-				while (1) {
-					fd_set fds;
-					FD_ZERO(&fds);
-					FD_SET(m->pty_master, &fds);
-					timeval tv;
-					tv.tv_sec = 0;
-					tv.tv_usec = 10000;
-					int sr = select(m->pty_master + 1, &fds, nullptr, nullptr, &tv);
-					if (sr <= 0) break;
-					char buf[1024];
-					int len = read(m->pty_master, buf, sizeof(buf));
-					if (len <= 0) break;
-					write_output(buf, len);
+		// 子が終了してもPTYバッファに出力が残っている場合があるため、子の回収後も
+		// master が EIO/EOF になるか、一定時間出力が途絶えるまで読み続けてから完了する。
+		auto arm_drain_timer = [this, run]() {
+			ProcessPosixReactor &reactor = ProcessPosixReactor::instance();
+			reactor.cancel_timer(run->drain_timer);
+			run->drain_timer = reactor.add_timer(std::chrono::milliseconds(10), [this, run]() {
+				run->drain_timer = 0;
+				finish();
+			});
+		};
+
+		reactor.add_reader(
+			master,
+			[this, run, arm_drain_timer](char const *ptr, size_t len) {
+				if (ProcessTrace::enabled()) {
+					if (!run->got_output) {
+						run->got_output = true;
+						ProcessTrace::record(ProcessTrace::Event::FirstByte, run->trace_id, run->pid);
+					}
+					ProcessTrace::record(ProcessTrace::Event::Read, run->trace_id, run->pid, len);
 				}
-				break;
-			}
-
-			{
-				fd_set fds;
-				FD_ZERO(&fds);
-				FD_SET(m->pty_master, &fds);
-				timeval tv;
-				tv.tv_sec = 0;
-				tv.tv_usec = 10000;
-				int r = select(m->pty_master + 1, &fds, nullptr, nullptr, &tv);
-				if (r < 0) break;
-				if (r > 0) {
-					char buf[1024];
-					int len = read(m->pty_master, buf, sizeof(buf));
-					if (len > 0) {
-						write_output(buf, len);
+				if (run->vt_stripped) {
+					run->vt_text.clear();
+					run->vt_stripper.append(ptr, len, &run->vt_text);
+					if (!run->vt_text.empty()) {
+						write_output(run->vt_text.data(), run->vt_text.size());
 					}
+				} else {
+					write_output(ptr, len);
 				}
-			}
-		}
-
-		if (!child_reaped) {
-			// SIGTERM を無視する子のため、猶予時間後に SIGKILL へエスカレーションする
-			kill(pid, SIGTERM);
-			int status = 0;
-			bool reaped = false;
-			for (int i = 0; i < 200; i++) { // 最大2秒 (200 x 10ms)
-				pid_t wr = waitpid(pid, &status, WNOHANG);
-				if (wr == pid) {
-					reaped = true;
-					break;
+				if (run->exited) {
+					arm_drain_timer();
 				}
-				if (wr < 0 && errno != EINTR) break;
-				std::this_thread::sleep_for(std::chrono::milliseconds(10));
-			}
-			if (!reaped) {
-				kill(pid, SIGKILL);
-				while (waitpid(pid, &status, 0) < 0 && errno == EINTR) { }
+			},
+			[this, run](int) {
+				run->master_closed = true;
+				if (run->exited) {
+					finish();
+				}
+			});
+
+		reactor.watch_child(run->pid, [this, run, arm_drain_timer](int status, struct rusage const &usage) {
+			run->status = status;
+			run->usage = usage;
+			run->wall_seconds = seconds_since(run->started);
+			run->exited_at = std::chrono::steady_clock::now();
+			int exit_code = exit_code_from_status(status);
+			ProcessTrace::record(ProcessTrace::Event::Reap, run->trace_id, run->pid, (uint64_t)(int64_t)exit_code);
+			ProcessMetrics::add(ProcessMetrics::Exits);
+			ProcessMetrics::record_exit_code(exit_code);
+			ProcessMetrics::record(ProcessMetrics::RunTime, nanoseconds_since(run->started));
+			run->exited = true;
+			run->pid = 0;
+			if (run->master_closed) {
+				finish();
+			} else {
+				arm_drain_timer();
 			}
-			if (WIFSIGNALED(status)) m->exit_code = 128 + WTERMSIG(status);
-		}
-		close(m->pty_master);
-		m->pty_master = -1;
-
-		// trace.end();
-
-		notify_completed();
-
-		(void)ok;
-	}
+		});
+	});
 }
 
 void ProcessPosixPty::stop()
 {
-	m->interrupted = true;
+	terminate();
 	wait();
 }
 
+void ProcessPosixPty::terminate()
+{
+	std::shared_ptr<ProcessPosixPtyRun> run = m->run;
+	if (run) {
+		ProcessPosixPtyRun::terminate(run);
+	}
+}
+
 int ProcessPosixPty::get_exit_code() const
 {
 	return m->exit_code;
 }
 
+ProcessUsage ProcessPosixPty::get_usage() const
+{
+	return m->usage;
+}
+
 void ProcessPosixPty::close_input()
 {
 }
@@ -2,6 +2,7 @@
 #define BASICPROCESSPOSIX_H
 
 #include "AbstractProcess.h"
+#include "ProcessPosixSpawn.h"
 #include <climits>
 #include <optional>
 
@@ -10,29 +11,136 @@ private:
 	struct Private;
 	Private *m;
 	static void parse_args(std::string const &cmd, std::vector<std::string> *out);
+	friend class ProcessPipeline;
 
 public:
+	enum class Capture {
+		Pipe, // パイプ経由でリアクタが読み取る (既定)
+		File, // 子の出力先を memfd (または無名の一時ファイル) に直接向け、終了後に mmap する
+	};
+
 	ProcessPosix();
 	~ProcessPosix();
 	void start(std::string const &command, bool use_input);
 	int wait();
+	bool wait_for(std::chrono::milliseconds timeout) override;
 	void stop();
+	// stop() と同じく SIGTERM を送り、応じなければ2秒後に SIGKILL するが、終了を待たずに戻る。
+	// リアクタスレッドからも呼べる。結果は通常どおり wait() で受け取る
+	void terminate();
 	bool is_running() const;
 	void write_input(char const *ptr, int len);
 	void close_input();
 	int get_exit_code() const;
+	ProcessUsage get_usage() const override;
 	int get_error_code() const;
 	std::string const &get_error_message() const;
 	std::vector<char> const &stdout_bytes() const;
 	std::vector<char> const &stderr_bytes() const;
+	std::vector<char> take_stdout();
+	std::vector<char> take_stderr();
+	std::string_view stdout_view() const override;
+	std::string_view stderr_view() const override;
 
 	void close_input(bool justnow);
+
+	// start() 前に設定すること。既定は ProcessPosixSpawner::Method::Fork。
+	void set_spawn_method(ProcessPosixSpawner::Method method);
+
+	// start() 前に設定すること。子の終了と出力の読み切りを確認した時点で、
+	// wait() が戻るより前にリアクタスレッドから呼ばれる（この中で wait() を呼ばないこと）。
+	// start() 自体が失敗した場合は呼ばれない。
+	void set_completion_callback(std::function<void(bool, std::shared_ptr<void>)> fn, std::shared_ptr<void> userdata);
+
+	// start() 前に設定すること。stdout/stderr から読み取った塊を、読み取った順に
+	// リアクタスレッドから渡す (ブロックしないこと)。完了通知より前にすべて届く。
+	void set_stdout_callback(std::function<void(char const *ptr, size_t len)> fn);
+	void set_stderr_callback(std::function<void(char const *ptr, size_t len)> fn);
+
+	// start() 前に設定すること。false にすると出力を溜めず、stdout_bytes()/stderr_bytes() は空になる。
+	// コールバックだけで逐次処理すれば、長時間動くコマンドでも一定のメモリで扱える。既定は true。
+	void set_accumulate_output(bool accumulate);
+
+	// start() 前に設定すること。出力が bytes を超えたら、dir (空なら $TMPDIR か /tmp) の
+	// unlink 済み一時ファイルへ退避する (0 = 退避しない、既定)。退避した結果は wait() 後に
+	// stdout_view()/stderr_view() で mmap した読み取り専用の領域として参照できる。
+	void set_spill_threshold(size_t bytes, std::string const &dir = { });
+
+	// start() 前に設定すること。Capture::File にしたストリームは、子が exec 前から memfd へ
+	// 直接書き込むので、実行中は読み取りもコピーも行われない。結果は wait() 後に
+	// stdout_view()/stderr_view() で mmap した領域として参照できる。
+	// このストリームにはチャンクコールバックは呼ばれない。Method::Helper では Pipe として扱う。
+	// set_stdout_file() などで取り込まない設定にしていれば、取り込みに戻す。
+	void set_stdout_capture(Capture capture);
+	void set_stderr_capture(Capture capture);
+
+	// start() 前に設定すること。子の stdin へ未送信のまま溜めておく量の上限 (0 = 無制限、既定)。
+	// 溜まった入力はリアクタが非ブロッキングの fd へ writev() でまとめて送り出す。上限があると、
+	// write_input() は空きができるまでブロックし、try_write_input() は入るだけ受け取る。
+	// リアクタスレッド (コールバックの中) からの書き込みと Method::Helper では上限は効かない。
+	void set_input_limit(size_t bytes);
+	// ブロックしない write_input()。受け取ったバイト数を返す。上限に達していれば 0 (would block)、
+	// stdin を閉じた後 (子が閉じた場合を含む) は -1
+	int try_write_input(char const *ptr, int len);
+	// 上限に空きができるまで最長 timeout 待つ。空きがあれば true、時間内に空かないか stdin を閉じていれば false
+	bool wait_input_space(std::chrono::milliseconds timeout);
+	// まだ子へ送り出していない stdin のバイト数
+	size_t pending_input() const;
+
+	// start() 前に設定すること。子の stdin を path のファイル (または fd の複製) にする。
+	// ファイルを子へそのまま渡すので、親は読み取りもコピーも行わない (子からは seek もできる)。
+	// fd は start() で複製するので、呼び出し側はその後いつ閉じてもよい。
+	void set_stdin_file(std::string const &path);
+	void set_stdin_file(int fd);
+	// start() 前に設定すること。data を子の stdin へ流し、流し終えたら閉じる。Linux では
+	// vmsplice() でページをパイプへ参照させるだけなので、write_input() のキューを通らずコピーもしない。
+	// 子が読み終えるまでページを参照しているので、data は wait() が戻るまで変更も解放もしないこと。
+	void set_stdin_buffer(std::string_view data);
+	// start() 前に設定すること。子の stdin を /dev/null にする (すぐに EOF を読む) か、親の stdin をそのまま使わせる
+	void set_stdin_null();
+	void set_stdin_inherit();
+	// stdin を write_input() で書き込むパイプに戻す (既定)
+	void set_stdin_pipe();
+	// 以上のいずれかを設定している間、start() の use_input と write_input() は効かず、
+	// Method::Helper は PosixSpawn として扱う。
+
+	// start() 前に設定すること。stdout/stderr を取り込まずに、path のファイル (既定は追記、
+	// append が false なら切り詰める。なければ 0644 で作る)、fd の複製、/dev/null、
+	// または親の stdout/stderr へ子から直接書かせる。そのストリームにはパイプもリアクタの
+	// 読み取りも使わないので、stdout_bytes()/stderr_bytes() は空のままで、チャンクコールバックも
+	// 呼ばれない。fd は start() で複製するので、呼び出し側はその後いつ閉じてもよい。
+	// 設定している間、Method::Helper は PosixSpawn として扱う。set_stdout_capture() で取り込みに戻る。
+	void set_stdout_file(std::string const &path, bool append = true);
+	void set_stdout_file(int fd);
+	void set_stdout_null();
+	void set_stdout_inherit();
+	void set_stderr_file(std::string const &path, bool append = true);
+	void set_stderr_file(int fd);
+	void set_stderr_null();
+	void set_stderr_inherit();
+
+	// start() 前に設定すること。起動から timeout が過ぎても終了していなければ、stop() と同じく
+	// SIGTERM を送り、2秒以内に終了しなければ SIGKILL する (0 = 無制限、既定)。
+	// 期限の監視はリアクタのタイマーで行うので、待つためのスレッドもポーリングも要らない。
+	// 終了させた場合は wait() 後の timed_out() が true になる。
+	void set_execution_timeout(std::chrono::milliseconds timeout);
+	bool timed_out() const;
+
+	// stdout に patterns のいずれかが現れるまで待ち、その番号を返す。timeout_ms (負なら無期限) が
+	// 過ぎるか、出力が終わるまでに現れなければ -1。前回見つかった位置より後ろだけを探すので、
+	// 続けて呼べば順に現れるプロンプトを1つずつ待てる。wait() より前に使うこと。
+	// Capture::File にした stdout は探せない。set_accumulate_output(false) やディスクへの退避を
+	// 使う場合、呼ぶ前に届いていた出力は末尾 64KiB だけを探す。
+	int wait_for_any_output(std::vector<std::string> const &patterns, int timeout_ms = -1);
 };
 
 class ProcessPosixPty : public AbstractPtyProcess {
 private:
 	struct Private;
 	Private *m;
+	void finish();
+	void watch_input();
+	void flush_input();
 
 protected:
 	void run();
@@ -42,16 +150,35 @@ public:
 	~ProcessPosixPty() override;
 	bool is_running() const override;
 	int read_output(char *ptr, int len) override;
+	// 書き切るまで待つ (子が読まずに終了した場合は残りを捨てて戻る)。リアクタスレッド
+	// (コールバックの中) からは待たずに溜めておき、master が書き込み可能になったらリアクタが送り出す
 	void write_input(char const *ptr, int len) override;
+	// 何もしない。端末は raw モード (VEOF が効かない) なので、master を閉じて切断する以外に
+	// 子へ EOF を伝える手段がない
 	void close_input();
 	void start(std::string const &cmd, std::string const &env, bool use_input) override;
 	int wait() override;
+	bool wait_for(std::chrono::milliseconds timeout) override;
 	void stop() override;
+	// ProcessPosix::terminate() と同じ
+	void terminate();
 	int get_exit_code() const override;
+	ProcessUsage get_usage() const override;
 	int get_error_code() const;
 	std::string const &get_error_message() const;
 
+	// time はミリ秒 (LONG_MAX 以上なら無期限)。wait_for() と同じだが、実行していなければ false
 	bool wait(unsigned long time);
+
+	// start() 前に設定すること。ProcessPosix::set_execution_timeout() と同じ
+	void set_execution_timeout(std::chrono::milliseconds timeout);
+	bool timed_out() const;
+
+	// start() 前に設定すること。既定は ProcessPosixSpawner::Method::Fork。
+	void set_spawn_method(ProcessPosixSpawner::Method method);
+	// start() 前に設定すること。true なら出力から VT エスケープシーケンスを取り除いてから
+	// 溜める (read_output() や wait_for_any_output() もシーケンスを除いた出力を見る)。既定は false
+	void set_vt_stripped(bool stripped);
 };
 
 #endif // BASICPROCESSPOSIX_H
@@ -1,4 +1,5 @@
 #include "BasicProcessWin.h"
+#include "MultiPatternMatcher.h"
 #include <algorithm>
 #include <condition_variable>
 #include <memory>
@@ -83,7 +84,7 @@ struct BasicProcessWin::Private {
 		AutoHandle hInputWrite;
 		AutoHandle hOutputRead;
 		AutoProcessInformation pi;
-		std::deque<char> output_queue;
+		ByteQueue output_queue;
 		std::vector<char> output_vector;
 		// std::string output_bytes;
 		bool output_closed = false;
@@ -94,6 +95,7 @@ struct BasicProcessWin::Private {
 	std::thread output_reader;
 	std::mutex output_mutex;
 	std::condition_variable output_changed;
+	OutputWaitList output_waiters; // wait_for_any_output()
 	std::mutex input_mutex;
 	std::mutex snap_mutex;
 	HANDLE hProcess_snap = nullptr;
@@ -152,6 +154,10 @@ bool BasicProcessWin::start(std::string const &cmd)
 	{
 		std::lock_guard<std::mutex> lock(m->output_mutex);
 		m->d.output_closed = false;
+		m->output_waiters.reset();
+		if (!m->options.output_vector) {
+			m->output_waiters.keep_tail(); // output_vector に溜めないので、待機用に末尾だけ持っておく
+		}
 	}
 
 	// 子へ渡す端だけを継承可能にし、親が保持する端は継承させない。
@@ -229,11 +235,12 @@ bool BasicProcessWin::start(std::string const &cmd)
 		while (ReadFile(m->d.hOutputRead, buf, sizeof(buf), &n, nullptr) && n > 0) {
 			{
 				std::lock_guard<std::mutex> lock(m->output_mutex);
+				m->output_waiters.feed(buf, n);
 				if (m->options.output_vector) {
 					m->d.output_vector.insert(m->d.output_vector.end(), buf, buf + n);
 				}
 				if (m->options.output_queue) {
-					m->d.output_queue.insert(m->d.output_queue.end(), buf, buf + n);
+					m->d.output_queue.append(buf, n);
 				}
 			}
 			m->output_changed.notify_all();
@@ -245,6 +252,7 @@ bool BasicProcessWin::start(std::string const &cmd)
 		{
 			std::lock_guard<std::mutex> lock(m->output_mutex);
 			m->d.output_closed = true;
+			m->output_waiters.close();
 		}
 		m->output_changed.notify_all();
 
@@ -298,28 +306,16 @@ void BasicProcessWin::terminate()
 
 bool BasicProcessWin::wait_for_output(std::string const &text)
 {
-	// プロンプトが複数回のReadFileに分割されても、連結済みoutput_vectorから検索できる。
-	// ワーカーが先に終了した場合はoutput_closedで待機を解除する。
-	// 通知のたびに全量を文字列化するとO(n^2)になるため、検索済み位置を保持し、
-	// テキストがチャンク境界をまたぐ場合に備えて text.size()-1 だけ遡って再検索する。
+	return wait_for_any_output({ text }) == 0;
+}
+
+int BasicProcessWin::wait_for_any_output(std::vector<std::string> const &patterns, int timeout_ms)
+{
+	// プロンプトが複数回のReadFileに分割されても、Aho-Corasick の状態を引き継いで探すので
+	// 各バイトは一度しか調べない。ワーカーが先に終了した場合は output_closed で待機を解除する。
 	std::unique_lock<std::mutex> lock(m->output_mutex);
-	size_t searched = 0;
-	bool found = false;
-	m->output_changed.wait(lock, [&] {
-		size_t total = m->d.output_vector.size();
-		if (searched < total) {
-			size_t overlap = text.empty() ? 0 : text.size() - 1;
-			size_t begin = searched > overlap ? searched - overlap : 0;
-			std::string_view view(m->d.output_vector.data() + begin, total - begin);
-			if (view.find(text) != std::string_view::npos) {
-				found = true;
-				return true;
-			}
-			searched = total;
-		}
-		return m->d.output_closed;
-	});
-	return found;
+	std::string_view history(m->d.output_vector.data(), m->d.output_vector.size());
+	return m->output_waiters.wait(lock, m->output_changed, patterns, history, timeout_ms);
 }
 
 void BasicProcessWin::close_input()
@@ -351,15 +347,7 @@ int BasicProcessWin::read_output(char *ptr, int n)
 		return 0;
 	}
 	std::lock_guard<std::mutex> lock(m->output_mutex);
-	if (!m->d.output_queue.empty()) {
-		int count = std::min(n, (int)m->d.output_queue.size());
-		for (int i = 0; i < count; i++) {
-			ptr[i] = m->d.output_queue.front();
-			m->d.output_queue.pop_front();
-		}
-		return static_cast<int>(count);
-	}
-	return 0;
+	return static_cast<int>(m->d.output_queue.pop(ptr, static_cast<size_t>(n)));
 }
 
 bool BasicProcessWin::is_running() const
@@ -372,6 +360,13 @@ std::vector<char> const &BasicProcessWin::stdout_bytes() const
 	return m->output_bytes;
 }
 
+std::vector<char> BasicProcessWin::take_stdout()
+{
+	std::vector<char> v;
+	v.swap(m->output_bytes);
+	return v;
+}
+
 int BasicProcessWin::get_exit_code() const
 {
 	return static_cast<int>(m->last_exit_code);
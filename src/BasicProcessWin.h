@@ -42,6 +42,7 @@ public:
 	virtual int read_output(char *ptr, int n) = 0;
 	virtual bool is_running() const = 0;
 	virtual std::vector<char> const &stdout_bytes() const = 0;
+	virtual std::vector<char> take_stdout() = 0; // 結果をコピーせずに取り出す
 	virtual int get_exit_code() const = 0;
 };
 
@@ -70,8 +71,11 @@ public:
 	int read_output(char *ptr, int n);
 	int get_exit_code() const;
 	std::vector<char> const &stdout_bytes() const;
+	std::vector<char> take_stdout();
 
 	bool wait_for_output(std::string const &text);
+	// patterns のいずれかが出力に現れるまで待ち、その番号を返す (タイムアウトか終了で -1)
+	int wait_for_any_output(std::vector<std::string> const &patterns, int timeout_ms = -1);
 
 	// start() 前に設定すること。実行中の変更はスレッドセーフではない。
 	void set_completion_callback(std::function<void(bool, std::shared_ptr<void>)> const &fn, std::shared_ptr<void> user_data);
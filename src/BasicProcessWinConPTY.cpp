@@ -1,6 +1,7 @@
 #include "BasicProcessWinConPTY.h"
 #include <windows.h>
 #include "ProcessWinHelper.h" // This file must be included after <windows.h>
+#include "VtStripper.h"
 
 struct BasicProcessWinConPTY::Private {
 	struct D {
@@ -12,7 +13,7 @@ struct BasicProcessWinConPTY::Private {
 		AutoHandle hPipeOutRead;
 		AutoHandle hPipeOutWrite;
 		_AbstractBasicProcess::ExecResult result;
-		std::deque<char> output_queue;
+		ByteQueue output_queue;
 		std::vector<char> output_vector;
 		bool output_closed = false;
 	} d;
@@ -198,13 +199,14 @@ bool BasicProcessWinConPTY::start(std::string const &cmd)
 	m->output_reader = std::thread([this, hStdOutput, vt_stripper = VtStripper { }]() mutable {
 		char buf[256];
 		DWORD n;
+		std::string text;
 		// fprintf(stderr, "before ReadFile\n");
 		while (ReadFile(m->d.hPipeOutRead, buf, sizeof(buf), &n, nullptr) && n > 0) {
 			// fprintf(stderr, "ReadFile: %d\n", (int)n);
 			std::string_view view(buf, n);
-			std::string text;
 			if (m->options.vt_stripped) {
-				text = vt_stripper.append(view);
+				text.clear();
+				vt_stripper.append(buf, n, &text);
 				view = std::string_view(text.data(), text.size());
 				// fprintf(stderr, "Stripped: %d %s\n", (int)text.size(), text.c_str());
 			}
@@ -217,7 +219,7 @@ bool BasicProcessWinConPTY::start(std::string const &cmd)
 					m->d.output_vector.insert(m->d.output_vector.end(), view.begin(), view.end());
 				}
 				if (m->options.output_queue) {
-					m->d.output_queue.insert(m->d.output_queue.end(), view.begin(), view.end());
+					m->d.output_queue.append(view.data(), view.size());
 				}
 			}
 		}
@@ -297,6 +299,17 @@ BasicProcessWinConPTY::ExecResult BasicProcessWinConPTY::wait()
 	return ret;
 }
 
+bool BasicProcessWinConPTY::wait_for_exit(unsigned long ms)
+{
+	HANDLE h;
+	{
+		std::lock_guard<std::mutex> lock(m->snap_mutex);
+		h = m->hProcess_snap;
+	}
+	if (!IS_VALID_HANDLE(h)) return true;
+	return WaitForSingleObject(h, ms) != WAIT_TIMEOUT;
+}
+
 void BasicProcessWinConPTY::terminate()
 {
 	std::lock_guard<std::mutex> lock(m->snap_mutex);
@@ -334,14 +347,7 @@ int BasicProcessWinConPTY::read_output(char *ptr, int len)
 		return 0;
 	}
 	std::lock_guard<std::mutex> lock(m->output_mutex);
-	if (m->d.output_queue.empty()) return 0;
-
-	int n = std::min(len, static_cast<int>(m->d.output_queue.size()));
-	for (int i = 0; i < n; ++i) {
-		ptr[i] = m->d.output_queue.front();
-		m->d.output_queue.pop_front();
-	}
-	return n;
+	return static_cast<int>(m->d.output_queue.pop(ptr, static_cast<size_t>(len)));
 }
 
 bool BasicProcessWinConPTY::is_running() const
@@ -354,6 +360,13 @@ std::vector<char> const &BasicProcessWinConPTY::stdout_bytes() const
 	return m->output_bytes;
 }
 
+std::vector<char> BasicProcessWinConPTY::take_stdout()
+{
+	std::vector<char> v;
+	v.swap(m->output_bytes);
+	return v;
+}
+
 void BasicProcessWinConPTY::set_no_window(bool no_window)
 {
 	m->options.no_window = no_window;
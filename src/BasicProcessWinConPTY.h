@@ -24,6 +24,9 @@ public:
 
 	bool start(std::string const &cmd);
 	ExecResult wait();
+	// 子の終了を最長 ms ミリ秒 (INFINITE なら無期限) 待つ。終了したか実行していなければ true。
+	// 結果の回収は wait() で行う。ハンドルを閉じる wait() と並行して呼ばないこと
+	bool wait_for_exit(unsigned long ms);
 	void terminate();
 	void close_input();
 	int write_input(char const *ptr, int n);
@@ -31,6 +34,7 @@ public:
 	bool is_running() const;
 	int get_exit_code() const;
 	std::vector<char> const &stdout_bytes() const;
+	std::vector<char> take_stdout();
 
 	void set_no_window(bool no_window);
 
@@ -0,0 +1,216 @@
+#ifndef BYTEQUEUE_H
+#define BYTEQUEUE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// 固定長チャンクを連結した FIFO バイトキュー。
+// std::deque<char> と違い1バイト単位ではなく memcpy でまとめて積み降ろしでき、
+// 先頭/末尾の連続領域を直接参照できる（read()/write() に直接渡せる）。
+// 空になったチャンクは1つだけ取っておいて再利用する。スレッドセーフではない。
+class ByteQueue {
+public:
+	static constexpr size_t DEFAULT_CHUNK_SIZE = 16384;
+
+private:
+	std::deque<std::unique_ptr<char[]>> chunks_;
+	std::unique_ptr<char[]> spare_;
+	size_t chunk_size_;
+	size_t head_ = 0; // 先頭チャンク内の読み出し位置
+	size_t tail_ = 0; // 末尾チャンク内の書き込み位置
+	size_t size_ = 0;
+
+	size_t front_end() const
+	{
+		return chunks_.size() == 1 ? tail_ : chunk_size_;
+	}
+
+	void push_chunk()
+	{
+		if (spare_) {
+			chunks_.push_back(std::move(spare_));
+		} else {
+			chunks_.emplace_back(new char[chunk_size_]);
+		}
+		tail_ = 0;
+	}
+
+	void pop_chunk()
+	{
+		if (!spare_) {
+			spare_ = std::move(chunks_.front());
+		}
+		chunks_.pop_front();
+		head_ = 0;
+		if (chunks_.empty()) {
+			tail_ = 0;
+		}
+	}
+
+	// dst == nullptr なら捨てるだけ
+	size_t consume(char *dst, size_t len)
+	{
+		size_t total = 0;
+		while (len > 0 && size_ > 0) {
+			size_t n = std::min(len, front_end() - head_);
+			if (dst) {
+				memcpy(dst + total, chunks_.front().get() + head_, n);
+			}
+			head_ += n;
+			size_ -= n;
+			total += n;
+			len -= n;
+			if (chunks_.size() == 1 && head_ == tail_) {
+				head_ = tail_ = 0; // 空になったチャンクは先頭から使い直す
+			} else if (head_ == chunk_size_) {
+				pop_chunk();
+			}
+		}
+		return total;
+	}
+
+public:
+	ByteQueue()
+		: chunk_size_(DEFAULT_CHUNK_SIZE)
+	{
+	}
+	explicit ByteQueue(size_t chunk_size)
+		: chunk_size_(chunk_size > 0 ? chunk_size : DEFAULT_CHUNK_SIZE)
+	{
+	}
+	ByteQueue(ByteQueue &&other) noexcept
+		: chunk_size_(other.chunk_size_)
+	{
+		*this = std::move(other);
+	}
+	ByteQueue &operator=(ByteQueue &&other) noexcept
+	{
+		if (this != &other) {
+			chunks_ = std::move(other.chunks_);
+			spare_ = std::move(other.spare_);
+			chunk_size_ = other.chunk_size_;
+			head_ = other.head_;
+			tail_ = other.tail_;
+			size_ = other.size_;
+			other.chunks_.clear();
+			other.head_ = other.tail_ = other.size_ = 0;
+		}
+		return *this;
+	}
+	ByteQueue(ByteQueue const &) = delete;
+	ByteQueue &operator=(ByteQueue const &) = delete;
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	bool empty() const
+	{
+		return size_ == 0;
+	}
+
+	void clear()
+	{
+		while (!chunks_.empty()) {
+			pop_chunk();
+		}
+		head_ = tail_ = size_ = 0;
+	}
+
+	void append(char const *ptr, size_t len)
+	{
+		while (len > 0) {
+			if (chunks_.empty() || tail_ == chunk_size_) {
+				push_chunk();
+			}
+			size_t n = std::min(len, chunk_size_ - tail_);
+			memcpy(chunks_.back().get() + tail_, ptr, n);
+			tail_ += n;
+			size_ += n;
+			ptr += n;
+			len -= n;
+		}
+	}
+
+	// 先頭から最大 len バイトを取り出し、取り出したバイト数を返す
+	size_t pop(char *dst, size_t len)
+	{
+		return dst ? consume(dst, len) : 0;
+	}
+
+	// 先頭から最大 len バイトを捨てる
+	size_t discard(size_t len)
+	{
+		return consume(nullptr, len);
+	}
+
+	// 先頭の連続領域。write() で送り出し、書けた分を discard() する使い方を想定
+	std::string_view front_span() const
+	{
+		if (size_ == 0) return { };
+		return { chunks_.front().get() + head_, front_end() - head_ };
+	}
+
+	// 先頭から最大 max 個の連続領域を out へ並べ、その数を返す。writev() でまとめて送り出し、
+	// 書けた分を discard() する使い方を想定
+	size_t front_spans(std::string_view *out, size_t max) const
+	{
+		size_t n = std::min(max, chunks_.size());
+		size_t count = 0;
+		for (size_t i = 0; i < n; i++) {
+			size_t begin = i == 0 ? head_ : 0;
+			size_t end = i + 1 == chunks_.size() ? tail_ : chunk_size_;
+			if (end > begin) {
+				out[count++] = std::string_view(chunks_[i].get() + begin, end - begin);
+			}
+		}
+		return count;
+	}
+
+	// 先頭から順にすべての連続領域を fn(std::string_view) へ渡す
+	template <typename F> void for_each_span(F fn) const
+	{
+		size_t n = chunks_.size();
+		for (size_t i = 0; i < n; i++) {
+			size_t begin = i == 0 ? head_ : 0;
+			size_t end = i + 1 == n ? tail_ : chunk_size_;
+			if (end > begin) {
+				fn(std::string_view(chunks_[i].get() + begin, end - begin));
+			}
+		}
+	}
+
+	// 末尾の書き込み可能な連続領域 (必ず1バイト以上)。read() で直接書き込み、commit() で確定する
+	std::pair<char *, size_t> prepare()
+	{
+		if (chunks_.empty() || tail_ == chunk_size_) {
+			push_chunk();
+		}
+		return { chunks_.back().get() + tail_, chunk_size_ - tail_ };
+	}
+
+	void commit(size_t len)
+	{
+		len = std::min(len, chunk_size_ - tail_);
+		tail_ += len;
+		size_ += len;
+	}
+
+	// 全体を out の末尾へコピーする（キューは変更しない）
+	void copy_to(std::vector<char> *out) const
+	{
+		out->reserve(out->size() + size_);
+		for_each_span([&](std::string_view s) {
+			out->insert(out->end(), s.begin(), s.end());
+		});
+	}
+};
+
+#endif // BYTEQUEUE_H
@@ -0,0 +1,235 @@
+#include "CaptureBuffer.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CaptureBuffer::~CaptureBuffer()
+{
+	release();
+}
+
+CaptureBuffer::CaptureBuffer(CaptureBuffer &&other) noexcept
+{
+	*this = std::move(other);
+}
+
+CaptureBuffer &CaptureBuffer::operator=(CaptureBuffer &&other) noexcept
+{
+	if (this != &other) {
+		release();
+		memory_ = std::move(other.memory_);
+		other.memory_.clear();
+		spill_threshold_ = other.spill_threshold_;
+		spill_dir_ = other.spill_dir_; // 設定は移動元にも残す
+		fd_ = other.fd_;
+		file_size_ = other.file_size_;
+		map_ = other.map_;
+		finished_ = other.finished_;
+		other.fd_ = -1;
+		other.file_size_ = 0;
+		other.map_ = nullptr;
+		other.finished_ = false;
+	}
+	return *this;
+}
+
+void CaptureBuffer::release()
+{
+#ifndef _WIN32
+	if (map_) {
+		munmap(map_, file_size_);
+		map_ = nullptr;
+	}
+	if (fd_ >= 0) {
+		close(fd_);
+		fd_ = -1;
+	}
+#endif
+	file_size_ = 0;
+}
+
+void CaptureBuffer::set_spill_threshold(size_t bytes, std::string const &dir)
+{
+	spill_threshold_ = bytes;
+	spill_dir_ = dir;
+}
+
+int CaptureBuffer::create_file(std::string const &dir, bool prefer_memfd)
+{
+#ifdef _WIN32
+	(void)dir;
+	(void)prefer_memfd;
+	return -1;
+#else
+	int fd = -1;
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+	if (prefer_memfd) {
+		fd = memfd_create("process-capture", MFD_CLOEXEC);
+		if (fd >= 0) return fd;
+	}
+#else
+	(void)prefer_memfd;
+#endif
+	std::string d = dir;
+	if (d.empty()) {
+		char const *tmp = getenv("TMPDIR");
+		d = (tmp && *tmp) ? tmp : "/tmp";
+	}
+#ifdef O_TMPFILE
+	// 名前を持たないファイルとして作れれば、unlink し損ねることもない
+	fd = open(d.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+	if (fd < 0) {
+		std::string path = d + "/process-capture-XXXXXX";
+		std::vector<char> tmpl(path.begin(), path.end());
+		tmpl.push_back('\0');
+		fd = mkstemp(tmpl.data());
+		if (fd >= 0) {
+			unlink(tmpl.data());
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+		}
+	}
+	return fd;
+#endif
+}
+
+// メモリ上の内容を一時ファイルへ移す。失敗した場合はメモリに溜め続ける
+bool CaptureBuffer::spill()
+{
+#ifdef _WIN32
+	spill_threshold_ = 0;
+	return false;
+#else
+	// 退避はメモリを減らすためなので、memfd (メモリ上のファイル) は使わない
+	int fd = create_file(spill_dir_, false);
+	if (fd < 0) {
+		spill_threshold_ = 0; // 以降は試みない
+		return false;
+	}
+	fd_ = fd;
+	file_size_ = 0;
+	std::vector<char> memory;
+	memory.swap(memory_);
+	append(memory.data(), memory.size());
+	return spilled();
+#endif
+}
+
+// 一時ファイルへ書けなくなった (ディスクが一杯など)。読み戻してメモリで続ける
+void CaptureBuffer::unspill()
+{
+#ifndef _WIN32
+	std::vector<char> memory(file_size_);
+	size_t pos = 0;
+	while (pos < memory.size()) {
+		ssize_t n = pread(fd_, memory.data() + pos, memory.size() - pos, pos);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		pos += n;
+	}
+	memory.resize(pos);
+	release();
+	memory_ = std::move(memory);
+	spill_threshold_ = 0;
+#endif
+}
+
+void CaptureBuffer::append(char const *ptr, size_t len)
+{
+	if (len == 0) return;
+#ifndef _WIN32
+	if (map_) {
+		// finish() 後に書き足された
+		munmap(map_, file_size_);
+		map_ = nullptr;
+	}
+	finished_ = false;
+	if (fd_ >= 0) {
+		while (len > 0) {
+			ssize_t n = write(fd_, ptr, len);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) {
+				unspill();
+				memory_.insert(memory_.end(), ptr, ptr + len);
+				return;
+			}
+			file_size_ += n;
+			ptr += n;
+			len -= n;
+		}
+		return;
+	}
+#endif
+	memory_.insert(memory_.end(), ptr, ptr + len);
+	if (spill_threshold_ > 0 && memory_.size() > spill_threshold_) {
+		spill();
+	}
+}
+
+void CaptureBuffer::adopt_file(int fd)
+{
+	clear();
+	fd_ = fd;
+}
+
+void CaptureBuffer::finish()
+{
+	if (finished_) return;
+	finished_ = true;
+#ifndef _WIN32
+	if (fd_ >= 0 && !map_) {
+		// adopt_file() した場合は子が書き込んだ分だけ大きくなっている
+		struct stat st;
+		if (fstat(fd_, &st) == 0 && st.st_size >= 0) {
+			file_size_ = static_cast<size_t>(st.st_size);
+		}
+	}
+	if (fd_ >= 0 && !map_ && file_size_ > 0) {
+		void *p = mmap(nullptr, file_size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+		if (p == MAP_FAILED) {
+			unspill();
+			return;
+		}
+		map_ = static_cast<char *>(p);
+	}
+#endif
+}
+
+std::string_view CaptureBuffer::view() const
+{
+	if (map_) return { map_, file_size_ };
+	if (spilled()) return { };
+	return { memory_.data(), memory_.size() };
+}
+
+std::vector<char> CaptureBuffer::take_vector()
+{
+	std::vector<char> v;
+	if (spilled()) {
+		finish(); // mmap に失敗した場合はメモリへ読み戻される
+	}
+	if (map_) {
+		v.assign(map_, map_ + file_size_);
+		release();
+	} else {
+		v.swap(memory_);
+		release(); // 空のファイルを引き受けていた場合
+	}
+	finished_ = false;
+	return v;
+}
+
+void CaptureBuffer::clear()
+{
+	release();
+	memory_.clear();
+	finished_ = false;
+}
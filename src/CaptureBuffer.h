@@ -0,0 +1,76 @@
+#ifndef CAPTUREBUFFER_H
+#define CAPTUREBUFFER_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 子プロセスの出力を最後まで溜めておくバッファ。
+// 既定ではメモリ (std::vector<char>) に溜めるだけだが、set_spill_threshold() で閾値を
+// 設定すると、それを超えた時点で中身を unlink 済みの一時ファイルへ移し、以降はファイルへ
+// 追記する。finish() 後は一時ファイルを読み取り専用で mmap し、view() でそのまま参照できる。
+// (Windows では一時ファイルへの退避は行わず、常にメモリに溜める)
+// スレッドセーフではない。
+class CaptureBuffer {
+private:
+	std::vector<char> memory_;
+	size_t spill_threshold_ = 0; // 0 = 退避しない
+	std::string spill_dir_;
+	int fd_ = -1; // 退避先の一時ファイル
+	size_t file_size_ = 0;
+	char *map_ = nullptr;
+	bool finished_ = false;
+
+	bool spill();
+	void unspill();
+	void release();
+
+public:
+	CaptureBuffer() = default;
+	~CaptureBuffer();
+	CaptureBuffer(CaptureBuffer &&other) noexcept;
+	CaptureBuffer &operator=(CaptureBuffer &&other) noexcept;
+	CaptureBuffer(CaptureBuffer const &) = delete;
+	CaptureBuffer &operator=(CaptureBuffer const &) = delete;
+
+	// bytes を超えたら dir (空なら $TMPDIR か /tmp) の一時ファイルへ退避する。0 = 退避しない
+	void set_spill_threshold(size_t bytes, std::string const &dir = { });
+
+	void append(char const *ptr, size_t len);
+
+	// 子プロセスが直接書き込むファイル (create_file() で作ったもの) を結果として引き受ける。
+	// 中身は finish() の時点のファイルの大きさで確定する。
+	void adopt_file(int fd);
+
+	// 書き込みの終わり。退避済みなら一時ファイルを mmap する
+	void finish();
+
+	// 名前を持たない読み書き用の一時ファイルを作る (CLOEXEC)。
+	// Linux では memfd_create、それ以外では dir (空なら $TMPDIR か /tmp) の O_TMPFILE か
+	// mkstemp + unlink。失敗時は -1。
+	static int create_file(std::string const &dir = { }, bool prefer_memfd = true);
+
+	bool spilled() const
+	{
+		return fd_ >= 0 || map_;
+	}
+	size_t size() const
+	{
+		return spilled() ? file_size_ : memory_.size();
+	}
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+	// 退避済みの場合は finish() 後にのみ有効 (mmap した領域を指す)
+	std::string_view view() const;
+
+	// 中身を取り出して空にする。メモリ上にある場合はコピーせずに move する
+	std::vector<char> take_vector();
+
+	void clear();
+};
+
+#endif // CAPTUREBUFFER_H
@@ -0,0 +1,216 @@
+#include "MultiPatternMatcher.h"
+#include <cstring>
+#include <deque>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MPM_USE_SSE2 1
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define MPM_USE_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+#ifdef MPM_USE_SSE2
+inline unsigned lowest_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+#endif
+
+} // namespace
+
+MultiPatternMatcher::MultiPatternMatcher()
+{
+	build();
+}
+
+MultiPatternMatcher::MultiPatternMatcher(std::vector<std::string> const &patterns)
+	: patterns_(patterns)
+{
+	build();
+}
+
+void MultiPatternMatcher::set_patterns(std::vector<std::string> const &patterns)
+{
+	patterns_ = patterns;
+	build();
+}
+
+void MultiPatternMatcher::build()
+{
+	state_ = 0;
+	empty_pattern_ = -1;
+
+	// パターンに現れるバイトだけに番号を振り、遷移表の幅を詰める
+	memset(byte_class_, 0, sizeof(byte_class_));
+	classes_ = 1;
+	for (std::string const &p : patterns_) {
+		for (char c : p) {
+			uint16_t &k = byte_class_[(unsigned char)c];
+			if (k == 0) k = (uint16_t)classes_++;
+		}
+	}
+
+	// トライを作る (-1 = 遷移なし)
+	std::vector<int32_t> trie(classes_, -1);
+	output_.assign(1, -1);
+	for (size_t i = 0; i < patterns_.size(); i++) {
+		std::string const &p = patterns_[i];
+		if (p.empty()) {
+			if (empty_pattern_ < 0) empty_pattern_ = (int32_t)i;
+			continue;
+		}
+		size_t s = 0;
+		for (char c : p) {
+			size_t k = byte_class_[(unsigned char)c];
+			int32_t t = trie[s * classes_ + k];
+			if (t < 0) {
+				t = (int32_t)output_.size();
+				trie[s * classes_ + k] = t;
+				trie.resize(trie.size() + classes_, -1);
+				output_.push_back(-1);
+			}
+			s = (size_t)t;
+		}
+		if (output_[s] < 0) output_[s] = (int32_t)i;
+	}
+
+	// 幅優先で失敗遷移を辿り、完全な DFA にする
+	size_t states = output_.size();
+	next_.assign(states * classes_, 0);
+	std::vector<uint32_t> fail(states, 0);
+	std::deque<uint32_t> queue;
+	for (size_t k = 0; k < classes_; k++) {
+		int32_t t = trie[k];
+		if (t > 0) {
+			next_[k] = (uint32_t)t;
+			queue.push_back((uint32_t)t);
+		}
+	}
+	while (!queue.empty()) {
+		uint32_t s = queue.front();
+		queue.pop_front();
+		uint32_t f = fail[s];
+		// 接尾辞で終わるパターンも、この状態で完成したものとして扱う
+		int32_t inherited = output_[f];
+		if (inherited >= 0 && (output_[s] < 0 || inherited < output_[s])) {
+			output_[s] = inherited;
+		}
+		for (size_t k = 0; k < classes_; k++) {
+			int32_t t = trie[s * classes_ + k];
+			if (t > 0) {
+				fail[t] = next_[f * classes_ + k];
+				next_[s * classes_ + k] = (uint32_t)t;
+				queue.push_back((uint32_t)t);
+			} else {
+				next_[s * classes_ + k] = next_[f * classes_ + k];
+			}
+		}
+	}
+
+	memset(first_byte_, 0, sizeof(first_byte_));
+	first_byte_count_ = 0;
+	for (int b = 0; b < 256; b++) {
+		uint16_t k = byte_class_[b];
+		if (k != 0 && next_[k] != 0) {
+			first_byte_[b] = true;
+			if (first_byte_count_ < sizeof(first_bytes_)) {
+				first_bytes_[first_byte_count_] = (unsigned char)b;
+			}
+			first_byte_count_++;
+		}
+	}
+}
+
+// 根の状態から抜け出すバイト (いずれかのパターンの先頭バイト) の位置まで読み飛ばす
+char const *MultiPatternMatcher::skip_to_candidate(char const *ptr, char const *end) const
+{
+	if (first_byte_count_ == 0) return end;
+	if (first_byte_count_ == 1) {
+		void const *p = memchr(ptr, first_bytes_[0], end - ptr);
+		return p ? static_cast<char const *>(p) : end;
+	}
+#if defined(MPM_USE_SSE2)
+	if (first_byte_count_ <= sizeof(first_bytes_)) {
+		__m128i needles[sizeof(first_bytes_)];
+		for (size_t i = 0; i < first_byte_count_; i++) {
+			needles[i] = _mm_set1_epi8((char)first_bytes_[i]);
+		}
+		while (end - ptr >= 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr));
+			__m128i hit = _mm_cmpeq_epi8(v, needles[0]);
+			for (size_t i = 1; i < first_byte_count_; i++) {
+				hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, needles[i]));
+			}
+			unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+			if (mask) return ptr + lowest_bit(mask);
+			ptr += 16;
+		}
+	}
+#elif defined(MPM_USE_NEON)
+	if (first_byte_count_ <= sizeof(first_bytes_)) {
+		uint8x16_t needles[sizeof(first_bytes_)];
+		for (size_t i = 0; i < first_byte_count_; i++) {
+			needles[i] = vdupq_n_u8(first_bytes_[i]);
+		}
+		while (end - ptr >= 16) {
+			uint8x16_t v = vld1q_u8(reinterpret_cast<uint8_t const *>(ptr));
+			uint8x16_t hit = vceqq_u8(v, needles[0]);
+			for (size_t i = 1; i < first_byte_count_; i++) {
+				hit = vorrq_u8(hit, vceqq_u8(v, needles[i]));
+			}
+			if (vmaxvq_u8(hit)) break; // この16バイトの中にある。位置は下で求める
+			ptr += 16;
+		}
+	}
+#endif
+	while (ptr < end && !first_byte_[(unsigned char)*ptr]) {
+		ptr++;
+	}
+	return ptr;
+}
+
+bool MultiPatternMatcher::feed(char const *ptr, size_t len, Match *match)
+{
+	if (empty_pattern_ >= 0) {
+		if (match) {
+			match->pattern = (size_t)empty_pattern_;
+			match->end = 0;
+		}
+		return true;
+	}
+	if (next_.size() <= classes_) return false; // パターンが無い
+
+	char const *begin = ptr;
+	char const *end = ptr + len;
+	uint32_t state = state_;
+	while (ptr < end) {
+		if (state == 0) {
+			ptr = skip_to_candidate(ptr, end);
+			if (ptr == end) break;
+		}
+		state = next_[state * classes_ + byte_class_[(unsigned char)*ptr++]];
+		int32_t out = output_[state];
+		if (out >= 0) {
+			state_ = 0; // 見つかった後は根から探し直す
+			if (match) {
+				match->pattern = (size_t)out;
+				match->end = (size_t)(ptr - begin);
+			}
+			return true;
+		}
+	}
+	state_ = state;
+	return false;
+}
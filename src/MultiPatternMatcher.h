@@ -0,0 +1,178 @@
+#ifndef MULTIPATTERNMATCHER_H
+#define MULTIPATTERNMATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 複数の文字列パターンを同時に探す Aho-Corasick オートマトン。
+// 状態を保持したまま出力の塊を順に feed() できるので、パターンが塊の境界をまたいでも
+// 見つけられ、パターンの数に関係なく各バイトは一度しか調べない。
+// 根の状態にいる間は、どのパターンの先頭にもならないバイトを SIMD (SSE2/NEON) でまとめて読み飛ばす。
+// スレッドセーフではない。
+class MultiPatternMatcher {
+public:
+	struct Match {
+		size_t pattern = 0; // 見つかったパターンの番号
+		size_t end = 0; // feed() に渡した塊の中での、パターン末尾の直後の位置
+	};
+
+private:
+	std::vector<std::string> patterns_;
+	uint16_t byte_class_[256]; // パターンに現れないバイトは全て 0 にまとめる
+	size_t classes_ = 1;
+	std::vector<uint32_t> next_; // 状態 × バイトクラスの遷移表
+	std::vector<int32_t> output_; // 状態ごとの、そこで終わるパターンの最小番号 (-1 = なし)
+	uint32_t state_ = 0;
+	int32_t empty_pattern_ = -1;
+
+	// 根から出る遷移を持つバイト (パターンの先頭バイト)
+	bool first_byte_[256];
+	unsigned char first_bytes_[8];
+	size_t first_byte_count_ = 0; // 8 を超える場合は表引きで読み飛ばす
+
+	void build();
+	char const *skip_to_candidate(char const *ptr, char const *end) const;
+
+public:
+	MultiPatternMatcher();
+	explicit MultiPatternMatcher(std::vector<std::string> const &patterns);
+
+	void set_patterns(std::vector<std::string> const &patterns);
+	std::vector<std::string> const &patterns() const
+	{
+		return patterns_;
+	}
+	bool empty() const
+	{
+		return patterns_.empty();
+	}
+
+	// 前回までの状態を引き継いで ptr[0, len) を走査する。パターンが完成した時点で止まり、
+	// その位置を match に入れて true を返す (同じ位置で複数完成した場合は番号の小さい方)。
+	// 続きを探す場合は、残り (ptr + match->end 以降) を改めて feed() すればよい。
+	bool feed(char const *ptr, size_t len, Match *match);
+
+	// 状態を根に戻す
+	void reset()
+	{
+		state_ = 0;
+	}
+};
+
+// 出力にパターンが現れるのを待つスレッドの一覧 (wait_for_any_output の実装用)。
+// 出力を溜めている側のロックの下で使う。各待機者は自分のオートマトンを持ち、
+// 書き込み側は読み取った塊を feed() するだけでよい。
+// 一度見つかったパターンの末尾までは「消費済み」として、次の待機では探さない。
+class OutputWaitList {
+private:
+	struct Waiter {
+		MultiPatternMatcher matcher;
+		bool found = false;
+		size_t pattern = 0;
+		uint64_t end = 0;
+	};
+	std::vector<Waiter *> waiters_;
+	uint64_t total_ = 0; // これまでに feed() された量
+	uint64_t consumed_ = 0; // 直前に見つかったパターンの末尾
+	bool closed_ = false;
+	std::string tail_; // keep_tail() した場合の、feed() された出力の末尾 (total_ の位置で終わる)
+	size_t tail_limit_ = 0;
+
+public:
+	// 呼び出し側が出力を溜めない (あるいはメモリ上に残さない) 場合に使う。
+	// feed() された出力の末尾を少なくとも bytes だけ自分で持ち、wait() は history の代わりにそれを探す
+	void keep_tail(size_t bytes = 64 * 1024)
+	{
+		tail_limit_ = bytes;
+		tail_.clear();
+	}
+
+	// lock は cond と対になる、呼び出し側のロック (取得済みであること)。
+	// history は溜めてある出力の末尾部分 (最後に feed() された位置で終わること)。
+	// 見つかったパターンの番号を、タイムアウトか close() で -1 を返す (timeout_ms < 0 = 無期限)。
+	int wait(std::unique_lock<std::mutex> &lock, std::condition_variable &cond, std::vector<std::string> const &patterns, std::string_view history, int timeout_ms)
+	{
+		Waiter w;
+		w.matcher.set_patterns(patterns);
+		if (tail_limit_ > 0) {
+			history = tail_;
+		}
+		if (history.size() > total_) {
+			history = history.substr(history.size() - total_);
+		}
+		uint64_t history_begin = total_ - history.size();
+		uint64_t from = consumed_ > history_begin ? consumed_ : history_begin;
+		if (from < total_) {
+			MultiPatternMatcher::Match m;
+			if (w.matcher.feed(history.data() + (from - history_begin), total_ - from, &m)) {
+				consumed_ = from + m.end;
+				return (int)m.pattern;
+			}
+		}
+		if (closed_) return -1;
+		waiters_.push_back(&w);
+		auto ready = [&]() {
+			return w.found || closed_;
+		};
+		if (timeout_ms < 0) {
+			cond.wait(lock, ready);
+		} else {
+			cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+		}
+		for (auto it = waiters_.begin(); it != waiters_.end(); it++) {
+			if (*it == &w) {
+				waiters_.erase(it);
+				break;
+			}
+		}
+		if (!w.found) return -1;
+		consumed_ = w.end;
+		return (int)w.pattern;
+	}
+
+	// 読み取った塊を待機者へ渡す。誰かが見つけたら true (呼び出し側で cond を notify すること)
+	bool feed(char const *ptr, size_t len)
+	{
+		bool found = false;
+		for (Waiter *w : waiters_) {
+			MultiPatternMatcher::Match m;
+			if (!w->found && w->matcher.feed(ptr, len, &m)) {
+				w->found = true;
+				w->pattern = m.pattern;
+				w->end = total_ + m.end;
+				found = true;
+			}
+		}
+		total_ += len;
+		if (tail_limit_ > 0) {
+			tail_.append(ptr, len);
+			if (tail_.size() > 2 * tail_limit_) { // 上限の2倍まで溜めてからまとめて詰める
+				tail_.erase(0, tail_.size() - tail_limit_);
+			}
+		}
+		return found;
+	}
+
+	// 出力の終わり。待機中の wait() は -1 を返す (呼び出し側で cond を notify すること)
+	void close()
+	{
+		closed_ = true;
+	}
+
+	// 新しい実行の開始
+	void reset()
+	{
+		total_ = 0;
+		consumed_ = 0;
+		closed_ = false;
+		tail_.clear();
+	}
+};
+
+#endif // MULTIPATTERNMATCHER_H
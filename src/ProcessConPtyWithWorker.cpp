@@ -155,13 +155,22 @@ bool ProcessConPtyWithWorker::wait(unsigned long time)
 	return m->cv.wait_for(lock, std::chrono::milliseconds(time), [this]() { return !m->running.load(); });
 }
 
+bool ProcessConPtyWithWorker::wait_for(std::chrono::milliseconds timeout)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!process::helper::wait_until(m->cv, lock, timeout, [this]() { return !m->running.load(); })) return false;
+	}
+	wait();
+	return true;
+}
+
 int ProcessConPtyWithWorker::wait()
 {
 	m->proc.wait();
 
 	std::lock_guard<std::mutex> lock(mutex_);
-	std::vector<char> const &out = m->proc.stdout_bytes();
-	stdout_bytes_ = out;
+	stdout_bytes_ = m->proc.take_stdout();
 	stderr_bytes_.clear();
 	m->exit_code = m->proc.get_exit_code();
 	m->running = false;
@@ -176,8 +185,7 @@ void ProcessConPtyWithWorker::stop()
 		m->proc.terminate();
 		m->proc.wait();
 		m->running = false;
-		std::vector<char> const &out = m->proc.stdout_bytes();
-		stdout_bytes_.assign(out.begin(), out.end());
+		stdout_bytes_ = m->proc.take_stdout();
 		stderr_bytes_.clear();
 		m->exit_code = m->proc.get_exit_code();
 	}
@@ -225,3 +233,8 @@ bool ProcessConPtyWithWorker::wait_for_output(std::string const &text)
 {
 	return m->proc.wait_for_output(text);
 }
+
+int ProcessConPtyWithWorker::wait_for_any_output(std::vector<std::string> const &patterns, int timeout_ms)
+{
+	return m->proc.wait_for_any_output(patterns, timeout_ms);
+}
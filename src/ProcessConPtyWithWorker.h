@@ -13,6 +13,7 @@ class ProcessConPtyWithWorker : public AbstractPtyProcess {
 public:
 	static int run_worker(int argc, char **argv);
 	bool wait_for_output(std::string const &text);
+	int wait_for_any_output(std::vector<std::string> const &patterns, int timeout_ms = -1) override;
 
 private:
 	constexpr static std::string_view subprocess_tag = "--conpty-worker--";
@@ -28,6 +29,7 @@ public:
 
 	void start(std::string const &command, std::string const &env, bool use_input) override;
 	int wait() override;
+	bool wait_for(std::chrono::milliseconds timeout) override;
 	void stop() override;
 	bool is_running() const override;
 	int get_exit_code() const override;
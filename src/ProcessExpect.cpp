@@ -0,0 +1,221 @@
+#include "ProcessExpect.h"
+#include "MultiPatternMatcher.h"
+#include "ProcessPosixReactor.h"
+#include <condition_variable>
+#include <mutex>
+
+// 照合と段の遷移はリアクタスレッドだけで行う。status/step は wait() などから読むので mutex で守る。
+struct ProcessExpect::State : public std::enable_shared_from_this<ProcessExpect::State> {
+	AbstractPtyProcess *proc = nullptr;
+	std::vector<Step> steps;
+	std::function<void(Status)> finished_fn;
+
+	mutable std::mutex mutex;
+	std::condition_variable cond;
+	Status status = Status::Idle;
+	size_t step = 0;
+
+	// 以下はリアクタスレッドからのみ触る
+	bool active = false;
+	MultiPatternMatcher matcher;
+	uint64_t timer = 0;
+
+	static ProcessPosixReactor &reactor()
+	{
+		return ProcessPosixReactor::instance();
+	}
+
+	void finish(Status st)
+	{
+		active = false;
+		reactor().cancel_timer(timer);
+		timer = 0;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			status = st;
+			cond.notify_all();
+		}
+		if (finished_fn) {
+			finished_fn(st);
+		}
+	}
+
+	void enter_step(size_t index)
+	{
+		reactor().cancel_timer(timer);
+		timer = 0;
+		if (index >= steps.size()) {
+			finish(Status::Done);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			step = index;
+		}
+		std::vector<std::string> patterns;
+		for (Rule const &rule : steps[index].rules) {
+			patterns.push_back(rule.pattern);
+		}
+		matcher.set_patterns(patterns);
+		active = true;
+		int timeout = steps[index].timeout_ms;
+		if (timeout >= 0) {
+			std::weak_ptr<State> weak = shared_from_this();
+			timer = reactor().add_timer(std::chrono::milliseconds(timeout), [weak]() {
+				if (auto self = weak.lock()) {
+					self->timer = 0;
+					self->on_timeout();
+				}
+			});
+		}
+	}
+
+	void perform(Action action)
+	{
+		switch (action) {
+		case Action::Next:
+			enter_step(step + 1);
+			break;
+		case Action::Stay:
+			enter_step(step); // タイムアウトも測り直す
+			break;
+		case Action::Done:
+			finish(Status::Done);
+			break;
+		case Action::Fail:
+			finish(Status::Failed);
+			break;
+		}
+	}
+
+	void on_timeout()
+	{
+		if (!active) return;
+		Action action = steps[step].on_timeout;
+		if (action == Action::Fail) {
+			finish(Status::Timeout);
+		} else {
+			perform(action);
+		}
+	}
+
+	void on_output(char const *ptr, size_t len)
+	{
+		if (!active) return;
+		if (!ptr) {
+			finish(Status::Eof);
+			return;
+		}
+		// 1つの塊の中で複数の段が進むこともある。見つかった位置の続きから次の段で探す
+		while (active && len > 0) {
+			MultiPatternMatcher::Match match;
+			if (!matcher.feed(ptr, len, &match)) return;
+			ptr += match.end;
+			len -= match.end;
+			Rule const &rule = steps[step].rules[match.pattern];
+			if (!rule.send.empty()) {
+				// リアクタスレッドからの書き込みは待たずに溜められ、master が書き込み可能になった
+				// ときにリアクタが送り出す (ここで待つと出力を読む者がいなくなり、子と互いに待ち合う)
+				proc->write_input(rule.send.data(), (int)rule.send.size());
+			}
+			perform(rule.fn ? rule.fn(match.pattern) : rule.action);
+		}
+	}
+};
+
+ProcessExpect::ProcessExpect(AbstractPtyProcess *proc)
+	: m(std::make_shared<State>())
+{
+	m->proc = proc;
+	// プロセス側にはこのオブジェクトより長く残りうるので、弱参照で渡す
+	std::weak_ptr<State> weak = m;
+	proc->set_output_callback([weak](char const *ptr, size_t len) {
+		if (auto self = weak.lock()) {
+			self->on_output(ptr, len);
+		}
+	});
+}
+
+ProcessExpect::~ProcessExpect()
+{
+	cancel();
+}
+
+void ProcessExpect::add_step(Step const &step)
+{
+	m->steps.push_back(step);
+}
+
+void ProcessExpect::add_step(std::vector<Rule> const &rules, int timeout_ms)
+{
+	Step step;
+	step.rules = rules;
+	step.timeout_ms = timeout_ms;
+	add_step(step);
+}
+
+void ProcessExpect::set_finished_callback(std::function<void(Status)> fn)
+{
+	m->finished_fn = fn;
+}
+
+void ProcessExpect::start()
+{
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		if (m->status == Status::Running) return;
+		m->status = Status::Running;
+		m->step = 0;
+	}
+	auto state = m;
+	ProcessPosixReactor::instance().post([state]() {
+		state->enter_step(0);
+	});
+}
+
+void ProcessExpect::cancel()
+{
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		if (m->status != Status::Running) return;
+	}
+	auto state = m;
+	ProcessPosixReactor::instance().post([state]() {
+		if (state->active) {
+			state->finish(Status::Canceled);
+		} else {
+			// start() 直後で、まだ最初の段に入っていない
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if (state->status == Status::Running) {
+				state->status = Status::Canceled;
+				state->cond.notify_all();
+			}
+		}
+	});
+}
+
+ProcessExpect::Status ProcessExpect::status() const
+{
+	std::lock_guard<std::mutex> lock(m->mutex);
+	return m->status;
+}
+
+size_t ProcessExpect::current_step() const
+{
+	std::lock_guard<std::mutex> lock(m->mutex);
+	return m->step;
+}
+
+ProcessExpect::Status ProcessExpect::wait(int timeout_ms)
+{
+	std::unique_lock<std::mutex> lock(m->mutex);
+	auto finished = [&]() {
+		return m->status != Status::Running;
+	};
+	if (timeout_ms < 0) {
+		m->cond.wait(lock, finished);
+	} else {
+		m->cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), finished);
+	}
+	return m->status;
+}
@@ -0,0 +1,96 @@
+#ifndef PROCESSEXPECT_H
+#define PROCESSEXPECT_H
+
+#include "AbstractProcess.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// expect 風の対話エンジン。AbstractPtyProcess の出力を塊ごとに受け取り、
+// 「このパターンが出たらこれを書き込む」という規則を順に評価する。
+// 照合は MultiPatternMatcher でストリームのまま行い、タイムアウトは共有リアクタの
+// タイマーで扱うので、スリープによるポーリングも、セッションごとのスレッドも要らない。
+// (出力がリアクタスレッドから届く ProcessPosixPty で使う)
+//
+//   ProcessPosixPty pty;
+//   ProcessExpect expect(&pty);
+//   expect.add_step({ { "(yes/no)? ", "yes\n" }, { "password: ", "secret\n" } }, 10000);
+//   expect.add_step({ { "$ ", "exit\n", ProcessExpect::Action::Done } }, 10000);
+//   expect.start();
+//   pty.start("ssh host", { }, true);
+//   ProcessExpect::Status st = expect.wait();
+class ProcessExpect {
+public:
+	enum class Action {
+		Next, // 次の段へ進む
+		Stay, // 同じ段で次の出力を待つ ("--More--" を繰り返し送るなど)
+		Done, // 成功として終了する
+		Fail, // 失敗として終了する
+	};
+
+	enum class Status {
+		Idle, // start() 前
+		Running,
+		Done, // Action::Done に達したか、全ての段を終えた
+		Failed, // Action::Fail に達した
+		Timeout, // 段のタイムアウト
+		Eof, // 全ての段を終える前に出力が終わった
+		Canceled, // cancel() された
+	};
+
+	struct Rule {
+		std::string pattern;
+		// パターンが見つかったら書き込む (空なら何もしない)。書き込みはブロックせずに溜められ、
+		// 子が読むのに合わせてリアクタが送り出すので、大きくてもよい
+		std::string send;
+		Action action = Action::Next;
+		// 設定されていれば send の後に (リアクタスレッドから) 呼び、戻り値を action の代わりに使う
+		std::function<Action(size_t rule)> fn;
+
+		Rule() = default;
+		Rule(std::string pattern, std::string send = { }, Action action = Action::Next)
+			: pattern(std::move(pattern))
+			, send(std::move(send))
+			, action(action)
+		{
+		}
+	};
+
+	// 1つの段では、いずれかの規則のパターンが見つかるのを待つ
+	struct Step {
+		std::vector<Rule> rules;
+		int timeout_ms = -1; // この段に入ってからの制限時間 (負なら無期限)
+		Action on_timeout = Action::Fail; // Fail ならタイムアウトとして終了する
+	};
+
+private:
+	struct State;
+	std::shared_ptr<State> m;
+
+public:
+	// proc の出力コールバックを使う。proc より先に破棄すること
+	explicit ProcessExpect(AbstractPtyProcess *proc);
+	~ProcessExpect();
+	ProcessExpect(ProcessExpect const &) = delete;
+	ProcessExpect &operator=(ProcessExpect const &) = delete;
+
+	// start() 前に段を追加する
+	void add_step(Step const &step);
+	void add_step(std::vector<Rule> const &rules, int timeout_ms = -1);
+
+	// 終了時に (リアクタスレッドから) 呼ばれる。この中で wait() を呼ばないこと
+	void set_finished_callback(std::function<void(Status)> fn);
+
+	// 最初の段の待機を始める。プロセスの start() より前に呼べば、最初の出力から照合できる
+	void start();
+	// 待機をやめ、以降の出力を無視する
+	void cancel();
+
+	Status status() const;
+	size_t current_step() const;
+	// 終了するまで待つ (timeout_ms が過ぎたらその時点の状態を返す)
+	Status wait(int timeout_ms = -1);
+};
+
+#endif // PROCESSEXPECT_H
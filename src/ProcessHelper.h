@@ -1,6 +1,9 @@
 #ifndef PROCESSHELPER_H
 #define PROCESSHELPER_H
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 
 namespace process {
@@ -12,6 +15,17 @@ typedef std::wstring dir_string_t;
 typedef std::string dir_string_t;
 #endif
 
+// pred が true になるまで最長 timeout 待つ。condition_variable::wait_for() は now() + timeout が
+// 溢れるほど長い timeout (milliseconds::max() など) を扱えないので、その場合は無期限に待つ
+template <typename Pred> bool wait_until(std::condition_variable &cond, std::unique_lock<std::mutex> &lock, std::chrono::milliseconds timeout, Pred pred)
+{
+	if (timeout >= std::chrono::hours(24 * 365 * 100)) {
+		cond.wait(lock, pred);
+		return true;
+	}
+	return cond.wait_for(lock, timeout, pred);
+}
+
 class PushDir {
 private:
 	dir_string_t cwd_;
@@ -0,0 +1,262 @@
+#include "ProcessMetrics.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+uint64_t LogHistogram::bucket_low(size_t index)
+{
+	if (index < SubBucketCount) return index;
+	int shift = (int)(index >> SubBucketBits) - 1;
+	return (uint64_t)((index & (SubBucketCount - 1)) | SubBucketCount) << shift;
+}
+
+uint64_t LogHistogram::bucket_high(size_t index)
+{
+	if (index < SubBucketCount) return index;
+	int shift = (int)(index >> SubBucketBits) - 1;
+	return bucket_low(index) + ((uint64_t(1) << shift) - 1);
+}
+
+void LogHistogram::add(uint64_t value, uint64_t n)
+{
+	add_bucket(bucket_of(value), n);
+	sum_ += value * n;
+}
+
+void LogHistogram::add_bucket(size_t index, uint64_t n)
+{
+	if (n == 0) return;
+	if (counts_.size() <= index) {
+		counts_.resize(index + 1);
+	}
+	counts_[index] += n;
+	count_ += n;
+}
+
+void LogHistogram::merge(LogHistogram const &other)
+{
+	if (counts_.size() < other.counts_.size()) {
+		counts_.resize(other.counts_.size());
+	}
+	for (size_t i = 0; i < other.counts_.size(); i++) {
+		counts_[i] += other.counts_[i];
+	}
+	count_ += other.count_;
+	sum_ += other.sum_;
+}
+
+void LogHistogram::subtract(LogHistogram const &other)
+{
+	size_t n = std::min(counts_.size(), other.counts_.size());
+	for (size_t i = 0; i < n; i++) {
+		counts_[i] -= std::min(counts_[i], other.counts_[i]);
+	}
+	while (!counts_.empty() && counts_.back() == 0) {
+		counts_.pop_back();
+	}
+	count_ -= std::min(count_, other.count_);
+	sum_ -= std::min(sum_, other.sum_);
+}
+
+uint64_t LogHistogram::percentile(double p) const
+{
+	if (count_ == 0) return 0;
+	// 最近接順位法。p = 100 なら最後の値
+	double rank = p / 100.0 * count_;
+	uint64_t target = rank <= 1 ? 1 : (uint64_t)rank;
+	if ((double)target < rank) target++;
+	if (target > count_) target = count_;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < counts_.size(); i++) {
+		seen += counts_[i];
+		if (seen >= target) return bucket_high(i);
+	}
+	return max();
+}
+
+uint64_t LogHistogram::min() const
+{
+	for (size_t i = 0; i < counts_.size(); i++) {
+		if (counts_[i]) return bucket_low(i);
+	}
+	return 0;
+}
+
+uint64_t LogHistogram::max() const
+{
+	for (size_t i = counts_.size(); i > 0; i--) {
+		if (counts_[i - 1]) return bucket_high(i - 1);
+	}
+	return 0;
+}
+
+ProcessMetrics::Snapshot ProcessMetrics::Snapshot::delta(Snapshot const &prev) const
+{
+	Snapshot d = *this;
+	for (int i = 0; i < CounterCount; i++) {
+		d.counters[i] -= std::min(d.counters[i], prev.counters[i]);
+	}
+	for (auto const &pair : prev.exit_codes) {
+		auto it = d.exit_codes.find(pair.first);
+		if (it == d.exit_codes.end()) continue;
+		it->second -= std::min(it->second, pair.second);
+		if (it->second == 0) {
+			d.exit_codes.erase(it);
+		}
+	}
+	for (int i = 0; i < HistogramCount; i++) {
+		d.histograms[i].subtract(prev.histograms[i]);
+	}
+	return d;
+}
+
+namespace {
+
+int const ExitCodeSlots = 257; // 0〜255 と、それ以外 (-1 など)
+
+// 1スレッド分の集計。書くのは所有するスレッドだけなので、fetch_add ではなく
+// load と store で足す。snapshot() は別スレッドから relaxed で読む。
+struct Shard {
+	std::atomic<uint64_t> counters[ProcessMetrics::CounterCount];
+	std::atomic<uint64_t> exit_codes[ExitCodeSlots];
+	std::atomic<uint64_t> buckets[ProcessMetrics::HistogramCount][LogHistogram::BucketCount];
+	std::atomic<uint64_t> sums[ProcessMetrics::HistogramCount];
+	std::atomic<size_t> used[ProcessMetrics::HistogramCount]; // 使ったバケットの番号 + 1 の最大
+
+	Shard()
+	{
+		for (auto &a : counters) a.store(0, std::memory_order_relaxed);
+		for (auto &a : exit_codes) a.store(0, std::memory_order_relaxed);
+		for (auto &h : buckets) {
+			for (auto &a : h) a.store(0, std::memory_order_relaxed);
+		}
+		for (auto &a : sums) a.store(0, std::memory_order_relaxed);
+		for (auto &a : used) a.store(0, std::memory_order_relaxed);
+	}
+
+	static void bump(std::atomic<uint64_t> &a, uint64_t n)
+	{
+		a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+};
+
+struct Registry {
+	std::mutex mutex;
+	std::vector<Shard *> shards;
+	Shard retired; // 終了したスレッドの分。mutex の下で足し込む
+};
+
+Registry &registry()
+{
+	static Registry *r = new Registry; // スレッドの終了処理から参照されうるので解放しない
+	return *r;
+}
+
+void accumulate(Shard const &s, ProcessMetrics::Snapshot *out)
+{
+	for (int i = 0; i < ProcessMetrics::CounterCount; i++) {
+		out->counters[i] += s.counters[i].load(std::memory_order_relaxed);
+	}
+	for (int i = 0; i < ExitCodeSlots; i++) {
+		uint64_t n = s.exit_codes[i].load(std::memory_order_relaxed);
+		if (n) {
+			out->exit_codes[i < 256 ? i : -1] += n;
+		}
+	}
+	for (int h = 0; h < ProcessMetrics::HistogramCount; h++) {
+		size_t used = s.used[h].load(std::memory_order_relaxed);
+		LogHistogram &hist = out->histograms[h];
+		for (size_t i = 0; i < used; i++) {
+			hist.add_bucket(i, s.buckets[h][i].load(std::memory_order_relaxed));
+		}
+		hist.add_sum(s.sums[h].load(std::memory_order_relaxed));
+	}
+}
+
+// スレッドの終了時に、その分を retired へ移して一覧から外す
+struct ShardHolder {
+	Shard *shard = nullptr;
+
+	~ShardHolder()
+	{
+		if (!shard) return;
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (int i = 0; i < ProcessMetrics::CounterCount; i++) {
+			Shard::bump(r.retired.counters[i], shard->counters[i].load(std::memory_order_relaxed));
+		}
+		for (int i = 0; i < ExitCodeSlots; i++) {
+			Shard::bump(r.retired.exit_codes[i], shard->exit_codes[i].load(std::memory_order_relaxed));
+		}
+		for (int h = 0; h < ProcessMetrics::HistogramCount; h++) {
+			size_t used = shard->used[h].load(std::memory_order_relaxed);
+			for (size_t i = 0; i < used; i++) {
+				Shard::bump(r.retired.buckets[h][i], shard->buckets[h][i].load(std::memory_order_relaxed));
+			}
+			Shard::bump(r.retired.sums[h], shard->sums[h].load(std::memory_order_relaxed));
+			if (r.retired.used[h].load(std::memory_order_relaxed) < used) {
+				r.retired.used[h].store(used, std::memory_order_relaxed);
+			}
+		}
+		r.shards.erase(std::remove(r.shards.begin(), r.shards.end(), shard), r.shards.end());
+		delete shard;
+	}
+};
+
+thread_local ShardHolder t_holder;
+
+Shard &thread_shard()
+{
+	if (!t_holder.shard) {
+		Shard *s = new Shard;
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.shards.push_back(s);
+		t_holder.shard = s;
+	}
+	return *t_holder.shard;
+}
+
+} // namespace
+
+void ProcessMetrics::add(Counter c, uint64_t n)
+{
+	Shard::bump(thread_shard().counters[c], n);
+}
+
+void ProcessMetrics::record(Histogram h, uint64_t ns)
+{
+	Shard &s = thread_shard();
+	size_t i = LogHistogram::bucket_of(ns);
+	Shard::bump(s.buckets[h][i], 1);
+	Shard::bump(s.sums[h], ns);
+	if (s.used[h].load(std::memory_order_relaxed) <= i) {
+		s.used[h].store(i + 1, std::memory_order_relaxed);
+	}
+}
+
+void ProcessMetrics::record_exit_code(int code)
+{
+	Shard::bump(thread_shard().exit_codes[code >= 0 && code < 256 ? code : 256], 1);
+}
+
+uint64_t ProcessMetrics::now_ns()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProcessMetrics::Snapshot ProcessMetrics::snapshot()
+{
+	Snapshot snap;
+	snap.time = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	Registry &r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	accumulate(r.retired, &snap);
+	for (Shard const *s : r.shards) {
+		accumulate(*s, &snap);
+	}
+	snap.in_flight = (int64_t)snap.counters[Spawns] - (int64_t)snap.counters[Exits];
+	return snap;
+}
@@ -0,0 +1,138 @@
+#ifndef PROCESSMETRICS_H
+#define PROCESSMETRICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// HDR 風の対数バケットのヒストグラム。2 のべき乗ごとの区間を 2^SubBucketBits 個に等分するので、
+// 値の大きさによらず相対誤差は 1/16 (約6%) 以下に収まり、1ns から 2^64ns までを固定の
+// BucketCount 個のバケットで表せる。値の型に過ぎず、スレッドセーフではない。
+class LogHistogram {
+public:
+	static constexpr int SubBucketBits = 4;
+	static constexpr size_t SubBucketCount = size_t(1) << SubBucketBits;
+	static constexpr size_t BucketCount = (64 - SubBucketBits + 1) * SubBucketCount;
+
+	static size_t bucket_of(uint64_t value)
+	{
+		if (value < SubBucketCount) return (size_t)value;
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		int msb = (int)index;
+#else
+		int msb = 63 - __builtin_clzll(value);
+#endif
+		int shift = msb - SubBucketBits;
+		return ((size_t)(shift + 1) << SubBucketBits) | (size_t)((value >> shift) & (SubBucketCount - 1));
+	}
+	// バケットに入る値の範囲 [low, high]
+	static uint64_t bucket_low(size_t index);
+	static uint64_t bucket_high(size_t index);
+
+private:
+	std::vector<uint64_t> counts_; // 末尾の空のバケットは持たない
+	uint64_t count_ = 0;
+	uint64_t sum_ = 0;
+
+public:
+	void add(uint64_t value, uint64_t n = 1);
+	// バケットごとの度数と値の合計を別々に足す (ProcessMetrics が各スレッドの分を集めるのに使う)
+	void add_bucket(size_t index, uint64_t n);
+	void add_sum(uint64_t sum)
+	{
+		sum_ += sum;
+	}
+	void merge(LogHistogram const &other);
+	// other (以前のスナップショット) を引いて、その後に記録された分だけにする
+	void subtract(LogHistogram const &other);
+
+	uint64_t count() const
+	{
+		return count_;
+	}
+	uint64_t sum() const
+	{
+		return sum_;
+	}
+	double mean() const
+	{
+		return count_ ? (double)sum_ / count_ : 0;
+	}
+	// p (0〜100) パーセンタイルの値が入るバケットの上限。空なら 0
+	uint64_t percentile(double p) const;
+	uint64_t min() const;
+	uint64_t max() const;
+	std::vector<uint64_t> const &counts() const
+	{
+		return counts_;
+	}
+};
+
+// プロセスライブラリ全体の集計値 (起動数、実行中の数、読み取ったバイト数、終了コードの分布、
+// 起動・実行・完了にかかった時間の分布)。ProcessPosix、ProcessPosixPty と
+// AbstractPtyProcess::write_output() が更新する。
+// 更新はスレッドごとの領域へロックなしで行い (書くのはそのスレッドだけなので atomic な
+// 加算命令も要らない)、snapshot() が全スレッドの分を合計する。毎秒呼んでも十分に軽い。
+//
+//   ProcessMetrics::Snapshot prev = ProcessMetrics::snapshot();
+//   ... 1秒後 ...
+//   ProcessMetrics::Snapshot now = ProcessMetrics::snapshot();
+//   double spawns_per_sec = now.per_second(ProcessMetrics::Spawns, prev);
+//   uint64_t p99 = now.delta(prev).histograms[ProcessMetrics::SpawnLatency].percentile(99);
+class ProcessMetrics {
+public:
+	enum Counter {
+		Spawns, // 起動に成功した子
+		SpawnFailures,
+		Exits, // 回収した子
+		StdoutBytes, // ProcessPosix が読み取った stdout
+		StderrBytes,
+		PtyOutputBytes, // AbstractPtyProcess::write_output() に渡された出力
+		StdinBytes, // 子の stdin へ書き込んだ量
+		CounterCount
+	};
+
+	// 値はナノ秒
+	enum Histogram {
+		SpawnLatency, // 起動処理 (fork/posix_spawn) にかかった時間
+		RunTime, // 起動から回収まで
+		ExitLatency, // 回収から完了 (出力を読み切って wait() が戻れる状態) まで
+		HistogramCount
+	};
+
+	struct Snapshot {
+		double time = 0; // snapshot() した時刻 (steady_clock の秒)
+		uint64_t counters[CounterCount] = { };
+		int64_t in_flight = 0; // 起動して、まだ回収していない子の数
+		std::map<int, uint64_t> exit_codes; // 終了コード (-1 = 起動失敗や回収不能) ごとの数
+		LogHistogram histograms[HistogramCount];
+
+		uint64_t operator[](Counter c) const
+		{
+			return counters[c];
+		}
+		// prev 以降の増分 (in_flight は引かずに、この時点の値のまま)
+		Snapshot delta(Snapshot const &prev) const;
+		double per_second(Counter c, Snapshot const &prev) const
+		{
+			double dt = time - prev.time;
+			return dt > 0 ? (counters[c] - prev.counters[c]) / dt : 0;
+		}
+	};
+
+	static void add(Counter c, uint64_t n = 1);
+	static void record(Histogram h, uint64_t ns);
+	static void record_exit_code(int code);
+	static uint64_t now_ns();
+
+	static Snapshot snapshot();
+};
+
+#endif // PROCESSMETRICS_H
@@ -0,0 +1,886 @@
+#include "ProcessPipeline.h"
+#include "BasicProcessPosix.h"
+#include "ByteQueue.h"
+#include "CaptureBuffer.h"
+#include "ProcessHelper.h"
+#include "ProcessPosixReactor.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// BasicProcessPosix.cpp と同じく、並行して起動される子へ継承されないよう CLOEXEC で作る
+int open_pipe(int fds[2])
+{
+#ifdef __linux__
+	return pipe2(fds, O_CLOEXEC);
+#else
+	if (pipe(fds) < 0) return -1;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+	return 0;
+#endif
+}
+
+int exit_code_from_status(int status)
+{
+	if (status < 0) return -1;
+	if (WIFEXITED(status)) return WEXITSTATUS(status);
+	if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+	return -1;
+}
+
+void close_fd(int *fd)
+{
+	if (*fd >= 0) {
+		close(*fd);
+		*fd = -1;
+	}
+}
+
+void set_nonblock(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+// 読み取れるデータが残っているか
+bool has_input(int fd)
+{
+	int avail = 0;
+	return ioctl(fd, FIONREAD, &avail) == 0 && avail > 0;
+}
+
+} // namespace
+
+// ProcessPipeline の1回分の実行状態。ProcessPosixJob と同じく、リアクタのコールバックから
+// 参照できるよう shared_ptr で寿命を管理する。
+class PipelineJob : public std::enable_shared_from_this<PipelineJob> {
+public:
+	struct Stage {
+		std::vector<std::string> argvec;
+		ProcessPipeline::TapFn tap_fn;
+		int tap_fd = -1;
+		std::atomic<pid_t> pid { 0 };
+		bool exited = false;
+		int exit_code = -1;
+		ProcessUsage usage;
+		int fd_err = -1;
+		CaptureBuffer errq;
+		// 覗き見する段では、子の stdout (tap_src) と次の段の stdin (tap_dst) の間を親が中継する
+		int tap_src = -1;
+		int tap_dst = -1;
+		ByteQueue tap_queue; // tap_fd が一杯で書けなかった分
+		bool tap_waiting = false; // tap_fd が書けるようになるのを待っている
+#ifdef __linux__
+		size_t tap_left = 0; // 次の段へ tee 済みで、まだ覗き見側へ移していない量
+#endif
+#ifndef __linux__
+		ByteQueue pending; // tee(2) が無い環境で次の段へ書き切れていない分
+#endif
+	};
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::vector<std::unique_ptr<Stage>> stages;
+	ProcessPosixSpawner::Method spawn_method = ProcessPosixSpawner::Method::PosixSpawn;
+	std::string change_dir;
+	std::chrono::steady_clock::time_point started;
+	bool use_input = false;
+	ByteQueue inq;
+	int fd_in = -1; // 最初の段の stdin へ書き込む端
+	int fd_out = -1; // 最後の段の stdout を読む端
+	CaptureBuffer outq;
+	int error_code = 0;
+	std::string error_message;
+	bool close_input_later = false;
+	bool flush_posted = false;
+	bool done = false;
+	std::function<void()> completed_fn;
+
+	// 以下はリアクタスレッドからのみ触る
+	uint64_t kill_timer = 0;
+	std::vector<char> tap_buffer;
+
+private:
+	static ProcessPosixReactor &reactor()
+	{
+		return ProcessPosixReactor::instance();
+	}
+
+	void close_input_now()
+	{
+		if (fd_in >= 0) {
+			reactor().unwatch_writable(fd_in);
+			close_fd(&fd_in);
+		}
+	}
+
+	void flush_input()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		flush_posted = false;
+		if (fd_in < 0) {
+			inq.clear();
+			return;
+		}
+		auto flush_when_writable = [this]() {
+			auto self = shared_from_this();
+			reactor().watch_writable(fd_in, [self]() {
+				self->flush_input();
+			});
+		};
+		while (!inq.empty()) {
+			// ProcessPosix と同じく、溜まったチャンクを writev() でまとめて送り出す
+			std::string_view spans[64];
+			struct iovec iov[64];
+			size_t n = inq.front_spans(spans, 64);
+			size_t total = 0;
+			for (size_t i = 0; i < n; i++) {
+				iov[i].iov_base = const_cast<char *>(spans[i].data());
+				iov[i].iov_len = spans[i].size();
+				total += spans[i].size();
+			}
+			ssize_t r = writev(fd_in, iov, (int)n);
+			if (r < 0) {
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					flush_when_writable();
+					return;
+				}
+				close_input_now();
+				inq.clear();
+				return;
+			}
+			inq.discard(r);
+			if ((size_t)r < total) {
+				flush_when_writable();
+				return;
+			}
+		}
+		if (close_input_later) {
+			close_input_now();
+		}
+	}
+
+	// tap_fd が書けるようになったら、そこを覗き見先にしている段をまとめて再開する
+	void wait_tap_writable(Stage &s)
+	{
+		s.tap_waiting = true;
+		auto self = shared_from_this();
+		int fd = s.tap_fd;
+		reactor().watch_writable(fd, [self, fd]() {
+			for (auto &stage : self->stages) {
+				Stage &t = *stage;
+				if (!t.tap_waiting || t.tap_fd != fd) continue;
+				t.tap_waiting = false;
+				if (t.tap_src >= 0) {
+					self->pump(t);
+				} else if (self->flush_tap(t)) {
+					self->try_finish(); // 最後の段の覗き見を書き終えた
+				}
+			}
+		});
+	}
+
+	// tap_queue を tap_fd へ書き出す。書き切れなければ、書けるようになったら再開するよう登録して false
+	bool flush_tap(Stage &s)
+	{
+		while (!s.tap_queue.empty() && s.tap_fd >= 0) {
+			std::string_view span = s.tap_queue.front_span();
+			ssize_t n = write(s.tap_fd, span.data(), span.size());
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0 && errno == EAGAIN) {
+				wait_tap_writable(s);
+				return false;
+			}
+			if (n <= 0) {
+				s.tap_fd = -1; // 書けなくなったら覗き見だけやめる
+				break;
+			}
+			s.tap_queue.discard(n);
+		}
+		if (s.tap_fd < 0) {
+			s.tap_queue.clear();
+		}
+		return true;
+	}
+
+	// リアクタを止めないよう、tap_fd へは書けるだけ書いて残りは tap_queue に溜める
+	void deliver_tap(Stage &s, char const *ptr, size_t len)
+	{
+		if (s.tap_fn) {
+			s.tap_fn(ptr, len);
+		}
+		if (s.tap_fd < 0) return;
+		while (len > 0 && s.tap_queue.empty()) {
+			ssize_t n = write(s.tap_fd, ptr, len);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0 && errno == EAGAIN) break;
+			if (n <= 0) {
+				s.tap_fd = -1;
+				return;
+			}
+			ptr += n;
+			len -= n;
+		}
+		if (len > 0) {
+			s.tap_queue.append(ptr, len);
+			if (!s.tap_waiting) {
+				wait_tap_writable(s);
+			}
+		}
+	}
+
+	// tap_src から len バイト (0 なら読めるだけ) を取り出して覗き見側へ渡す。EOF なら 0 を返す。
+	// splice(2) の EAGAIN は、tap_src が空の場合と tap_fd が一杯の場合の両方がありうる
+	ssize_t consume_tap(Stage &s, size_t len)
+	{
+#ifdef __linux__
+		if (s.tap_fd >= 0 && !s.tap_fn) {
+			// fd へはユーザー空間を経由せずに移す (SPLICE_F_NONBLOCK は tap_fd 側にも効く)
+			ssize_t n = splice(s.tap_src, nullptr, s.tap_fd, nullptr, len ? len : (1 << 20), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n >= 0 || errno == EAGAIN || errno == EINTR) return n;
+			// splice できない fd (O_APPEND のファイルなど) は read/write で書く
+		}
+#endif
+		size_t want = len ? std::min(len, tap_buffer.size()) : tap_buffer.size();
+		ssize_t n = read(s.tap_src, tap_buffer.data(), want);
+		if (n > 0) {
+			deliver_tap(s, tap_buffer.data(), (size_t)n);
+		}
+		return n;
+	}
+
+	void finish_tap(Stage &s)
+	{
+		close_fd(&s.tap_src);
+		close_fd(&s.tap_dst); // 次の段に EOF を伝える
+		try_finish();
+	}
+
+	// 覗き見する段の出力を次の段へ中継する。読めなくなるか、次の段や覗き見側が詰まったら、
+	// 再開できるようになったときにリアクタから呼び直してもらう。
+	void pump(Stage &s)
+	{
+		auto self = shared_from_this();
+		Stage *sp = &s;
+		auto again = [self, sp]() {
+			self->pump(*sp);
+		};
+		while (s.tap_src >= 0) {
+			if (!flush_tap(s)) return;
+#ifdef __linux__
+			if (s.tap_left > 0) {
+				// tee 済みのデータは読めるので、EAGAIN は覗き見側が一杯ということ
+				ssize_t r = consume_tap(s, s.tap_left);
+				if (r > 0) {
+					s.tap_left -= (size_t)r;
+					continue;
+				}
+				if (r < 0 && errno == EINTR) continue;
+				if (r < 0 && errno == EAGAIN) {
+					wait_tap_writable(s);
+					return;
+				}
+				finish_tap(s);
+				return;
+			}
+#endif
+			if (s.tap_dst < 0) {
+				// 次の段がもう読まない。前の段を詰まらせないよう覗き見側へ流し続ける
+				ssize_t n = consume_tap(s, 0);
+				if (n > 0) continue;
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0 && errno == EAGAIN) {
+					if (s.tap_fd >= 0 && has_input(s.tap_src)) {
+						wait_tap_writable(s);
+					} else {
+						reactor().watch_readable(s.tap_src, again);
+					}
+					return;
+				}
+				finish_tap(s);
+				return;
+			}
+#ifdef __linux__
+			// 次の段へはパイプ間で複製するだけで、データはカーネルから出ない
+			ssize_t n = tee(s.tap_src, s.tap_dst, 1 << 20, SPLICE_F_NONBLOCK);
+			if (n > 0) {
+				s.tap_left = (size_t)n;
+				continue;
+			}
+			if (n == 0) {
+				finish_tap(s);
+				return;
+			}
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) {
+				// 入力が空なのか、次の段のパイプが一杯なのか
+				if (has_input(s.tap_src)) {
+					reactor().watch_writable(s.tap_dst, again);
+				} else {
+					reactor().watch_readable(s.tap_src, again);
+				}
+				return;
+			}
+			// EPIPE など。次の段が終了した
+			close_fd(&s.tap_dst);
+#else
+			while (!s.pending.empty()) {
+				std::string_view span = s.pending.front_span();
+				ssize_t r = write(s.tap_dst, span.data(), span.size());
+				if (r < 0 && errno == EINTR) continue;
+				if (r < 0 && errno == EAGAIN) {
+					reactor().watch_writable(s.tap_dst, again);
+					return;
+				}
+				if (r < 0) {
+					close_fd(&s.tap_dst);
+					s.pending.clear();
+					break;
+				}
+				s.pending.discard(r);
+			}
+			if (s.tap_dst < 0) continue;
+			ssize_t n = read(s.tap_src, tap_buffer.data(), tap_buffer.size());
+			if (n > 0) {
+				deliver_tap(s, tap_buffer.data(), (size_t)n);
+				s.pending.append(tap_buffer.data(), (size_t)n);
+				continue;
+			}
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0 && errno == EAGAIN) {
+				reactor().watch_readable(s.tap_src, again);
+				return;
+			}
+			finish_tap(s);
+			return;
+#endif
+		}
+	}
+
+	void on_stdout(char const *ptr, size_t len)
+	{
+		Stage &last = *stages.back();
+		if (last.tap_fn || last.tap_fd >= 0) {
+			deliver_tap(last, ptr, len);
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		outq.append(ptr, len);
+	}
+
+	void try_finish()
+	{
+		if (fd_out >= 0) return;
+		for (auto const &s : stages) {
+			if (!s->exited || s->fd_err >= 0 || s->tap_src >= 0) return;
+			if (s->tap_fd >= 0 && !s->tap_queue.empty()) return; // 覗き見側へ書き終えていない
+		}
+		reactor().cancel_timer(kill_timer);
+		kill_timer = 0;
+		if (completed_fn) {
+			completed_fn();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		close_input_now();
+		done = true;
+		cond.notify_all();
+	}
+
+	// 起動に失敗した。起動済みの段は終了させて回収だけしておく
+	void abort_spawn()
+	{
+		close_fd(&fd_in);
+		close_fd(&fd_out);
+		for (auto &s : stages) {
+			close_fd(&s->fd_err);
+			close_fd(&s->tap_src);
+			close_fd(&s->tap_dst);
+			pid_t pid = s->pid.exchange(0);
+			if (pid > 0) {
+				kill(pid, SIGKILL);
+				reactor().watch_child(pid, { });
+			}
+		}
+		fprintf(stderr, "%s\n", error_message.c_str());
+	}
+
+public:
+	bool spawn()
+	{
+		started = std::chrono::steady_clock::now();
+		int const R = 0;
+		int const W = 1;
+		int in_pipe[2];
+		if (open_pipe(in_pipe) < 0) {
+			error_code = errno;
+			error_message = "failed: pipe (stdin)";
+			fprintf(stderr, "%s\n", error_message.c_str());
+			return false;
+		}
+		fd_in = in_pipe[W];
+		int prev_read = in_pipe[R]; // 次に起動する段の stdin
+
+		for (size_t i = 0; i < stages.size(); i++) {
+			Stage &s = *stages[i];
+			bool last = i + 1 == stages.size();
+			int out_pipe[2] = { -1, -1 };
+			int err_pipe[2] = { -1, -1 };
+			int next_read = -1;
+			if (open_pipe(out_pipe) < 0 || open_pipe(err_pipe) < 0) {
+				error_code = errno;
+				error_message = "failed: pipe";
+				close_fd(&out_pipe[R]);
+				close_fd(&out_pipe[W]);
+				close_fd(&prev_read);
+				abort_spawn();
+				return false;
+			}
+			if (last) {
+				fd_out = out_pipe[R];
+			} else if (s.tap_fn || s.tap_fd >= 0) {
+				int relay[2];
+				if (open_pipe(relay) < 0) {
+					error_code = errno;
+					error_message = "failed: pipe (tap)";
+					for (int *fd : { &out_pipe[R], &out_pipe[W], &err_pipe[R], &err_pipe[W], &prev_read }) {
+						close_fd(fd);
+					}
+					abort_spawn();
+					return false;
+				}
+				s.tap_src = out_pipe[R];
+				s.tap_dst = relay[W];
+				next_read = relay[R];
+			} else {
+				next_read = out_pipe[R]; // 次の段と直結する
+			}
+
+			std::vector<char *> args;
+			for (std::string const &a : s.argvec) {
+				args.push_back(const_cast<char *>(a.c_str()));
+			}
+			args.push_back(nullptr);
+			ProcessPosixSpawner::Params params;
+			params.argv = args.data();
+			params.fd_in = prev_read;
+			params.fd_out = out_pipe[W];
+			params.fd_err = err_pipe[W];
+			params.change_dir = change_dir.empty() ? nullptr : change_dir.c_str();
+			pid_t pid = ProcessPosixSpawner::spawn(spawn_method, params);
+			int spawn_errno = errno;
+			close_fd(&prev_read);
+			close_fd(&out_pipe[W]);
+			close_fd(&err_pipe[W]);
+			s.fd_err = err_pipe[R];
+			if (pid < 0) {
+				error_code = spawn_errno;
+				error_message = "failed: fork";
+				close_fd(&next_read);
+				abort_spawn();
+				return false;
+			}
+			s.pid = pid;
+			prev_read = next_read;
+		}
+
+		set_nonblock(fd_in);
+		for (auto &s : stages) {
+			if (s->tap_src >= 0) {
+				set_nonblock(s->tap_src);
+				set_nonblock(s->tap_dst);
+				tap_buffer.resize(65536);
+			}
+		}
+		return true;
+	}
+
+	void start()
+	{
+		auto self = shared_from_this();
+		reactor().post([self]() {
+			ProcessPosixReactor &r = reactor();
+			r.add_reader(
+				self->fd_out,
+				[self](char const *ptr, size_t len) {
+					self->on_stdout(ptr, len);
+				},
+				[self](int) {
+					close_fd(&self->fd_out);
+					self->try_finish();
+				});
+			for (auto &stage : self->stages) {
+				Stage *s = stage.get();
+				r.add_reader(
+					s->fd_err,
+					[self, s](char const *ptr, size_t len) {
+						std::lock_guard<std::mutex> lock(self->mutex);
+						s->errq.append(ptr, len);
+					},
+					[self, s](int) {
+						close_fd(&s->fd_err);
+						self->try_finish();
+					});
+				r.watch_child(s->pid, [self, s](int status, struct rusage const &ru) {
+					s->exit_code = exit_code_from_status(status);
+					if (status >= 0) {
+						double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - self->started).count();
+						ProcessPosixSpawner::make_usage(ru, wall, &s->usage);
+					}
+					s->exited = true;
+					s->pid = 0;
+					self->try_finish();
+				});
+				if (s->tap_src >= 0) {
+					self->pump(*s);
+				}
+			}
+			if (self->use_input) {
+				self->flush_input();
+			} else {
+				std::lock_guard<std::mutex> lock(self->mutex);
+				self->close_input_now();
+			}
+		});
+	}
+
+	void write_input(char const *ptr, int len)
+	{
+		if (!ptr || len <= 0) return;
+		std::lock_guard<std::mutex> lock(mutex);
+		inq.append(ptr, len);
+		if (!flush_posted) {
+			flush_posted = true;
+			auto self = shared_from_this();
+			reactor().post([self]() {
+				self->flush_input();
+			});
+		}
+	}
+
+	void close_input(bool justnow)
+	{
+		auto self = shared_from_this();
+		if (justnow) {
+			reactor().post([self]() {
+				std::lock_guard<std::mutex> lock(self->mutex);
+				self->close_input_now();
+			});
+		} else {
+			std::lock_guard<std::mutex> lock(mutex);
+			close_input_later = true;
+			reactor().post([self]() {
+				self->flush_input();
+			});
+		}
+	}
+
+	void send_signal(int sig)
+	{
+		for (auto &s : stages) {
+			pid_t p = s->pid.load();
+			if (p > 0) {
+				kill(p, sig);
+			}
+		}
+	}
+
+	void terminate()
+	{
+		send_signal(SIGTERM);
+		// SIGTERM を無視する段のために SIGKILL へのエスカレーション期限を設定する
+		auto self = shared_from_this();
+		reactor().post([self]() {
+			if (self->kill_timer != 0) return;
+			self->kill_timer = reactor().add_timer(std::chrono::seconds(2), [self]() {
+				self->kill_timer = 0;
+				self->send_signal(SIGKILL);
+			});
+		});
+		close_input(true);
+	}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cond.wait(lock, [this]() {
+			return done;
+		});
+	}
+
+	bool wait_for(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		return process::helper::wait_until(cond, lock, timeout, [this]() {
+			return done;
+		});
+	}
+};
+
+struct ProcessPipeline::Private {
+	struct Stage {
+		std::vector<std::string> argv;
+		TapFn tap_fn;
+		int tap_fd = -1;
+		int exit_code = -1;
+		ProcessUsage usage;
+		std::vector<char> stderr_bytes;
+	};
+	std::vector<Stage> stages;
+	std::shared_ptr<PipelineJob> job;
+	ProcessPosixSpawner::Method spawn_method = ProcessPosixSpawner::Method::PosixSpawn;
+	std::string change_dir;
+	std::shared_ptr<void> user_data;
+	std::function<void(bool, std::shared_ptr<void>)> completed_fn;
+	std::vector<char> stdout_bytes;
+	int exit_code = -1;
+	int error_code = 0;
+	std::string error_message;
+};
+
+ProcessPipeline::ProcessPipeline()
+	: m(new Private)
+{
+}
+
+ProcessPipeline::~ProcessPipeline()
+{
+	if (m->job) {
+		m->job->terminate();
+		m->job->wait();
+	}
+	delete m;
+}
+
+ProcessPipeline &ProcessPipeline::add(std::string const &command)
+{
+	std::vector<std::string> argv;
+	ProcessPosix::parse_args(command, &argv);
+	return add(argv);
+}
+
+ProcessPipeline &ProcessPipeline::add(std::vector<std::string> const &argv)
+{
+	Private::Stage s;
+	s.argv = argv;
+	m->stages.push_back(std::move(s));
+	return *this;
+}
+
+size_t ProcessPipeline::size() const
+{
+	return m->stages.size();
+}
+
+ProcessPipeline &ProcessPipeline::tap(size_t stage, TapFn fn)
+{
+	if (stage < m->stages.size()) {
+		m->stages[stage].tap_fn = fn;
+	}
+	return *this;
+}
+
+ProcessPipeline &ProcessPipeline::tap_fd(size_t stage, int fd)
+{
+	if (stage < m->stages.size()) {
+		m->stages[stage].tap_fd = fd;
+	}
+	return *this;
+}
+
+void ProcessPipeline::set_spawn_method(ProcessPosixSpawner::Method method)
+{
+	m->spawn_method = method;
+}
+
+void ProcessPipeline::set_change_dir(std::string const &dir)
+{
+	m->change_dir = dir;
+}
+
+void ProcessPipeline::set_completion_callback(std::function<void(bool, std::shared_ptr<void>)> fn, std::shared_ptr<void> userdata)
+{
+	m->completed_fn = fn;
+	m->user_data = userdata;
+}
+
+bool ProcessPipeline::start(bool use_input)
+{
+	if (is_running()) return false;
+	m->exit_code = -1;
+	m->error_code = 0;
+	m->error_message.clear();
+	m->stdout_bytes.clear();
+	if (m->stages.empty()) {
+		m->error_code = EINVAL;
+		m->error_message = "empty pipeline";
+		return false;
+	}
+	auto job = std::make_shared<PipelineJob>();
+	for (Private::Stage &s : m->stages) {
+		s.exit_code = -1;
+		s.usage = { };
+		s.stderr_bytes.clear();
+		if (s.argv.empty()) {
+			m->error_code = EINVAL;
+			m->error_message = "empty command or failed to parse arguments";
+			return false;
+		}
+		auto stage = std::make_unique<PipelineJob::Stage>();
+		stage->argvec = s.argv;
+		stage->tap_fn = s.tap_fn;
+		stage->tap_fd = s.tap_fd;
+		job->stages.push_back(std::move(stage));
+	}
+	job->use_input = use_input;
+	// ProcessSpawnHelper は子の fd を指定できないので posix_spawn で起動する
+	job->spawn_method = m->spawn_method == ProcessPosixSpawner::Method::Helper ? ProcessPosixSpawner::Method::PosixSpawn : m->spawn_method;
+	job->change_dir = m->change_dir;
+	if (m->completed_fn) {
+		auto fn = m->completed_fn;
+		auto userdata = m->user_data;
+		job->completed_fn = [fn, userdata]() {
+			fn(true, userdata);
+		};
+	}
+	if (!job->spawn()) {
+		m->error_code = job->error_code;
+		m->error_message = std::move(job->error_message);
+		return false;
+	}
+	m->job = job;
+	job->start();
+	return true;
+}
+
+void ProcessPipeline::write_input(char const *ptr, int len)
+{
+	if (m->job) {
+		m->job->write_input(ptr, len);
+	}
+}
+
+void ProcessPipeline::close_input(bool justnow)
+{
+	if (m->job) {
+		m->job->close_input(justnow);
+	}
+}
+
+bool ProcessPipeline::is_running() const
+{
+	return m->job != nullptr;
+}
+
+void ProcessPipeline::stop()
+{
+	if (m->job) {
+		m->job->terminate();
+	}
+	wait();
+}
+
+int ProcessPipeline::wait()
+{
+	std::shared_ptr<PipelineJob> job = std::move(m->job);
+	if (!job) return m->exit_code;
+	job->wait();
+
+	// job はもう誰からも参照されないので、ロックせずに結果を移してよい
+	job->outq.finish();
+	m->stdout_bytes = job->outq.take_vector();
+	for (size_t i = 0; i < m->stages.size(); i++) {
+		PipelineJob::Stage &s = *job->stages[i];
+		s.errq.finish();
+		m->stages[i].stderr_bytes = s.errq.take_vector();
+		m->stages[i].exit_code = s.exit_code;
+		m->stages[i].usage = s.usage;
+	}
+	m->exit_code = m->stages.back().exit_code;
+	m->error_code = job->error_code;
+	m->error_message = std::move(job->error_message);
+	return m->exit_code;
+}
+
+bool ProcessPipeline::wait_for(std::chrono::milliseconds timeout)
+{
+	if (m->job && !m->job->wait_for(timeout)) return false;
+	wait();
+	return true;
+}
+
+int ProcessPipeline::get_exit_code() const
+{
+	return m->exit_code;
+}
+
+int ProcessPipeline::get_exit_code(size_t stage) const
+{
+	return stage < m->stages.size() ? m->stages[stage].exit_code : -1;
+}
+
+ProcessUsage ProcessPipeline::get_usage(size_t stage) const
+{
+	return stage < m->stages.size() ? m->stages[stage].usage : ProcessUsage();
+}
+
+int ProcessPipeline::get_error_code() const
+{
+	return m->error_code;
+}
+
+std::string const &ProcessPipeline::get_error_message() const
+{
+	return m->error_message;
+}
+
+std::vector<char> const &ProcessPipeline::stdout_bytes() const
+{
+	return m->stdout_bytes;
+}
+
+std::vector<char> ProcessPipeline::take_stdout()
+{
+	std::vector<char> v;
+	v.swap(m->stdout_bytes);
+	return v;
+}
+
+std::string_view ProcessPipeline::stdout_view() const
+{
+	return { m->stdout_bytes.data(), m->stdout_bytes.size() };
+}
+
+std::vector<char> const &ProcessPipeline::stderr_bytes(size_t stage) const
+{
+	static std::vector<char> const empty;
+	return stage < m->stages.size() ? m->stages[stage].stderr_bytes : empty;
+}
+
+std::vector<char> ProcessPipeline::take_stderr(size_t stage)
+{
+	std::vector<char> v;
+	if (stage < m->stages.size()) {
+		v.swap(m->stages[stage].stderr_bytes);
+	}
+	return v;
+}
+
+std::string_view ProcessPipeline::stderr_view(size_t stage) const
+{
+	if (stage >= m->stages.size()) return { };
+	return { m->stages[stage].stderr_bytes.data(), m->stages[stage].stderr_bytes.size() };
+}
@@ -0,0 +1,83 @@
+#ifndef PROCESSPIPELINE_H
+#define PROCESSPIPELINE_H
+
+#include "ProcessPosixSpawn.h"
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// "git log | grep foo | head" のように複数のコマンドをパイプでつないで実行する。
+// 段と段の間は子プロセス同士を直接パイプでつなぐので、途中のデータは親を経由しない。
+// 親が読み取るのは最後の段の stdout と、各段の stderr だけ。
+// I/O と子プロセスの回収は ProcessPosix と同じく共有リアクタ (ProcessPosixReactor) が行う。
+class ProcessPipeline {
+public:
+	typedef std::function<void(char const *ptr, size_t len)> TapFn;
+
+private:
+	struct Private;
+	Private *m;
+
+public:
+	ProcessPipeline();
+	~ProcessPipeline();
+	ProcessPipeline(ProcessPipeline const &) = delete;
+	ProcessPipeline &operator=(ProcessPipeline const &) = delete;
+
+	// start() 前に段を追加する。command の解釈は ProcessPosix::start() と同じ
+	ProcessPipeline &add(std::string const &command);
+	ProcessPipeline &add(std::vector<std::string> const &argv);
+	size_t size() const;
+
+	// start() 前に設定すること。stage 段目の stdout を覗く。次の段へ渡るデータは
+	// tee(2) でカーネル内で複製するので、ユーザー空間を経由しない (Linux 以外ではコピーする)。
+	// fn はリアクタスレッドから呼ばれる。最後の段に設定した場合は stdout の塊がそのまま届く。
+	ProcessPipeline &tap(size_t stage, TapFn fn);
+	// 覗いたデータを fd へ splice(2) する。読み取りもコピーも行わない。fd は呼び出し側が閉じる。
+	// fd が一杯の間はこの段の中継を止めて、書けるようになるまで待つ (リアクタは止めない)。
+	// tap() と併用するか splice できない fd の場合は write(2) で書くので、パイプやソケットは
+	// O_NONBLOCK にしておくこと。最後の段では書けなかった分を溜め、書き終えてから完了する
+	ProcessPipeline &tap_fd(size_t stage, int fd);
+
+	// start() 前に設定すること。Method::Helper は PosixSpawn として扱う。既定は PosixSpawn
+	void set_spawn_method(ProcessPosixSpawner::Method method);
+	void set_change_dir(std::string const &dir);
+
+	// start() 前に設定すること。全ての段が終了し出力を読み切った時点で、wait() が戻るより前に
+	// リアクタスレッドから呼ばれる (この中で wait() を呼ばないこと)。
+	void set_completion_callback(std::function<void(bool, std::shared_ptr<void>)> fn, std::shared_ptr<void> userdata);
+
+	// use_input が true なら write_input() で最初の段の stdin へ書き込める。
+	// どこかの段の起動に失敗した場合は、起動済みの段を終了させて false を返す。
+	bool start(bool use_input = false);
+	void write_input(char const *ptr, int len);
+	void close_input(bool justnow = false);
+	bool is_running() const;
+	void stop();
+
+	// 最後の段の終了コードを返す (シェルと同じ)
+	int wait();
+	// 全ての段が終了するまで最長 timeout 待つ。終わっていれば wait() と同じく結果を取り込んで true
+	bool wait_for(std::chrono::milliseconds timeout);
+	int get_exit_code() const;
+	int get_exit_code(size_t stage) const;
+	// stage 段目の資源使用量 (wall_seconds はパイプライン全体の起動からその段の回収まで)
+	ProcessUsage get_usage(size_t stage) const;
+	int get_error_code() const;
+	std::string const &get_error_message() const;
+
+	// 最後の段の stdout
+	std::vector<char> const &stdout_bytes() const;
+	std::vector<char> take_stdout();
+	std::string_view stdout_view() const;
+	// stage 段目の stderr
+	std::vector<char> const &stderr_bytes(size_t stage) const;
+	std::vector<char> take_stderr(size_t stage);
+	std::string_view stderr_view(size_t stage) const;
+};
+
+#endif // PROCESSPIPELINE_H
@@ -0,0 +1,307 @@
+#include "ProcessPool.h"
+#include "BasicProcessPosix.h"
+#include "ProcessPosixReactor.h"
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct ProcessPool::Task {
+	uint64_t id = 0;
+	Job job;
+	Callback callback;
+	// proc/pty の生成と破棄、cancel() からの terminate() は mutex の下で行う
+	std::mutex mutex;
+	std::unique_ptr<ProcessPosix> proc;
+	std::unique_ptr<ProcessPosixPty> pty;
+	bool launched = false; // launch() が入力を書き終えた。それまで complete() は結果を回収しない
+	bool completed = false; // launch() の途中で完了した
+	bool cancel_requested = false;
+};
+
+// 実行中のジョブの完了通知が shared_ptr で参照するので、ProcessPool より長く生きることがある
+struct ProcessPool::Private : std::enable_shared_from_this<ProcessPool::Private> {
+	mutable std::mutex mutex;
+	std::condition_variable cond;
+	size_t max_concurrency = 1;
+	uint64_t next_id = 1;
+	std::deque<std::shared_ptr<Task>> pending;
+	std::map<uint64_t, std::shared_ptr<Task>> running; // 結果を届け終えるまで残る
+
+	void start_pending();
+	void launch(Task *task);
+	void complete(uint64_t id);
+	static void terminate(Task *task);
+};
+
+ProcessPool::ProcessPool(size_t max_concurrency)
+	: m(std::make_shared<Private>())
+{
+	set_max_concurrency(max_concurrency);
+}
+
+ProcessPool::~ProcessPool()
+{
+	// リアクタスレッド (コールバックの中) では完了を待てないので、そのまま戻る。
+	// 残りのジョブは m を共有したまま最後まで実行され、結果もコールバックへ届く
+	wait_all();
+}
+
+void ProcessPool::set_max_concurrency(size_t n)
+{
+	if (n == 0) {
+		n = std::thread::hardware_concurrency();
+		if (n == 0) n = 1;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		m->max_concurrency = n;
+	}
+	m->start_pending();
+}
+
+size_t ProcessPool::max_concurrency() const
+{
+	std::lock_guard<std::mutex> lock(m->mutex);
+	return m->max_concurrency;
+}
+
+uint64_t ProcessPool::submit(Job job, Callback callback)
+{
+	auto task = std::make_shared<Task>();
+	task->job = std::move(job);
+	task->callback = std::move(callback);
+	uint64_t id;
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		id = m->next_id++;
+		task->id = id;
+		m->pending.push_back(task);
+	}
+	m->start_pending();
+	return id;
+}
+
+std::future<ProcessPool::Result> ProcessPool::submit(Job job)
+{
+	auto promise = std::make_shared<std::promise<Result>>();
+	std::future<Result> future = promise->get_future();
+	submit(std::move(job), [promise](Result &&result) {
+		promise->set_value(std::move(result));
+	});
+	return future;
+}
+
+// 空きがある限り待機中のジョブを起動する。呼び出し元スレッド（完了時はリアクタスレッド）で起動する。
+void ProcessPool::Private::start_pending()
+{
+	while (1) {
+		std::shared_ptr<Task> task;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (pending.empty() || running.size() >= max_concurrency) return;
+			task = pending.front();
+			pending.pop_front();
+			running[task->id] = task;
+		}
+		launch(task.get());
+	}
+}
+
+void ProcessPool::Private::launch(Task *task)
+{
+	uint64_t id = task->id;
+	// 完了通知は wait() が戻れるようになる前に呼ばれるので、結果の回収はいったん post してから行う
+	std::shared_ptr<Private> self = shared_from_this();
+	auto on_completed = [self, id](bool, std::shared_ptr<void>) {
+		ProcessPosixReactor::instance().post([self, id]() {
+			self->complete(id);
+		});
+	};
+	Job const &job = task->job;
+	bool started;
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+		if (job.use_pty) {
+			task->pty = std::make_unique<ProcessPosixPty>();
+			task->pty->set_spawn_method(job.spawn_method);
+			task->pty->set_change_dir(job.change_dir);
+			task->pty->set_completion_callback(on_completed, nullptr);
+			task->pty->start(job.command, job.env, !job.input.empty());
+			// fork などに失敗した場合は is_running() のまま完了通知が呼ばれるが、
+			// 空のコマンドでは実行を始めないので通知も呼ばれない (started が false)
+			started = task->pty->is_running();
+			if (started && task->cancel_requested) {
+				task->pty->terminate();
+			}
+		} else {
+			task->proc = std::make_unique<ProcessPosix>();
+			task->proc->set_spawn_method(job.spawn_method);
+			task->proc->set_completion_callback(on_completed, nullptr);
+			task->proc->start(job.command, !job.input.empty());
+			started = task->proc->is_running();
+			if (started && task->cancel_requested) {
+				task->proc->terminate();
+			}
+		}
+	}
+	// 入力の書き込みはロックせずに行う (PTY は書き切るまで待つので、その間も cancel() できるように)。
+	// その間に完了しても、complete() は launched になるまで proc/pty を破棄しない
+	if (started && !job.input.empty()) {
+		if (task->pty) {
+			task->pty->write_input(job.input.data(), (int)job.input.size());
+		} else {
+			task->proc->write_input(job.input.data(), (int)job.input.size());
+			task->proc->close_input(false);
+		}
+	}
+	bool completed;
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+		task->launched = true;
+		completed = task->completed;
+	}
+	if (completed || !started) {
+		// 書き込み中に届いた完了通知をやり直す。実行を始めなかった場合は完了通知が呼ばれない
+		on_completed(false, nullptr);
+	}
+}
+
+// リアクタスレッド上で呼ばれる
+void ProcessPool::Private::complete(uint64_t id)
+{
+	std::shared_ptr<Task> task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = running.find(id);
+		if (it == running.end()) return;
+		task = it->second;
+	}
+
+	Result result;
+	result.id = id;
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+		if (!task->launched) {
+			task->completed = true; // launch() が書き込みを終えてから回収する
+			return;
+		}
+		if (task->pty) {
+			result.exit_code = task->pty->wait();
+			result.error_code = task->pty->get_error_code();
+			result.stdout_bytes = task->pty->take_stdout();
+		} else {
+			result.exit_code = task->proc->wait();
+			result.error_code = task->proc->get_error_code();
+			result.stdout_bytes = task->proc->take_stdout();
+			result.stderr_bytes = task->proc->take_stderr();
+		}
+		task->pty.reset();
+		task->proc.reset();
+	}
+	if (task->callback) {
+		task->callback(std::move(result));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running.erase(id);
+		cond.notify_all();
+	}
+	start_pending();
+}
+
+// 起動済みのジョブを終了させる。結果は完了時に通常どおり届く
+void ProcessPool::Private::terminate(Task *task)
+{
+	std::lock_guard<std::mutex> lock(task->mutex);
+	task->cancel_requested = true;
+	if (task->pty) {
+		task->pty->terminate();
+	} else if (task->proc) {
+		task->proc->terminate();
+	}
+}
+
+void ProcessPool::cancel(uint64_t id)
+{
+	std::shared_ptr<Task> task;
+	std::shared_ptr<Task> running;
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		for (auto it = m->pending.begin(); it != m->pending.end(); it++) {
+			if ((*it)->id == id) {
+				task = *it;
+				m->pending.erase(it);
+				break;
+			}
+		}
+		auto it = m->running.find(id);
+		if (it != m->running.end()) {
+			running = it->second;
+		}
+		m->cond.notify_all();
+	}
+	if (running) {
+		Private::terminate(running.get());
+		return;
+	}
+	if (task && task->callback) {
+		Result result;
+		result.id = id;
+		result.error_code = ECANCELED;
+		result.canceled = true;
+		task->callback(std::move(result));
+	}
+}
+
+void ProcessPool::cancel_all()
+{
+	std::deque<std::shared_ptr<Task>> tasks;
+	std::vector<std::shared_ptr<Task>> running;
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		tasks.swap(m->pending);
+		for (auto &pair : m->running) {
+			running.push_back(pair.second);
+		}
+		m->cond.notify_all();
+	}
+	for (auto &task : running) {
+		Private::terminate(task.get());
+	}
+	for (auto &task : tasks) {
+		if (task->callback) {
+			Result result;
+			result.id = task->id;
+			result.error_code = ECANCELED;
+			result.canceled = true;
+			task->callback(std::move(result));
+		}
+	}
+}
+
+size_t ProcessPool::running() const
+{
+	std::lock_guard<std::mutex> lock(m->mutex);
+	return m->running.size();
+}
+
+size_t ProcessPool::pending() const
+{
+	std::lock_guard<std::mutex> lock(m->mutex);
+	return m->pending.size();
+}
+
+void ProcessPool::wait_all()
+{
+	// リアクタスレッドから呼ぶと完了を処理できずデッドロックする
+	if (ProcessPosixReactor::instance().in_reactor_thread()) return;
+	std::unique_lock<std::mutex> lock(m->mutex);
+	m->cond.wait(lock, [&]() {
+		return m->pending.empty() && m->running.empty();
+	});
+}
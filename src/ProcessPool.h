@@ -0,0 +1,75 @@
+#ifndef PROCESSPOOL_H
+#define PROCESSPOOL_H
+
+#include "ProcessHelper.h"
+#include "ProcessPosixSpawn.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 同時に走る子プロセスの数を制限するジョブキュー。
+// 投入されたジョブは FIFO で ProcessPosix (use_pty なら ProcessPosixPty) として起動され、
+// 同時実行数が上限に達している間は待たされる。ジョブ毎のスレッドは作らず、
+// 完了の検出と次のジョブの起動は共有リアクタスレッド上で行う。
+class ProcessPool {
+public:
+	struct Job {
+		std::string command;
+		std::string env; // use_pty の場合のみ有効 (ProcessPosixPty::start() の env)
+		process::helper::dir_string_t change_dir; // use_pty の場合のみ有効
+		// 空でなければ stdin へ書き込んでから閉じる。use_pty の場合は閉じない (端末は raw モードなので
+		// EOF を送れない)。入力の終わりを自分で判断しないコマンド (cat など) は終了しないので注意
+		std::vector<char> input;
+		bool use_pty = false;
+		ProcessPosixSpawner::Method spawn_method = ProcessPosixSpawner::Method::PosixSpawn;
+	};
+
+	struct Result {
+		uint64_t id = 0;
+		int exit_code = -1;
+		int error_code = 0; // 起動に失敗した場合の errno
+		bool canceled = false; // 起動前に cancel() された
+		std::vector<char> stdout_bytes; // use_pty の場合は端末出力 (stdout/stderr 混在)
+		std::vector<char> stderr_bytes;
+	};
+
+	// リアクタスレッド上で呼ばれるのでブロックしないこと。
+	// cancel() で取り消されたジョブは cancel() を呼んだスレッドから呼ばれる。
+	typedef std::function<void(Result &&result)> Callback;
+
+private:
+	struct Task;
+	struct Private;
+	std::shared_ptr<Private> m;
+
+public:
+	// max_concurrency = 0 の場合は CPU の数
+	explicit ProcessPool(size_t max_concurrency = 0);
+	// 実行中・待機中のジョブがすべて終わるまで待つ。リアクタスレッド (コールバックの中) から
+	// 破棄した場合は待たずに戻り、残りのジョブはそのまま実行されて結果もコールバックへ届く
+	~ProcessPool();
+	ProcessPool(ProcessPool const &) = delete;
+	ProcessPool &operator=(ProcessPool const &) = delete;
+
+	void set_max_concurrency(size_t n);
+	size_t max_concurrency() const;
+
+	// ジョブIDを返す
+	uint64_t submit(Job job, Callback callback);
+	std::future<Result> submit(Job job);
+
+	// 起動前のジョブを取り消す。起動済みのものは terminate() で終了させる（終了を待たずに戻り、
+	// 結果は通常どおり届く）。
+	void cancel(uint64_t id);
+	void cancel_all();
+
+	size_t running() const;
+	size_t pending() const;
+	void wait_all();
+};
+
+#endif // PROCESSPOOL_H
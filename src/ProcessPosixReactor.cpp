@@ -0,0 +1,813 @@
+#include "ProcessPosixReactor.h"
+#include "ProcessPosixUring.h"
+#include "ProcessTrace.h"
+#include "TimerWheel.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+#endif
+
+namespace {
+
+// pidfd が使えない環境で SIGCHLD をリアクタへ中継するための自己パイプ
+int g_sigchld_pipe[2] = { -1, -1 };
+struct sigaction g_sigchld_prev;
+
+void sigchld_handler(int sig, siginfo_t *info, void *ctx)
+{
+	int saved = errno;
+	char c = 0;
+	if (write(g_sigchld_pipe[1], &c, 1) < 0) {
+		// パイプが一杯なら既に起床が予約されている
+	}
+	errno = saved;
+	// ホストアプリが自前のハンドラを設定していた場合はそちらにも届ける
+	if (g_sigchld_prev.sa_flags & SA_SIGINFO) {
+		if (g_sigchld_prev.sa_sigaction) {
+			g_sigchld_prev.sa_sigaction(sig, info, ctx);
+		}
+	} else if (g_sigchld_prev.sa_handler != SIG_DFL && g_sigchld_prev.sa_handler != SIG_IGN) {
+		g_sigchld_prev.sa_handler(sig);
+	}
+}
+
+int open_pidfd(pid_t pid)
+{
+#ifdef __linux__
+	return static_cast<int>(syscall(__NR_pidfd_open, pid, 0));
+#else
+	(void)pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+void set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags >= 0 && !(flags & O_NONBLOCK)) {
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	}
+}
+
+void set_cloexec(int fd)
+{
+	int flags = fcntl(fd, F_GETFD, 0);
+	if (flags >= 0) {
+		fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+	}
+}
+
+} // namespace
+
+struct ProcessPosixReactor::Private {
+	std::thread thread;
+	std::atomic<pthread_t> thread_handle { };
+	std::atomic<bool> thread_started { false };
+
+	std::mutex post_mutex;
+	std::vector<std::function<void()>> posted;
+	bool wake_pending = false;
+	int wake_pipe[2] = { -1, -1 };
+#ifdef __linux__
+	Backend backend = Backend::Epoll;
+	int epfd = -1;
+#else
+	Backend backend = Backend::Poll;
+#endif
+
+	struct Watch {
+		DataFn on_data;
+		CloseFn on_close;
+		ReadyFn on_writable;
+		ReadyFn on_readable;
+		pid_t child = 0; // pidfd の場合、監視対象の子プロセス
+		bool registered = false; // epoll に登録済みか
+		uint64_t read_op = 0; // io_uring で完了待ちの読み取り (または POLLIN) 要求
+		bool nonblock = false; // io_uring で、呼び出し側が O_NONBLOCK にした fd (READ を出さない)
+		uint64_t write_op = 0; // io_uring で完了待ちの POLLOUT 要求
+	};
+	std::unordered_map<int, Watch> watches;
+
+#ifdef PROCESS_POSIX_HAVE_IO_URING
+	std::unique_ptr<ProcessPosixUring> uring;
+	enum class OpKind {
+		Read, // バッファプールへの read
+		ReadPoll, // O_NONBLOCK の fd が読めるようになるのを待って、handle_readable() で読む
+		ReadyPoll, // watch_readable() の POLLIN
+		ChildPoll, // pidfd の POLLIN
+		WritePoll, // POLLOUT
+	};
+	struct Op {
+		int fd;
+		OpKind kind;
+	};
+	// 完了待ちの要求。取り消した要求はここから消すので、後から完了が届いても無視される
+	// (fd の番号が再利用されていても取り違えない)。
+	std::unordered_map<uint64_t, Op> ops;
+	uint64_t next_op = 2; // 0 は取り消しとバッファ返却、1 は wake_pipe
+#endif
+
+	struct Child {
+		ExitFn on_exit;
+		int pidfd = -1; // -1 なら SIGCHLD による回収に任せる
+	};
+	std::map<pid_t, Child> children;
+	bool sigchld_installed = false;
+	bool pidfd_unsupported = false;
+
+	// タイマーは 1ms を 1 tick とするホイールで管理する (登録も取り消しも O(1))
+	Clock::time_point timer_epoch = Clock::now();
+	TimerWheel timers;
+	std::atomic<uint64_t> next_timer_id { 1 };
+
+	uint64_t timer_tick(Clock::time_point t, bool round_up) const
+	{
+		if (t <= timer_epoch) return 0;
+		auto d = t - timer_epoch;
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(d);
+		if (round_up && ms < d) ms += std::chrono::milliseconds(1);
+		return (uint64_t)ms.count();
+	}
+
+	char buffer[65536];
+};
+
+ProcessPosixReactor::ProcessPosixReactor()
+	: m(new Private)
+{
+	if (pipe(m->wake_pipe) == 0) {
+		set_nonblock(m->wake_pipe[0]);
+		set_nonblock(m->wake_pipe[1]);
+		set_cloexec(m->wake_pipe[0]);
+		set_cloexec(m->wake_pipe[1]);
+	}
+#ifdef PROCESS_POSIX_HAVE_IO_URING
+	char const *backend = getenv("PROCESS_REACTOR_BACKEND");
+	if (backend && strcmp(backend, "io_uring") == 0) {
+		auto uring = std::make_unique<ProcessPosixUring>();
+		// 古いカーネルや io_uring が禁止された環境では失敗するので、その場合は epoll を使う
+		if (uring->init(256)) {
+			m->uring = std::move(uring);
+			m->backend = Backend::IoUring;
+			m->uring->prep_poll(m->wake_pipe[0], POLLIN, 1);
+		}
+	}
+#endif
+#ifdef __linux__
+	if (m->backend == Backend::Epoll) {
+		m->epfd = epoll_create1(EPOLL_CLOEXEC);
+		epoll_event ev = { };
+		ev.events = EPOLLIN;
+		ev.data.fd = m->wake_pipe[0];
+		epoll_ctl(m->epfd, EPOLL_CTL_ADD, m->wake_pipe[0], &ev);
+	}
+#endif
+	m->thread = std::thread([this]() {
+		run();
+	});
+}
+
+ProcessPosixReactor::~ProcessPosixReactor()
+{
+	// instance() はプロセス終了まで破棄しない（静的オブジェクトの破棄順序の問題を避けるため）
+	delete m;
+}
+
+ProcessPosixReactor &ProcessPosixReactor::instance()
+{
+	static ProcessPosixReactor *reactor = new ProcessPosixReactor;
+	return *reactor;
+}
+
+bool ProcessPosixReactor::in_reactor_thread() const
+{
+	return m->thread_started.load() && pthread_equal(m->thread_handle.load(), pthread_self());
+}
+
+ProcessPosixReactor::Backend ProcessPosixReactor::backend() const
+{
+	return m->backend;
+}
+
+void ProcessPosixReactor::post(std::function<void()> fn)
+{
+	bool wake = false;
+	{
+		std::lock_guard<std::mutex> lock(m->post_mutex);
+		m->posted.push_back(std::move(fn));
+		if (!m->wake_pending) {
+			m->wake_pending = true;
+			wake = true;
+		}
+	}
+	if (wake) {
+		char c = 0;
+		while (write(m->wake_pipe[1], &c, 1) < 0 && errno == EINTR) { }
+	}
+}
+
+void ProcessPosixReactor::update_interest(int fd)
+{
+#ifdef PROCESS_POSIX_HAVE_IO_URING
+	if (m->uring) {
+		arm_uring(fd);
+		return;
+	}
+#endif
+	auto it = m->watches.find(fd);
+	bool want_read = it != m->watches.end() && (it->second.on_data || it->second.on_readable || it->second.child > 0);
+	bool want_write = it != m->watches.end() && it->second.on_writable;
+#ifdef __linux__
+	if (!want_read && !want_write) {
+		if (it != m->watches.end()) {
+			if (it->second.registered) {
+				epoll_ctl(m->epfd, EPOLL_CTL_DEL, fd, nullptr);
+			}
+			m->watches.erase(it);
+		}
+		return;
+	}
+	epoll_event ev = { };
+	ev.events = (want_read ? uint32_t(EPOLLIN) : 0u) | (want_write ? uint32_t(EPOLLOUT) : 0u);
+	ev.data.fd = fd;
+	if (it->second.registered) {
+		epoll_ctl(m->epfd, EPOLL_CTL_MOD, fd, &ev);
+	} else if (epoll_ctl(m->epfd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+		it->second.registered = true;
+	}
+#else
+	// poll() はループ毎に watches から pollfd を組み立て直すので、不要な要素を消すだけでよい
+	if (!want_read && !want_write && it != m->watches.end()) {
+		m->watches.erase(it);
+	}
+#endif
+}
+
+void ProcessPosixReactor::add_reader(int fd, DataFn on_data, CloseFn on_close)
+{
+	if (fd < 0) return;
+	if (!in_reactor_thread()) {
+		post([this, fd, on_data, on_close]() {
+			add_reader(fd, on_data, on_close);
+		});
+		return;
+	}
+	Private::Watch &w = m->watches[fd];
+#ifdef PROCESS_POSIX_HAVE_IO_URING
+	if (m->uring) {
+		// io_uring の READ はブロッキングの fd ならカーネル内で読めるようになるのを待って完了するが、
+		// O_NONBLOCK の fd では待たずに -EAGAIN で完了する。なので fd のフラグは変えず、
+		// 呼び出し側が非ブロッキングにしていた fd だけ POLLIN を待ってから自分で読む
+		w.nonblock = (fcntl(fd, F_GETFL, 0) & O_NONBLOCK) != 0;
+	} else
+#endif
+	{
+		set_nonblock(fd);
+	}
+	w.on_data = on_data;
+	w.on_close = on_close;
+	update_interest(fd);
+}
+
+void ProcessPosixReactor::remove_reader(int fd)
+{
+	if (!in_reactor_thread()) {
+		post([this, fd]() {
+			remove_reader(fd);
+		});
+		return;
+	}
+	auto it = m->watches.find(fd);
+	if (it != m->watches.end()) {
+		it->second.on_data = { };
+		it->second.on_close = { };
+		update_interest(fd);
+	}
+}
+
+void ProcessPosixReactor::watch_writable(int fd, ReadyFn fn)
+{
+	if (fd < 0) return;
+	if (!in_reactor_thread()) {
+		post([this, fd, fn]() {
+			watch_writable(fd, fn);
+		});
+		return;
+	}
+	Private::Watch &w = m->watches[fd];
+	w.on_writable = fn;
+	update_interest(fd);
+}
+
+void ProcessPosixReactor::unwatch_writable(int fd)
+{
+	if (!in_reactor_thread()) {
+		post([this, fd]() {
+			unwatch_writable(fd);
+		});
+		return;
+	}
+	auto it = m->watches.find(fd);
+	if (it != m->watches.end()) {
+		it->second.on_writable = { };
+		update_interest(fd);
+	}
+}
+
+void ProcessPosixReactor::watch_readable(int fd, ReadyFn fn)
+{
+	if (fd < 0) return;
+	if (!in_reactor_thread()) {
+		post([this, fd, fn]() {
+			watch_readable(fd, fn);
+		});
+		return;
+	}
+	Private::Watch &w = m->watches[fd];
+	w.on_readable = fn;
+	update_interest(fd);
+}
+
+void ProcessPosixReactor::unwatch_readable(int fd)
+{
+	if (!in_reactor_thread()) {
+		post([this, fd]() {
+			unwatch_readable(fd);
+		});
+		return;
+	}
+	auto it = m->watches.find(fd);
+	if (it != m->watches.end()) {
+		it->second.on_readable = { };
+		update_interest(fd);
+	}
+}
+
+void ProcessPosixReactor::install_sigchld_handler()
+{
+	if (m->sigchld_installed) return;
+	m->sigchld_installed = true;
+	if (pipe(g_sigchld_pipe) < 0) return;
+	for (int fd : g_sigchld_pipe) {
+		set_nonblock(fd);
+		set_cloexec(fd);
+	}
+	add_reader(
+		g_sigchld_pipe[0],
+		[this](char const *, size_t) {
+			reap_children();
+		},
+		{ });
+	struct sigaction sa = { };
+	sa.sa_sigaction = sigchld_handler;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGCHLD, &sa, &g_sigchld_prev);
+}
+
+void ProcessPosixReactor::watch_child(pid_t pid, ExitFn on_exit, int pidfd)
+{
+	if (pid <= 0) return;
+	if (!in_reactor_thread()) {
+		post([this, pid, on_exit, pidfd]() {
+			watch_child(pid, on_exit, pidfd);
+		});
+		return;
+	}
+	// 回収前の子の pid は再利用されないので、fork 後に pidfd_open しても競合しない
+	if (pidfd < 0 && !m->pidfd_unsupported) {
+		pidfd = open_pidfd(pid);
+		if (pidfd < 0 && (errno == ENOSYS || errno == EPERM)) {
+			m->pidfd_unsupported = true;
+		}
+	}
+	Private::Child &child = m->children[pid];
+	child.on_exit = on_exit;
+	child.pidfd = pidfd;
+	if (pidfd >= 0) {
+		set_cloexec(pidfd);
+		m->watches[pidfd].child = pid;
+		update_interest(pidfd);
+	} else {
+		install_sigchld_handler();
+	}
+	// 登録前に既に終了していた場合に備えて一度確認しておく
+	reap_child(pid);
+}
+
+uint64_t ProcessPosixReactor::add_timer(Clock::duration delay, TimerFn fn)
+{
+	uint64_t id = m->next_timer_id++;
+	Clock::time_point when = Clock::now() + delay;
+	auto insert = [this, id, when, fn]() {
+		// 期限を tick に切り上げるので、早く呼ばれることはない
+		m->timers.add(id, m->timer_tick(when, true), fn);
+	};
+	if (in_reactor_thread()) {
+		insert();
+	} else {
+		post(insert);
+	}
+	return id;
+}
+
+void ProcessPosixReactor::cancel_timer(uint64_t id)
+{
+	if (id == 0) return;
+	if (!in_reactor_thread()) {
+		post([this, id]() {
+			cancel_timer(id);
+		});
+		return;
+	}
+	m->timers.cancel(id);
+}
+
+void ProcessPosixReactor::handle_readable(int fd)
+{
+	auto it = m->watches.find(fd);
+	if (it == m->watches.end()) return;
+	if (it->second.child > 0) {
+		// pidfd が読み込み可能 = 子プロセスが終了した
+		reap_child(it->second.child);
+		return;
+	}
+	if (it->second.on_readable && !it->second.on_data) {
+		ReadyFn fn = std::move(it->second.on_readable);
+		it->second.on_readable = { };
+		update_interest(fd);
+		fn();
+		return;
+	}
+	if (!it->second.on_data) return;
+
+	// レベルトリガなので1回のイベントで1回だけ読む。大量出力の fd が他を飢えさせないため。
+	ssize_t n = read(fd, m->buffer, sizeof(m->buffer));
+	if (n > 0) {
+		DataFn fn = it->second.on_data; // コールバック内で登録解除されても安全なようにコピーする
+		fn(m->buffer, static_cast<size_t>(n));
+		return;
+	}
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return;
+	}
+	// EOF、または PTY master の EIO（スレーブ側が全て閉じられた）
+	int error = n < 0 ? errno : 0;
+	CloseFn fn = std::move(it->second.on_close);
+	it->second.on_data = { };
+	it->second.on_close = { };
+	update_interest(fd);
+	if (fn) {
+		fn(error);
+	}
+}
+
+void ProcessPosixReactor::handle_writable(int fd)
+{
+	auto it = m->watches.find(fd);
+	if (it == m->watches.end() || !it->second.on_writable) return;
+	ReadyFn fn = std::move(it->second.on_writable);
+	it->second.on_writable = { };
+	update_interest(fd);
+	fn();
+}
+
+void ProcessPosixReactor::run_posted()
+{
+	{
+		char tmp[256];
+		while (read(m->wake_pipe[0], tmp, sizeof(tmp)) > 0) { }
+	}
+	std::vector<std::function<void()>> list;
+	{
+		std::lock_guard<std::mutex> lock(m->post_mutex);
+		list.swap(m->posted);
+		m->wake_pending = false;
+	}
+	for (auto &fn : list) {
+		fn();
+	}
+}
+
+void ProcessPosixReactor::run_timers()
+{
+	if (m->timers.empty()) return;
+	m->timers.advance(m->timer_tick(Clock::now(), false));
+	// コールバックが同じ回に期限の来た他のタイマーを取り消してもよいよう、1つずつ取り出す
+	TimerFn fn;
+	while (m->timers.pop_expired(&fn)) {
+		if (fn) {
+			fn();
+		}
+	}
+}
+
+bool ProcessPosixReactor::reap_child(pid_t pid)
+{
+	auto it = m->children.find(pid);
+	if (it == m->children.end()) return false;
+	// 自分が起動した子だけを pid 指定で回収する。waitpid(-1) はホストアプリの
+	// 他の子プロセスまで回収してしまうので使わない。
+	// wait4 なら、回収と同時に子の CPU 時間や最大 RSS も得られる
+	int status = 0;
+	struct rusage usage;
+	memset(&usage, 0, sizeof(usage));
+	pid_t r;
+	do {
+		r = wait4(pid, &status, WNOHANG, &usage);
+	} while (r < 0 && errno == EINTR);
+	if (r != pid && !(r < 0 && errno == ECHILD)) return false;
+	ProcessTrace::record(ProcessTrace::Event::Exit, 0, pid, r < 0 ? (uint64_t)-1 : (uint64_t)status);
+
+	ExitFn fn = std::move(it->second.on_exit);
+	int pidfd = it->second.pidfd;
+	m->children.erase(it);
+	if (pidfd >= 0) {
+		auto w = m->watches.find(pidfd);
+		if (w != m->watches.end()) {
+			w->second.child = 0;
+			update_interest(pidfd);
+		}
+		close(pidfd);
+	}
+	if (fn) {
+		if (r < 0) {
+			memset(&usage, 0, sizeof(usage));
+		}
+		fn(r < 0 ? -1 : status, usage);
+	}
+	return true;
+}
+
+void ProcessPosixReactor::reap_children()
+{
+	// SIGCHLD はまとめて届くことがあるので、pidfd を持たない子を全て確認する
+	std::vector<pid_t> pids;
+	for (auto const &pair : m->children) {
+		if (pair.second.pidfd < 0) {
+			pids.push_back(pair.first);
+		}
+	}
+	for (pid_t pid : pids) {
+		reap_child(pid);
+	}
+}
+
+int ProcessPosixReactor::next_timeout_ms() const
+{
+	uint64_t tick = m->timers.next_tick();
+	if (tick == TimerWheel::Never) return -1;
+	auto d = m->timer_epoch + std::chrono::milliseconds(tick) - Clock::now();
+	if (d <= Clock::duration::zero()) return 0;
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(d);
+	if (ms < d) ms += std::chrono::milliseconds(1);
+	return static_cast<int>(std::min<long long>(ms.count(), 1 << 30));
+}
+
+void ProcessPosixReactor::run()
+{
+	m->thread_handle = pthread_self();
+	m->thread_started = true;
+	ProcessTrace::set_thread_name("process reactor");
+
+	// 子プロセスが stdin を閉じた後の write で SIGPIPE を受けるとホストプロセスごと
+	// 終了してしまうため、このスレッドではブロックして EPIPE として扱う。
+	{
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &set, nullptr);
+	}
+
+#ifdef PROCESS_POSIX_HAVE_IO_URING
+	if (m->uring) {
+		run_uring();
+		return;
+	}
+#endif
+
+	while (1) {
+		int timeout = next_timeout_ms();
+#ifdef __linux__
+		epoll_event events[64];
+		int n = epoll_wait(m->epfd, events, 64, timeout);
+		if (n < 0 && errno != EINTR) break;
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			if (fd == m->wake_pipe[0]) {
+				run_posted();
+				continue;
+			}
+			uint32_t e = events[i].events;
+			if (e & (EPOLLOUT | EPOLLERR)) {
+				handle_writable(fd);
+			}
+			if (e & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+				handle_readable(fd);
+			}
+		}
+#else
+		std::vector<pollfd> fds;
+		fds.push_back({ m->wake_pipe[0], POLLIN, 0 });
+		for (auto const &pair : m->watches) {
+			short events = 0;
+			if (pair.second.on_data || pair.second.on_readable) events |= POLLIN;
+			if (pair.second.on_writable) events |= POLLOUT;
+			if (events) {
+				fds.push_back({ pair.first, events, 0 });
+			}
+		}
+		int n = poll(fds.data(), fds.size(), timeout);
+		if (n < 0 && errno != EINTR) break;
+		for (size_t i = 1; n > 0 && i < fds.size(); i++) {
+			short e = fds[i].revents;
+			if (e & (POLLOUT | POLLERR)) {
+				handle_writable(fds[i].fd);
+			}
+			if (e & (POLLIN | POLLHUP | POLLERR)) {
+				handle_readable(fds[i].fd);
+			}
+		}
+		if (n > 0 && (fds[0].revents & POLLIN)) {
+			run_posted();
+		}
+#endif
+		run_timers();
+	}
+}
+
+#ifdef PROCESS_POSIX_HAVE_IO_URING
+
+// io_uring 版の update_interest()。必要な要求が出ていなければ積み、不要になった要求は取り消す。
+// 積んだ SQE は次に run_uring() が io_uring_enter を呼ぶときにまとめて submit される。
+void ProcessPosixReactor::arm_uring(int fd)
+{
+	auto it = m->watches.find(fd);
+	if (it == m->watches.end()) return;
+	Private::Watch &w = it->second;
+	bool want_read = w.on_data || w.on_readable || w.child > 0;
+	bool want_write = (bool)w.on_writable;
+
+	if (want_read && w.read_op == 0) {
+		uint64_t id = m->next_op++;
+		if (w.child > 0) {
+			m->ops[id] = { fd, Private::OpKind::ChildPoll };
+			m->uring->prep_poll(fd, POLLIN, id);
+		} else if (w.on_data && !w.nonblock) {
+			m->ops[id] = { fd, Private::OpKind::Read };
+			m->uring->prep_read(fd, id);
+		} else if (w.on_data) {
+			m->ops[id] = { fd, Private::OpKind::ReadPoll };
+			m->uring->prep_poll(fd, POLLIN, id);
+		} else {
+			m->ops[id] = { fd, Private::OpKind::ReadyPoll };
+			m->uring->prep_poll(fd, POLLIN, id);
+		}
+		w.read_op = id;
+	} else if (!want_read && w.read_op != 0) {
+		m->ops.erase(w.read_op);
+		m->uring->prep_cancel(w.read_op);
+		w.read_op = 0;
+	}
+
+	if (want_write && w.write_op == 0) {
+		uint64_t id = m->next_op++;
+		m->ops[id] = { fd, Private::OpKind::WritePoll };
+		m->uring->prep_poll(fd, POLLOUT, id);
+		w.write_op = id;
+	} else if (!want_write && w.write_op != 0) {
+		m->ops.erase(w.write_op);
+		m->uring->prep_cancel(w.write_op);
+		w.write_op = 0;
+	}
+
+	if (!want_read && !want_write) {
+		m->watches.erase(it);
+	}
+}
+
+void ProcessPosixReactor::handle_completion(uint64_t user_data, int res, uint32_t flags)
+{
+	if (user_data == 0) return; // 取り消しとバッファ返却の結果
+	if (user_data == 1) {
+		run_posted();
+		m->uring->prep_poll(m->wake_pipe[0], POLLIN, 1);
+		return;
+	}
+
+	bool has_buffer = (flags & IORING_CQE_F_BUFFER) != 0;
+	unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+	auto op = m->ops.find(user_data);
+	if (op == m->ops.end()) {
+		// 取り消した要求。読めてしまったデータは捨ててバッファだけ返す
+		if (has_buffer) m->uring->provide_buffer(bid);
+		return;
+	}
+	int fd = op->second.fd;
+	Private::OpKind kind = op->second.kind;
+	m->ops.erase(op);
+	auto it = m->watches.find(fd);
+	if (it == m->watches.end()) {
+		if (has_buffer) m->uring->provide_buffer(bid);
+		return;
+	}
+
+	switch (kind) {
+	case Private::OpKind::WritePoll:
+		it->second.write_op = 0;
+		handle_writable(fd);
+		return;
+	case Private::OpKind::ChildPoll:
+		it->second.read_op = 0;
+		handle_readable(fd); // 子プロセスを回収する
+		update_interest(fd); // まだ回収できなければ再度待つ
+		return;
+	case Private::OpKind::ReadPoll:
+		it->second.read_op = 0;
+		handle_readable(fd); // 1回だけ読む (EOF なら on_close を呼んで登録を解除する)
+		update_interest(fd); // 登録が残っていれば再度待つ
+		return;
+	case Private::OpKind::ReadyPoll:
+		it->second.read_op = 0;
+		handle_readable(fd); // on_readable を呼ぶ
+		return;
+	case Private::OpKind::Read:
+		break;
+	}
+
+	it->second.read_op = 0;
+	if (res > 0 && has_buffer) {
+		DataFn fn = it->second.on_data; // コールバック内で登録解除されても安全なようにコピーする
+		if (fn) {
+			fn(m->uring->buffer(bid), static_cast<size_t>(res));
+		}
+		m->uring->provide_buffer(bid);
+		update_interest(fd); // 登録が残っていれば次の read を出す
+		return;
+	}
+	if (has_buffer) m->uring->provide_buffer(bid);
+	if (res == -EAGAIN) {
+		// add_reader() の後で O_NONBLOCK にされた fd。以後は POLLIN を待ってから読む
+		it->second.nonblock = true;
+		update_interest(fd);
+		return;
+	}
+	if (res == -EINTR) {
+		update_interest(fd);
+		return;
+	}
+	if (res == -ENOBUFS) {
+		// バッファプールが空。この周回で返したバッファが submit されれば読める
+		update_interest(fd);
+		return;
+	}
+	// EOF、または PTY master の EIO（スレーブ側が全て閉じられた）
+	int error = res < 0 ? -res : 0;
+	CloseFn fn = std::move(it->second.on_close);
+	it->second.on_data = { };
+	it->second.on_close = { };
+	update_interest(fd);
+	if (fn) {
+		fn(error);
+	}
+}
+
+// io_uring 版のイベントループ。1周につき io_uring_enter を1回だけ呼び、前の周回で積んだ
+// SQE (read の再発行、バッファの返却、POLL の登録、取り消し) の submit と完了待ちを同時に行う。
+void ProcessPosixReactor::run_uring()
+{
+	while (1) {
+		int timeout = next_timeout_ms();
+		int r = m->uring->submit_and_wait(timeout);
+		if (r < 0) break;
+		m->uring->for_each_cqe([this](io_uring_cqe const &cqe) {
+			handle_completion(cqe.user_data, cqe.res, cqe.flags);
+		});
+		run_timers();
+	}
+}
+
+#endif // PROCESS_POSIX_HAVE_IO_URING
@@ -0,0 +1,91 @@
+#ifndef PROCESSPOSIXREACTOR_H
+#define PROCESSPOSIXREACTOR_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <sys/types.h>
+
+struct rusage;
+
+// 全ての ProcessPosix / ProcessPosixPty で共有するI/Oリアクタ。
+// 1本のスレッドで stdout/stderr/stdin/PTY の fd と子プロセスの終了を多重化する。
+// Linux では epoll を、それ以外では poll を使う。環境変数 PROCESS_REACTOR_BACKEND=io_uring で
+// io_uring を選べる (使えなければ epoll に戻る)。現状 throughput ベンチマークで epoll に届かないので既定にはしない
+// 登録されたコールバックは全てリアクタスレッド上で呼ばれるため、ブロックしてはならない。
+// 各メソッドはリアクタスレッドから呼ばれた場合は即座に、それ以外のスレッドからは
+// post() 経由で非同期に実行される。
+class ProcessPosixReactor {
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef std::function<void(char const *ptr, size_t len)> DataFn;
+	typedef std::function<void(int error)> CloseFn;
+	typedef std::function<void()> ReadyFn;
+	// usage は回収 (wait4) 時に得た子の資源使用量。回収できなかった場合は status が -1 で、usage は 0 埋め
+	typedef std::function<void(int status, struct rusage const &usage)> ExitFn;
+	typedef std::function<void()> TimerFn;
+
+	enum class Backend {
+		Poll,
+		Epoll,
+		IoUring,
+	};
+
+private:
+	struct Private;
+	Private *m;
+
+	ProcessPosixReactor();
+	~ProcessPosixReactor();
+	void run();
+	void run_posted();
+	void run_timers();
+	void install_sigchld_handler();
+	bool reap_child(pid_t pid);
+	void reap_children();
+	int next_timeout_ms() const;
+	void update_interest(int fd);
+	void handle_readable(int fd);
+	void handle_writable(int fd);
+	void run_uring();
+	void arm_uring(int fd);
+	void handle_completion(uint64_t user_data, int res, uint32_t flags);
+
+public:
+	ProcessPosixReactor(ProcessPosixReactor const &) = delete;
+	ProcessPosixReactor &operator=(ProcessPosixReactor const &) = delete;
+
+	static ProcessPosixReactor &instance();
+
+	bool in_reactor_thread() const;
+	Backend backend() const;
+	void post(std::function<void()> fn);
+
+	// fd の読み取りを開始する。EOF/エラーで登録は自動的に解除され、on_close が呼ばれる。
+	// fd のクローズは呼び出し側の責任（リアクタスレッド上で行うこと）。
+	// epoll/poll では fd を非ブロッキングにする。io_uring では fd のフラグを変えないので、
+	// リアクタスレッドから write する fd は呼び出し側で O_NONBLOCK にしておくこと。
+	void add_reader(int fd, DataFn on_data, CloseFn on_close);
+	void remove_reader(int fd);
+
+	// fd が書き込み可能になったら一度だけ fn を呼ぶ。
+	void watch_writable(int fd, ReadyFn fn);
+	void unwatch_writable(int fd);
+
+	// fd が読み込み可能 (または EOF/エラー) になったら一度だけ fn を呼ぶ。読み取りは行わないので、
+	// splice/tee のように fd を自分で消費する場合に使う。同じ fd に add_reader() と併用しないこと。
+	void watch_readable(int fd, ReadyFn fn);
+	void unwatch_readable(int fd);
+
+	// 子プロセスの終了を監視し、回収 (wait4) した時点の status と資源使用量を渡して on_exit を呼ぶ。
+	// 終了は pidfd（Linux 5.3 以降）で即座に検出する。pidfd を持っていれば渡してよい
+	// (所有権はリアクタへ移る)。使えない環境では SIGCHLD ハンドラによる回収に切り替える。
+	void watch_child(pid_t pid, ExitFn on_exit, int pidfd = -1);
+
+	// 0 は無効なタイマーIDとして扱う。
+	uint64_t add_timer(Clock::duration delay, TimerFn fn);
+	void cancel_timer(uint64_t id);
+};
+
+#endif // PROCESSPOSIXREACTOR_H
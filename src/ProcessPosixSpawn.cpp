@@ -0,0 +1,227 @@
+#include "ProcessPosixSpawn.h"
+#include "AbstractProcess.h"
+#include "ProcessTrace.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+extern char **environ;
+
+namespace {
+
+// fork 後の子プロセスで fd を標準入出力の番号へ付け替える。
+// 番号が同じ場合 dup2 は CLOEXEC を落とさないので明示的に外す。
+void move_fd(int from, int to)
+{
+	if (from < 0) return;
+	if (from == to) {
+		int flags = fcntl(from, F_GETFD, 0);
+		if (flags >= 0) {
+			fcntl(from, F_SETFD, flags & ~FD_CLOEXEC);
+		}
+	} else {
+		dup2(from, to);
+	}
+}
+
+void write_error(char const *msg, size_t len)
+{
+	if (write(STDERR_FILENO, msg, len) < 0) {
+		// 書けなくても終了コード127で十分失敗は伝わる
+	}
+}
+
+} // namespace
+
+pid_t ProcessPosixSpawner::spawn(Method method, Params const &params)
+{
+	if (!params.argv || !params.argv[0]) {
+		errno = EINVAL;
+		return -1;
+	}
+	ProcessTrace::record(ProcessTrace::Event::Spawn, params.trace_id);
+	pid_t pid = -1;
+	if (method == Method::PosixSpawn || method == Method::Helper) {
+		pid = spawn_posix_spawn(params);
+		// posix_spawnp は exec の失敗もエラーとして親へ返す（子は作られない）。
+		// 従来どおり「終了コード 127 で終了した子」として見せるため、また
+		// posix_spawn で表現できない指定の場合も、fork 方式で起動し直す。
+	}
+	if (pid <= 0) {
+		pid = spawn_fork(params);
+	}
+	if (pid > 0) {
+		ProcessTrace::record(ProcessTrace::Event::Exec, params.trace_id, pid);
+	}
+	return pid;
+}
+
+pid_t ProcessPosixSpawner::spawn_fork(Params const &params)
+{
+	pid_t pid = fork();
+	if (pid != 0) return pid;
+
+	// fork 後の子プロセス。malloc/stdio などロック取得を伴うAPIは
+	// デッドロックの危険があるため最小限に留める。
+	if (params.tty) {
+		setsid();
+		int pty_slave = open(params.tty, O_RDWR);
+		if (pty_slave < 0) {
+			char const msg[] = "failed: open pty slave\n";
+			write_error(msg, sizeof(msg) - 1);
+			_exit(127);
+		}
+		dup2(pty_slave, STDIN_FILENO);
+		dup2(pty_slave, STDOUT_FILENO);
+		dup2(pty_slave, STDERR_FILENO);
+		if (pty_slave > STDERR_FILENO) {
+			close(pty_slave);
+		}
+	} else {
+		// 親側の端は CLOEXEC なので exec 時に閉じられる
+		move_fd(params.fd_in, STDIN_FILENO);
+		move_fd(params.fd_out, STDOUT_FILENO);
+		move_fd(params.fd_err, STDERR_FILENO);
+	}
+
+	setenv("LANG", "C", 1);
+	for (char const *const *e = params.env; e && *e; e++) {
+		if (**e) {
+			putenv(const_cast<char *>(*e));
+		}
+	}
+	if (params.change_dir && *params.change_dir) {
+		if (chdir(params.change_dir) < 0) {
+			// 従来どおり、移動できなくてもそのまま実行する
+		}
+	}
+
+	execvp(params.argv[0], params.argv);
+
+	// execvp()は成功すれば戻らない。ここに来るのは失敗した場合のみ。
+	// forkした子プロセス側なので、exit()（atexitハンドラやCライブラリの
+	// バッファを親と共有した状態でフラッシュしてしまう）ではなく_exit()を使う。
+	// またマルチスレッドの親からforkした直後はロック取得を伴うstdioが
+	// デッドロックしうるため、async-signal-safeなwrite(2)だけを使う。
+	char const msg[] = "failed: exec\n";
+	write_error(msg, sizeof(msg) - 1);
+	_exit(127);
+}
+
+pid_t ProcessPosixSpawner::spawn_posix_spawn(Params const &params)
+{
+	// 標準入出力と同じ番号の fd は adddup2 で CLOEXEC を外せる保証がない
+	if ((params.fd_in >= 0 && params.fd_in == STDIN_FILENO) || (params.fd_out >= 0 && params.fd_out == STDOUT_FILENO) || (params.fd_err >= 0 && params.fd_err == STDERR_FILENO)) {
+		errno = EINVAL;
+		return -1;
+	}
+#if !defined(POSIX_SPAWN_SETSID)
+	if (params.tty) {
+		errno = ENOTSUP;
+		return -1;
+	}
+#endif
+#if !(defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29)))
+	if (params.change_dir && *params.change_dir) {
+		errno = ENOTSUP;
+		return -1;
+	}
+#endif
+
+	// 子の環境変数は親で組み立てる (LANG=C と追加分で同名のものを置き換える)
+	char lang[] = "LANG=C";
+	std::vector<char *> extra;
+	extra.push_back(lang);
+	for (char const *const *e = params.env; e && *e; e++) {
+		if (**e) {
+			extra.push_back(const_cast<char *>(*e));
+		}
+	}
+	auto overridden = [&](char const *var) {
+		for (char const *e : extra) {
+			char const *eq = strchr(e, '=');
+			size_t n = eq ? eq - e + 1 : strlen(e);
+			if (strncmp(var, e, n) == 0 && (eq || var[n] == '=')) return true;
+		}
+		return false;
+	};
+	std::vector<char *> envp;
+	for (char **e = environ; e && *e; e++) {
+		if (overridden(*e)) continue;
+		envp.push_back(*e);
+	}
+	envp.insert(envp.end(), extra.begin(), extra.end());
+	envp.push_back(nullptr);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+	// 呼び出し元スレッドのシグナルマスクや SIGPIPE の無視設定を子へ持ち込まない
+	short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+	sigset_t mask;
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigset_t def;
+	sigemptyset(&def);
+	sigaddset(&def, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &def);
+
+	if (params.tty) {
+#ifdef POSIX_SPAWN_SETSID
+		// setsid はファイルアクションより先に行われるので、ここで開いた端末が制御端末になる
+		flags |= POSIX_SPAWN_SETSID;
+#endif
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, params.tty, O_RDWR, 0);
+		posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO, STDERR_FILENO);
+	} else {
+		if (params.fd_in >= 0) posix_spawn_file_actions_adddup2(&actions, params.fd_in, STDIN_FILENO);
+		if (params.fd_out >= 0) posix_spawn_file_actions_adddup2(&actions, params.fd_out, STDOUT_FILENO);
+		if (params.fd_err >= 0) posix_spawn_file_actions_adddup2(&actions, params.fd_err, STDERR_FILENO);
+	}
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+	if (params.change_dir && *params.change_dir) {
+		posix_spawn_file_actions_addchdir_np(&actions, params.change_dir);
+	}
+#endif
+	posix_spawnattr_setflags(&attr, flags);
+
+	pid_t pid = -1;
+	int r = posix_spawnp(&pid, params.argv[0], &actions, &attr, params.argv, envp.data());
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (r != 0) {
+		errno = r;
+		return -1;
+	}
+	return pid;
+}
+
+void ProcessPosixSpawner::make_usage(struct rusage const &ru, double wall_seconds, ProcessUsage *out)
+{
+	*out = ProcessUsage();
+	out->valid = true;
+	out->wall_seconds = wall_seconds;
+	out->user_cpu_seconds = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+	out->system_cpu_seconds = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+#ifdef __APPLE__
+	out->max_rss_bytes = (uint64_t)ru.ru_maxrss; // macOS はバイト単位
+#else
+	out->max_rss_bytes = (uint64_t)ru.ru_maxrss * 1024; // Linux は KB 単位
+#endif
+	out->minor_faults = (uint64_t)ru.ru_minflt;
+	out->major_faults = (uint64_t)ru.ru_majflt;
+	out->voluntary_context_switches = (uint64_t)ru.ru_nvcsw;
+	out->involuntary_context_switches = (uint64_t)ru.ru_nivcsw;
+}
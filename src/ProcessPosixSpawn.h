@@ -0,0 +1,45 @@
+#ifndef PROCESSPOSIXSPAWN_H
+#define PROCESSPOSIXSPAWN_H
+
+#include <cstdint>
+#include <sys/types.h>
+
+struct ProcessUsage;
+struct rusage;
+
+// ProcessPosix / ProcessPosixPty 共通の子プロセス起動処理。
+class ProcessPosixSpawner {
+public:
+	enum class Method {
+		Fork, // fork() + execvp()。親のページテーブルを複製するので、親のRSSに比例して遅くなる
+		PosixSpawn, // posix_spawnp()。glibc では clone(CLONE_VM|CLONE_VFORK) で起動するため親の大きさに依存しない
+		Helper, // 常駐ヘルパー (ProcessSpawnHelper) に起動させる。ProcessPosix 専用で、それ以外では PosixSpawn と同じ
+	};
+
+	struct Params {
+		char *const *argv = nullptr;
+		// 子の stdin/stdout/stderr に割り当てる fd (-1 なら親から継承したまま)
+		int fd_in = -1;
+		int fd_out = -1;
+		int fd_err = -1;
+		// 指定した場合は setsid() した上でこの端末を開き、制御端末兼 stdin/stdout/stderr にする
+		char const *tty = nullptr;
+		char const *change_dir = nullptr;
+		char const *const *env = nullptr; // 追加の環境変数 "NAME=value" の配列 (nullptr 終端)
+		uint64_t trace_id = 0; // ProcessTrace に記録する Spawn/Exec の ID
+	};
+
+	// 子の pid を返す。失敗時は -1 を返し errno を設定する。
+	// どちらの方式でも子の環境には LANG=C が設定され、exec に失敗した子は
+	// "failed: exec" を stderr へ出力して終了コード 127 で終了する。
+	static pid_t spawn(Method method, Params const &params);
+
+	// 回収時の rusage と、起動から回収までの秒数から ProcessUsage を作る
+	static void make_usage(struct rusage const &ru, double wall_seconds, ProcessUsage *out);
+
+private:
+	static pid_t spawn_fork(Params const &params);
+	static pid_t spawn_posix_spawn(Params const &params);
+};
+
+#endif // PROCESSPOSIXSPAWN_H
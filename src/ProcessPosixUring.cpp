@@ -0,0 +1,273 @@
+#include "ProcessPosixUring.h"
+
+#ifdef PROCESS_POSIX_HAVE_IO_URING
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+int sys_io_uring_setup(unsigned entries, io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+} // namespace
+
+ProcessPosixUring::~ProcessPosixUring()
+{
+	release();
+}
+
+void ProcessPosixUring::release()
+{
+	if (buffers_) {
+		munmap(buffers_, size_t(BUFFER_COUNT) * BUFFER_SIZE);
+		buffers_ = nullptr;
+	}
+	if (sqes_) {
+		munmap(sqes_, sqes_size_);
+		sqes_ = nullptr;
+	}
+	if (cq_ring_ && cq_ring_ != sq_ring_) {
+		munmap(cq_ring_, cq_ring_size_);
+	}
+	cq_ring_ = nullptr;
+	if (sq_ring_) {
+		munmap(sq_ring_, sq_ring_size_);
+		sq_ring_ = nullptr;
+	}
+	if (ring_fd_ >= 0) {
+		close(ring_fd_);
+		ring_fd_ = -1;
+	}
+}
+
+bool ProcessPosixUring::init(unsigned entries)
+{
+	io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * 4;
+	int fd = sys_io_uring_setup(entries, &p);
+	if (fd < 0) return false; // 古いカーネル、seccomp、io_uring_disabled など
+	ring_fd_ = fd;
+
+	// タイムアウト付きの待機 (EXT_ARG) と、CQ が溢れても完了を落とさないこと (NODROP) が前提
+	unsigned const required = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+	if ((p.features & required) != required) {
+		release();
+		return false;
+	}
+
+	sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (single_mmap) {
+		if (cq_ring_size_ > sq_ring_size_) sq_ring_size_ = cq_ring_size_;
+		cq_ring_size_ = sq_ring_size_;
+	}
+	void *sq = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED) {
+		release();
+		return false;
+	}
+	sq_ring_ = sq;
+	if (single_mmap) {
+		cq_ring_ = sq_ring_;
+	} else {
+		void *cq = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED) {
+			release();
+			return false;
+		}
+		cq_ring_ = cq;
+	}
+	sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		release();
+		return false;
+	}
+	sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+	char *sqp = static_cast<char *>(sq_ring_);
+	sq_head_ = reinterpret_cast<unsigned *>(sqp + p.sq_off.head);
+	sq_tail_ = reinterpret_cast<unsigned *>(sqp + p.sq_off.tail);
+	sq_mask_ = reinterpret_cast<unsigned *>(sqp + p.sq_off.ring_mask);
+	sq_array_ = reinterpret_cast<unsigned *>(sqp + p.sq_off.array);
+	sq_entries_ = p.sq_entries;
+	char *cqp = static_cast<char *>(cq_ring_);
+	cq_head_ = reinterpret_cast<unsigned *>(cqp + p.cq_off.head);
+	cq_tail_ = reinterpret_cast<unsigned *>(cqp + p.cq_off.tail);
+	cq_mask_ = reinterpret_cast<unsigned *>(cqp + p.cq_off.ring_mask);
+	cqes_ = reinterpret_cast<io_uring_cqe *>(cqp + p.cq_off.cqes);
+
+	if (!probe()) {
+		release();
+		return false;
+	}
+
+	void *buffers = mmap(nullptr, size_t(BUFFER_COUNT) * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffers == MAP_FAILED) {
+		release();
+		return false;
+	}
+	buffers_ = static_cast<char *>(buffers);
+
+	// バッファプールをまとめて渡し、受け付けられたことを確かめる
+	io_uring_sqe *sqe = get_sqe();
+	sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd = BUFFER_COUNT;
+	sqe->addr = reinterpret_cast<uint64_t>(buffers_);
+	sqe->len = BUFFER_SIZE;
+	sqe->off = 0;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->user_data = 0;
+	if (submit_and_wait(-1) < 0) {
+		release();
+		return false;
+	}
+	bool ok = false;
+	for_each_cqe([&](io_uring_cqe const &cqe) {
+		if (cqe.user_data == 0 && cqe.res >= 0) ok = true;
+	});
+	if (!ok) {
+		release();
+		return false;
+	}
+	return true;
+}
+
+// 使う命令がすべてサポートされているか
+bool ProcessPosixUring::probe()
+{
+	size_t size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+	char storage[sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)];
+	memset(storage, 0, size);
+	io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(storage);
+	if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PROBE, probe, 256) < 0) return false;
+	unsigned const ops[] = {
+		IORING_OP_READ,
+		IORING_OP_POLL_ADD,
+		IORING_OP_ASYNC_CANCEL,
+		IORING_OP_PROVIDE_BUFFERS,
+	};
+	for (unsigned op : ops) {
+		if (op > probe->last_op) return false;
+		if (!(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+	}
+	return true;
+}
+
+int ProcessPosixUring::enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+	int r = sys_io_uring_enter(ring_fd_, to_submit, min_complete, flags, arg, argsz);
+	if (r < 0) return -errno;
+	return r;
+}
+
+io_uring_sqe *ProcessPosixUring::get_sqe()
+{
+	unsigned tail = *sq_tail_;
+	if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+		// SQ が一杯。待たずに submit だけして空ける
+		while (to_submit_ > 0) {
+			int r = enter(to_submit_, 0, 0, nullptr, 0);
+			if (r == -EINTR) continue;
+			if (r < 0) break;
+			to_submit_ -= (unsigned)r;
+		}
+	}
+	unsigned index = tail & *sq_mask_;
+	io_uring_sqe *sqe = &sqes_[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sq_array_[index] = index;
+	__atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+	to_submit_++;
+	return sqe;
+}
+
+void ProcessPosixUring::prep_read(int fd, uint64_t user_data)
+{
+	io_uring_sqe *sqe = get_sqe();
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->len = BUFFER_SIZE;
+	sqe->off = (uint64_t)-1; // パイプ/PTY なので現在位置から
+	sqe->user_data = user_data;
+}
+
+void ProcessPosixUring::prep_poll(int fd, unsigned events, uint64_t user_data)
+{
+	io_uring_sqe *sqe = get_sqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = user_data;
+}
+
+void ProcessPosixUring::prep_cancel(uint64_t target)
+{
+	io_uring_sqe *sqe = get_sqe();
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = 0;
+}
+
+void ProcessPosixUring::provide_buffer(unsigned bid)
+{
+	io_uring_sqe *sqe = get_sqe();
+	sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd = 1;
+	sqe->addr = reinterpret_cast<uint64_t>(buffer(bid));
+	sqe->len = BUFFER_SIZE;
+	sqe->off = bid;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->user_data = 0;
+}
+
+int ProcessPosixUring::submit_and_wait(int timeout_ms)
+{
+	io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	__kernel_timespec ts;
+	if (timeout_ms >= 0) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+	}
+	while (1) {
+		int r = enter(to_submit_, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+		if (r >= 0) {
+			to_submit_ -= (unsigned)r;
+			return r;
+		}
+		if (r == -ETIME) return 0;
+		if (r == -EINTR) return 0; // 呼び出し側のループでタイマーを見直す
+		if (r == -EBUSY || r == -EAGAIN) {
+			// CQ が溢れている。まず刈り取ってもらう
+			return 0;
+		}
+		return r;
+	}
+}
+
+#endif // PROCESS_POSIX_HAVE_IO_URING
@@ -0,0 +1,93 @@
+#ifndef PROCESSPOSIXURING_H
+#define PROCESSPOSIXURING_H
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define PROCESS_POSIX_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef PROCESS_POSIX_HAVE_IO_URING
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+// ProcessPosixReactor の io_uring バックエンド用の最小限のリングラッパー。
+// liburing には依存せず、io_uring_setup/io_uring_enter/io_uring_register を直接呼ぶ。
+// 読み取りはカーネルに渡した共有バッファプール (IOSQE_BUFFER_SELECT) へ行うので、
+// 監視している fd の数に関係なくバッファは BUFFER_COUNT 個で済む。
+// リアクタスレッドからのみ使うこと。
+class ProcessPosixUring {
+public:
+	static constexpr unsigned BUFFER_GROUP = 1;
+	static constexpr unsigned BUFFER_COUNT = 32;
+	static constexpr unsigned BUFFER_SIZE = 65536; // epoll 版の読み取りバッファと同じ
+
+private:
+	int ring_fd_ = -1;
+	void *sq_ring_ = nullptr;
+	size_t sq_ring_size_ = 0;
+	void *cq_ring_ = nullptr;
+	size_t cq_ring_size_ = 0;
+	io_uring_sqe *sqes_ = nullptr;
+	size_t sqes_size_ = 0;
+
+	unsigned *sq_head_ = nullptr;
+	unsigned *sq_tail_ = nullptr;
+	unsigned *sq_mask_ = nullptr;
+	unsigned *sq_array_ = nullptr;
+	unsigned sq_entries_ = 0;
+	unsigned *cq_head_ = nullptr;
+	unsigned *cq_tail_ = nullptr;
+	unsigned *cq_mask_ = nullptr;
+	io_uring_cqe *cqes_ = nullptr;
+
+	unsigned to_submit_ = 0;
+	char *buffers_ = nullptr;
+
+	bool probe();
+	int enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz);
+	void release();
+
+public:
+	ProcessPosixUring() = default;
+	~ProcessPosixUring();
+	ProcessPosixUring(ProcessPosixUring const &) = delete;
+	ProcessPosixUring &operator=(ProcessPosixUring const &) = delete;
+
+	// リングを作りバッファプールを登録する。必要な機能が無いカーネルでは false
+	bool init(unsigned entries);
+
+	// 空き SQE を返す (ゼロクリア済み)。SQ が一杯なら先に submit する
+	io_uring_sqe *get_sqe();
+
+	void prep_read(int fd, uint64_t user_data); // バッファプールから読む
+	void prep_poll(int fd, unsigned events, uint64_t user_data); // ワンショット
+	void prep_cancel(uint64_t target);
+	void provide_buffer(unsigned bid); // 読み終えたバッファをプールへ返す
+
+	char *buffer(unsigned bid)
+	{
+		return buffers_ + size_t(bid) * BUFFER_SIZE;
+	}
+
+	// 溜まった SQE を submit し、完了が1つ以上届くか timeout_ms が経つまで待つ (-1 = 無期限)
+	int submit_and_wait(int timeout_ms);
+
+	// 届いている CQE を順に fn(io_uring_cqe const &) へ渡す。fn の中で SQE を積んでもよい
+	template <typename F> void for_each_cqe(F fn)
+	{
+		unsigned head = *cq_head_;
+		while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+			io_uring_cqe cqe = cqes_[head & *cq_mask_];
+			head++;
+			__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+			fn(cqe);
+		}
+	}
+};
+
+#endif // PROCESS_POSIX_HAVE_IO_URING
+
+#endif // PROCESSPOSIXURING_H
@@ -0,0 +1,648 @@
+#include "ProcessSpawnHelper.h"
+#include "ProcessPosixReactor.h"
+#include "ProcessPosixSpawn.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+struct FrameHeader {
+	uint32_t type;
+	uint32_t id;
+	uint32_t size;
+};
+
+size_t const MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+void put_u32(std::string *out, uint32_t v)
+{
+	out->append(reinterpret_cast<char const *>(&v), sizeof(v));
+}
+
+void put_str(std::string *out, std::string const &s)
+{
+	put_u32(out, static_cast<uint32_t>(s.size()));
+	out->append(s);
+}
+
+bool get_u32(char const **ptr, char const *end, uint32_t *v)
+{
+	if (end - *ptr < (ptrdiff_t)sizeof(uint32_t)) return false;
+	memcpy(v, *ptr, sizeof(uint32_t));
+	*ptr += sizeof(uint32_t);
+	return true;
+}
+
+bool get_str(char const **ptr, char const *end, std::string *s)
+{
+	uint32_t n;
+	if (!get_u32(ptr, end, &n)) return false;
+	if ((size_t)(end - *ptr) < n) return false;
+	s->assign(*ptr, n);
+	*ptr += n;
+	return true;
+}
+
+void set_cloexec(int fd)
+{
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD, 0) | FD_CLOEXEC);
+}
+
+void set_nonblock(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+int open_pipe(int fds[2])
+{
+#ifdef __linux__
+	return pipe2(fds, O_CLOEXEC);
+#else
+	if (pipe(fds) < 0) return -1;
+	set_cloexec(fds[0]);
+	set_cloexec(fds[1]);
+	return 0;
+#endif
+}
+
+// ヘルパー側 (fork 後の別プロセス) でのみ使う
+
+int g_helper_sigchld_pipe[2] = { -1, -1 };
+
+void helper_sigchld_handler(int)
+{
+	int saved = errno;
+	char c = 0;
+	if (write(g_helper_sigchld_pipe[1], &c, 1) < 0) {
+		// パイプが一杯なら既に起床が予約されている
+	}
+	errno = saved;
+}
+
+// ホストから継承した fd を閉じる。ホストのパイプの書き込み端などをヘルパーが
+// 握ったままだと、ホスト側で EOF を検出できなくなる。
+void close_fds_from(int lowfd)
+{
+#if defined(__linux__) && defined(SYS_close_range)
+	if (syscall(SYS_close_range, lowfd, ~0U, 0) == 0) return;
+#endif
+	long maxfd = sysconf(_SC_OPEN_MAX);
+	if (maxfd < 0 || maxfd > 65536) maxfd = 65536;
+	for (int fd = lowfd; fd < maxfd; fd++) {
+		close(fd);
+	}
+}
+
+bool write_all(int fd, char const *ptr, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, ptr, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		ptr += n;
+		len -= n;
+	}
+	return true;
+}
+
+void helper_send(int fd, uint32_t type, uint32_t id, char const *ptr, size_t len)
+{
+	FrameHeader h = { type, id, static_cast<uint32_t>(len) };
+	std::string frame(reinterpret_cast<char const *>(&h), sizeof(h));
+	frame.append(ptr, len);
+	if (!write_all(fd, frame.data(), frame.size())) {
+		// ホストがいなくなった
+		_exit(0);
+	}
+}
+
+// 回収できた子は、status に続けて wait4() の rusage を送る
+void helper_send_exit(int fd, uint32_t id, int32_t status, struct rusage const *usage)
+{
+	char payload[sizeof(int32_t) + sizeof(struct rusage)];
+	memcpy(payload, &status, sizeof(status));
+	size_t len = sizeof(status);
+	if (usage) {
+		memcpy(payload + len, usage, sizeof(*usage));
+		len += sizeof(*usage);
+	}
+	helper_send(fd, ProcessSpawnHelper::Exit, id, payload, len);
+}
+
+} // namespace
+
+struct ProcessSpawnHelper::Private {
+	std::mutex mutex;
+	int fd = -1;
+	pid_t helper_pid = 0;
+	uint32_t next_id = 1;
+	std::map<uint32_t, Callbacks> sessions;
+	std::string outbuf; // 送信待ち
+	bool flush_posted = false;
+	std::string inbuf; // リアクタスレッドからのみ触る
+};
+
+ProcessSpawnHelper::ProcessSpawnHelper()
+	: m(new Private)
+{
+}
+
+ProcessSpawnHelper::~ProcessSpawnHelper()
+{
+	// instance() はプロセス終了まで破棄しない
+	delete m;
+}
+
+ProcessSpawnHelper &ProcessSpawnHelper::instance()
+{
+	static ProcessSpawnHelper *helper = new ProcessSpawnHelper;
+	return *helper;
+}
+
+bool ProcessSpawnHelper::launch()
+{
+	return instance().ensure_launched();
+}
+
+bool ProcessSpawnHelper::ensure_launched()
+{
+	std::lock_guard<std::mutex> lock(m->mutex);
+	if (m->fd >= 0) return true;
+
+	int sv[2];
+#ifdef SOCK_CLOEXEC
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return false;
+#else
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) return false;
+	set_cloexec(sv[0]);
+	set_cloexec(sv[1]);
+#endif
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(sv[0]);
+		run_helper(sv[1]);
+	}
+	close(sv[1]);
+	m->fd = sv[0];
+	set_nonblock(m->fd); // flush() はリアクタスレッドで書くので、詰まっても待たない
+	m->helper_pid = pid;
+
+	// リアクタはスレッドを持つので、ヘルパーを fork した後に初めて触る
+	ProcessPosixReactor &reactor = ProcessPosixReactor::instance();
+	reactor.add_reader(
+		m->fd,
+		[this](char const *ptr, size_t len) {
+			on_data(ptr, len);
+		},
+		[this](int) {
+			on_closed();
+		});
+	reactor.watch_child(pid, [](int, struct rusage const &) { });
+	return true;
+}
+
+void ProcessSpawnHelper::send(uint32_t type, uint32_t id, char const *ptr, size_t len)
+{
+	std::lock_guard<std::mutex> lock(m->mutex);
+	if (m->fd < 0) return;
+	FrameHeader h = { type, id, static_cast<uint32_t>(len) };
+	m->outbuf.append(reinterpret_cast<char const *>(&h), sizeof(h));
+	m->outbuf.append(ptr, len);
+	if (!m->flush_posted) {
+		m->flush_posted = true;
+		ProcessPosixReactor::instance().post([this]() {
+			flush();
+		});
+	}
+}
+
+void ProcessSpawnHelper::flush()
+{
+	std::lock_guard<std::mutex> lock(m->mutex);
+	m->flush_posted = false;
+	size_t pos = 0;
+	while (m->fd >= 0 && pos < m->outbuf.size()) {
+		ssize_t n = write(m->fd, m->outbuf.data() + pos, m->outbuf.size() - pos);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				ProcessPosixReactor::instance().watch_writable(m->fd, [this]() {
+					flush();
+				});
+			}
+			break;
+		}
+		pos += n;
+	}
+	m->outbuf.erase(0, pos);
+}
+
+void ProcessSpawnHelper::on_data(char const *ptr, size_t len)
+{
+	m->inbuf.append(ptr, len);
+	size_t pos = 0;
+	while (m->inbuf.size() - pos >= sizeof(FrameHeader)) {
+		FrameHeader h;
+		memcpy(&h, m->inbuf.data() + pos, sizeof(h));
+		if (m->inbuf.size() - pos - sizeof(h) < h.size) break;
+		char const *payload = m->inbuf.data() + pos + sizeof(h);
+
+		Callbacks cb;
+		{
+			std::lock_guard<std::mutex> lock(m->mutex);
+			auto it = m->sessions.find(h.id);
+			if (it != m->sessions.end()) {
+				if (h.type == Exit) {
+					cb = std::move(it->second);
+					m->sessions.erase(it);
+				} else {
+					cb = it->second;
+				}
+			}
+		}
+		if (h.type == Stdout && cb.on_stdout) {
+			cb.on_stdout(payload, h.size);
+		} else if (h.type == Stderr && cb.on_stderr) {
+			cb.on_stderr(payload, h.size);
+		} else if (h.type == Exit && cb.on_exit) {
+			int32_t status = -1;
+			struct rusage usage;
+			memset(&usage, 0, sizeof(usage));
+			if (h.size >= sizeof(status)) {
+				memcpy(&status, payload, sizeof(status));
+			}
+			if (h.size >= sizeof(status) + sizeof(usage)) {
+				memcpy(&usage, payload + sizeof(status), sizeof(usage));
+			}
+			cb.on_exit(status, usage);
+		}
+		pos += sizeof(h) + h.size;
+	}
+	m->inbuf.erase(0, pos);
+}
+
+void ProcessSpawnHelper::on_closed()
+{
+	// ヘルパーが終了した。実行中だったセッションは全て失敗として終わらせ、
+	// 次の spawn() で改めて起動する。
+	std::map<uint32_t, Callbacks> sessions;
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		if (m->fd >= 0) {
+			ProcessPosixReactor::instance().unwatch_writable(m->fd);
+			close(m->fd);
+			m->fd = -1;
+		}
+		m->helper_pid = 0;
+		m->outbuf.clear();
+		sessions.swap(m->sessions);
+	}
+	m->inbuf.clear();
+	struct rusage usage;
+	memset(&usage, 0, sizeof(usage));
+	for (auto &pair : sessions) {
+		if (pair.second.on_exit) {
+			pair.second.on_exit(-1, usage);
+		}
+	}
+}
+
+uint32_t ProcessSpawnHelper::spawn(Request const &req, Callbacks const &callbacks)
+{
+	if (req.argv.empty()) return 0;
+	if (!ensure_launched()) return 0;
+	std::string payload = encode_spawn(req);
+	if (payload.size() > MAX_FRAME_SIZE) return 0;
+	uint32_t id;
+	{
+		std::lock_guard<std::mutex> lock(m->mutex);
+		id = m->next_id++;
+		if (id == 0) id = m->next_id++;
+		m->sessions[id] = callbacks;
+	}
+	send(Spawn, id, payload.data(), payload.size());
+	return id;
+}
+
+void ProcessSpawnHelper::write_stdin(uint32_t id, char const *ptr, size_t len)
+{
+	while (len > 0) {
+		size_t n = std::min(len, MAX_FRAME_SIZE);
+		send(Stdin, id, ptr, n);
+		ptr += n;
+		len -= n;
+	}
+}
+
+void ProcessSpawnHelper::close_stdin(uint32_t id, bool justnow)
+{
+	char now = justnow ? 1 : 0;
+	send(CloseStdin, id, &now, 1);
+}
+
+void ProcessSpawnHelper::kill(uint32_t id, int sig)
+{
+	uint32_t v = static_cast<uint32_t>(sig);
+	send(Kill, id, reinterpret_cast<char const *>(&v), sizeof(v));
+}
+
+std::string ProcessSpawnHelper::encode_spawn(Request const &req)
+{
+	std::string out;
+	put_u32(&out, static_cast<uint32_t>(req.argv.size()));
+	for (std::string const &s : req.argv) {
+		put_str(&out, s);
+	}
+	put_u32(&out, static_cast<uint32_t>(req.env.size()));
+	for (std::string const &s : req.env) {
+		put_str(&out, s);
+	}
+	put_str(&out, req.change_dir);
+	return out;
+}
+
+bool ProcessSpawnHelper::decode_spawn(char const *ptr, size_t len, Request *out)
+{
+	char const *end = ptr + len;
+	uint32_t n;
+	if (!get_u32(&ptr, end, &n)) return false;
+	out->argv.resize(n);
+	for (std::string &s : out->argv) {
+		if (!get_str(&ptr, end, &s)) return false;
+	}
+	if (!get_u32(&ptr, end, &n)) return false;
+	out->env.resize(n);
+	for (std::string &s : out->env) {
+		if (!get_str(&ptr, end, &s)) return false;
+	}
+	return get_str(&ptr, end, &out->change_dir) && !out->argv.empty();
+}
+
+void ProcessSpawnHelper::run_helper(int fd)
+{
+	// 制御用ソケットを 3 番に置き、それ以外にホストから継承した fd は全て閉じる
+	if (fd != 3) {
+		dup2(fd, 3);
+		fd = 3;
+	}
+	close_fds_from(4);
+	set_cloexec(fd);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+
+	signal(SIGPIPE, SIG_IGN);
+	if (open_pipe(g_helper_sigchld_pipe) < 0) _exit(1);
+	set_nonblock(g_helper_sigchld_pipe[0]);
+	set_nonblock(g_helper_sigchld_pipe[1]);
+	{
+		struct sigaction sa = { };
+		sa.sa_handler = helper_sigchld_handler;
+		sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+		sigemptyset(&sa.sa_mask);
+		sigaction(SIGCHLD, &sa, nullptr);
+	}
+
+	struct Child {
+		pid_t pid = 0;
+		int fd_in = -1;
+		int fd_out = -1;
+		int fd_err = -1;
+		std::string inq;
+		bool close_input_later = false;
+		bool exited = false;
+		int status = -1;
+		struct rusage usage = { };
+	};
+	std::map<uint32_t, Child> children;
+	std::string inbuf;
+	static char buf[65536];
+
+	auto close_input = [](Child &c) {
+		if (c.fd_in >= 0) {
+			close(c.fd_in);
+			c.fd_in = -1;
+		}
+		c.inq.clear();
+	};
+
+	auto flush_input = [&](Child &c) {
+		while (c.fd_in >= 0 && !c.inq.empty()) {
+			ssize_t n = write(c.fd_in, c.inq.data(), c.inq.size());
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+				close_input(c); // 子が stdin を閉じた
+				return;
+			}
+			c.inq.erase(0, n);
+		}
+		if (c.inq.empty() && c.close_input_later) {
+			close_input(c);
+		}
+	};
+
+	auto start_child = [&](uint32_t id, Request const &req) {
+		int stdin_pipe[2] = { -1, -1 };
+		int stdout_pipe[2] = { -1, -1 };
+		int stderr_pipe[2] = { -1, -1 };
+		int32_t status = -1;
+		if (open_pipe(stdin_pipe) == 0 && open_pipe(stdout_pipe) == 0 && open_pipe(stderr_pipe) == 0) {
+			std::vector<char *> argv;
+			for (std::string const &s : req.argv) {
+				argv.push_back(const_cast<char *>(s.c_str()));
+			}
+			argv.push_back(nullptr);
+			std::vector<char const *> env;
+			for (std::string const &s : req.env) {
+				env.push_back(s.c_str());
+			}
+			env.push_back(nullptr);
+			ProcessPosixSpawner::Params params;
+			params.argv = argv.data();
+			params.fd_in = stdin_pipe[0];
+			params.fd_out = stdout_pipe[1];
+			params.fd_err = stderr_pipe[1];
+			params.change_dir = req.change_dir.c_str();
+			params.env = env.data();
+			// ヘルパー自身は小さいので fork でもよいが、SIGPIPE の無視設定を子へ持ち込まないよう posix_spawn を使う
+			pid_t pid = ProcessPosixSpawner::spawn(ProcessPosixSpawner::Method::PosixSpawn, params);
+			if (pid > 0) {
+				close(stdin_pipe[0]);
+				close(stdout_pipe[1]);
+				close(stderr_pipe[1]);
+				Child &c = children[id];
+				c.pid = pid;
+				c.fd_in = stdin_pipe[1];
+				c.fd_out = stdout_pipe[0];
+				c.fd_err = stderr_pipe[0];
+				set_nonblock(c.fd_in);
+				return;
+			}
+		}
+		for (int f : { stdin_pipe[0], stdin_pipe[1], stdout_pipe[0], stdout_pipe[1], stderr_pipe[0], stderr_pipe[1] }) {
+			if (f >= 0) close(f);
+		}
+		char const msg[] = "failed: fork\n";
+		helper_send(fd, Stderr, id, msg, sizeof(msg) - 1);
+		helper_send_exit(fd, id, status, nullptr);
+	};
+
+	auto handle_frame = [&](FrameHeader const &h, char const *payload) {
+		if (h.type == Spawn) {
+			Request req;
+			if (decode_spawn(payload, h.size, &req)) {
+				start_child(h.id, req);
+			} else {
+				helper_send_exit(fd, h.id, -1, nullptr);
+			}
+			return;
+		}
+		auto it = children.find(h.id);
+		if (it == children.end()) return;
+		Child &c = it->second;
+		if (h.type == Stdin) {
+			if (c.fd_in >= 0) {
+				c.inq.append(payload, h.size);
+				flush_input(c);
+			}
+		} else if (h.type == CloseStdin) {
+			if (h.size > 0 && payload[0]) {
+				close_input(c);
+			} else {
+				c.close_input_later = true;
+				flush_input(c);
+			}
+		} else if (h.type == Kill) {
+			uint32_t sig = 0;
+			if (h.size >= sizeof(sig)) {
+				memcpy(&sig, payload, sizeof(sig));
+			}
+			if (!c.exited && c.pid > 0) {
+				::kill(c.pid, static_cast<int>(sig));
+			}
+		}
+	};
+
+	while (1) {
+		std::vector<pollfd> fds;
+		std::vector<std::pair<uint32_t, int>> owners; // fds[i] に対応する (id, 0=in 1=out 2=err)
+		fds.push_back({ fd, POLLIN, 0 });
+		owners.push_back({ 0, -1 });
+		fds.push_back({ g_helper_sigchld_pipe[0], POLLIN, 0 });
+		owners.push_back({ 0, -1 });
+		for (auto &pair : children) {
+			Child &c = pair.second;
+			if (c.fd_in >= 0 && !c.inq.empty()) {
+				fds.push_back({ c.fd_in, POLLOUT, 0 });
+				owners.push_back({ pair.first, 0 });
+			}
+			if (c.fd_out >= 0) {
+				fds.push_back({ c.fd_out, POLLIN, 0 });
+				owners.push_back({ pair.first, 1 });
+			}
+			if (c.fd_err >= 0) {
+				fds.push_back({ c.fd_err, POLLIN, 0 });
+				owners.push_back({ pair.first, 2 });
+			}
+		}
+		int r = poll(fds.data(), fds.size(), -1);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		for (size_t i = 2; i < fds.size(); i++) {
+			if (!fds[i].revents) continue;
+			auto it = children.find(owners[i].first);
+			if (it == children.end()) continue;
+			Child &c = it->second;
+			int which = owners[i].second;
+			if (which == 0) {
+				flush_input(c);
+				continue;
+			}
+			int &cfd = which == 1 ? c.fd_out : c.fd_err;
+			if (cfd < 0) continue;
+			ssize_t n = read(cfd, buf, sizeof(buf));
+			if (n > 0) {
+				helper_send(fd, which == 1 ? Stdout : Stderr, it->first, buf, n);
+			} else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+				close(cfd);
+				cfd = -1;
+			}
+		}
+
+		if (fds[1].revents) {
+			while (read(g_helper_sigchld_pipe[0], buf, sizeof(buf)) > 0) { }
+			for (auto &pair : children) {
+				Child &c = pair.second;
+				if (c.exited) continue;
+				int status = 0;
+				pid_t w = wait4(c.pid, &status, WNOHANG, &c.usage);
+				if (w == c.pid || (w < 0 && errno == ECHILD)) {
+					c.exited = true;
+					c.status = w < 0 ? -1 : status;
+				}
+			}
+		}
+
+		if (fds[0].revents) {
+			ssize_t n = read(fd, buf, sizeof(buf));
+			if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+				// ホストが終了した。残っている子には終了を促して抜ける
+				for (auto &pair : children) {
+					if (!pair.second.exited) {
+						::kill(pair.second.pid, SIGTERM);
+					}
+				}
+				_exit(0);
+			}
+			if (n > 0) {
+				inbuf.append(buf, n);
+				size_t pos = 0;
+				while (inbuf.size() - pos >= sizeof(FrameHeader)) {
+					FrameHeader h;
+					memcpy(&h, inbuf.data() + pos, sizeof(h));
+					if (h.size > MAX_FRAME_SIZE) _exit(1); // プロトコル違反
+					if (inbuf.size() - pos - sizeof(h) < h.size) break;
+					handle_frame(h, inbuf.data() + pos + sizeof(h));
+					pos += sizeof(h) + h.size;
+				}
+				inbuf.erase(0, pos);
+			}
+		}
+
+		// 出力を読み切り、回収も済んだ子の終了を通知する
+		for (auto it = children.begin(); it != children.end();) {
+			Child &c = it->second;
+			if (c.exited && c.fd_out < 0 && c.fd_err < 0) {
+				helper_send_exit(fd, it->first, c.status, c.status < 0 ? nullptr : &c.usage);
+				close_input(c);
+				it = children.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	_exit(0);
+}
@@ -0,0 +1,81 @@
+#ifndef PROCESSSPAWNHELPER_H
+#define PROCESSSPAWNHELPER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct rusage;
+
+// 常駐する小さな起動専用プロセス (spawn helper) のクライアント。
+// 巨大なホストプロセスが子を起動するたびに fork するのを避けるため、起動直後の
+// まだ小さいうちに一度だけ fork したヘルパーへ、フレーム化したバイナリプロトコルで
+// 起動要求 (argv, env, cwd, stdin) を送り、stdout/stderr/終了をタグ付きフレームで
+// 受け取る。1本の接続上で多数の子を同時に扱える。
+//
+// フレーム: [type:u32][id:u32][size:u32][payload:size] (同一マシン内なのでネイティブエンディアン)
+class ProcessSpawnHelper {
+public:
+	enum FrameType : uint32_t {
+		// クライアント → ヘルパー
+		Spawn = 1, // payload: argv, env, cwd (encode_spawn() 参照)
+		Stdin = 2, // payload: 子の stdin へ書き込むデータ
+		CloseStdin = 3, // payload: u8 (1 = 未送信分を捨てて即座に閉じる, 0 = 書き切ってから閉じる)
+		Kill = 4, // payload: u32 シグナル番号
+		// ヘルパー → クライアント
+		Stdout = 16,
+		Stderr = 17,
+		Exit = 18, // payload: i32 wait4 の status (-1 = 起動失敗/回収不能)、回収できた場合は続けて struct rusage
+	};
+
+	struct Request {
+		std::vector<std::string> argv;
+		std::vector<std::string> env; // 追加の環境変数 "NAME=value"
+		std::string change_dir;
+	};
+
+	// リアクタスレッド上で呼ばれる。on_exit の後は同じ id のコールバックは呼ばれない。
+	struct Callbacks {
+		std::function<void(char const *ptr, size_t len)> on_stdout;
+		std::function<void(char const *ptr, size_t len)> on_stderr;
+		// usage は回収できなかった場合は 0 で埋めてある
+		std::function<void(int status, struct rusage const &usage)> on_exit;
+	};
+
+private:
+	struct Private;
+	Private *m;
+
+	ProcessSpawnHelper();
+	~ProcessSpawnHelper();
+	bool ensure_launched();
+	void send(uint32_t type, uint32_t id, char const *ptr, size_t len);
+	void flush();
+	void on_data(char const *ptr, size_t len);
+	void on_closed();
+
+	static std::string encode_spawn(Request const &req);
+	static bool decode_spawn(char const *ptr, size_t len, Request *out);
+	[[noreturn]] static void run_helper(int fd);
+
+public:
+	ProcessSpawnHelper(ProcessSpawnHelper const &) = delete;
+	ProcessSpawnHelper &operator=(ProcessSpawnHelper const &) = delete;
+
+	static ProcessSpawnHelper &instance();
+
+	// ヘルパーを起動する。ホストのメモリが小さく、スレッドもまだ無いプログラム開始直後に
+	// 呼んでおくこと。呼ばなかった場合は最初の spawn() の時点で起動する。
+	static bool launch();
+
+	// 起動要求を送り、セッションIDを返す (0 = ヘルパーを起動できなかった)。
+	// exec の失敗は従来どおり終了コード 127 と "failed: exec" (stderr) で通知される。
+	uint32_t spawn(Request const &req, Callbacks const &callbacks);
+	void write_stdin(uint32_t id, char const *ptr, size_t len);
+	void close_stdin(uint32_t id, bool justnow);
+	void kill(uint32_t id, int sig);
+};
+
+#endif // PROCESSSPAWNHELPER_H
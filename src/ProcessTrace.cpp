@@ -0,0 +1,431 @@
+#include "ProcessTrace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+// リングの1要素。書き込みは所有するスレッドだけが行い、export 側は seq の前後比較で
+// 書き込み途中や上書きされた要素を読み捨てる (seqlock)。
+// 読み手と並行して書かれるので、フィールドも relaxed の atomic にしておく。
+struct Slot {
+	std::atomic<uint64_t> seq { 0 }; // 2n+1 = n 番目を書き込み中、2n+2 = n 番目を書き終えた
+	std::atomic<uint64_t> ts { 0 };
+	std::atomic<uint64_t> dur { 0 };
+	std::atomic<uint64_t> id { 0 };
+	std::atomic<uint64_t> value { 0 };
+	std::atomic<int32_t> pid { 0 };
+	std::atomic<uint32_t> label { 0 };
+	std::atomic<uint8_t> event { 0 };
+};
+
+// リングを書いたスレッド。from 番目以降 (次の Owner の from まで) がこのスレッドのイベント
+struct Owner {
+	uint64_t from;
+	int tid;
+	std::string name;
+};
+
+struct Ring {
+	std::unique_ptr<Slot[]> slots;
+	size_t mask = 0;
+	std::atomic<uint64_t> head { 0 }; // これまでに書いた数
+	std::atomic<uint64_t> base { 0 }; // clear() した時点の head。これより前は読まない
+	// 以下は Registry::mutex の下で扱う
+	std::vector<Owner> owners; // 終了したスレッドのリングは次のスレッドが引き継ぐ
+	bool in_use = true;
+
+	explicit Ring(size_t capacity)
+		: slots(new Slot[capacity])
+		, mask(capacity - 1)
+	{
+	}
+
+	void push(ProcessTrace::Event event, uint64_t id, int pid, uint64_t value, uint64_t ts, uint64_t dur, uint32_t label)
+	{
+		uint64_t n = head.load(std::memory_order_relaxed);
+		Slot &s = slots[n & mask];
+		s.seq.store(2 * n + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		s.ts.store(ts, std::memory_order_relaxed);
+		s.dur.store(dur, std::memory_order_relaxed);
+		s.id.store(id, std::memory_order_relaxed);
+		s.value.store(value, std::memory_order_relaxed);
+		s.pid.store(pid, std::memory_order_relaxed);
+		s.label.store(label, std::memory_order_relaxed);
+		s.event.store((uint8_t)event, std::memory_order_relaxed);
+		s.seq.store(2 * n + 2, std::memory_order_release);
+		head.store(n + 1, std::memory_order_release);
+	}
+
+	// まだ読める最初の番号
+	uint64_t oldest() const
+	{
+		uint64_t h = head.load(std::memory_order_acquire);
+		uint64_t capacity = mask + 1;
+		uint64_t from = h > capacity ? h - capacity : 0;
+		return std::max(from, base.load(std::memory_order_relaxed));
+	}
+
+	// イベントが全て上書きされた Owner を捨てる
+	void prune_owners()
+	{
+		uint64_t from = oldest();
+		size_t i = 0;
+		while (i + 1 < owners.size() && owners[i + 1].from <= from) i++;
+		owners.erase(owners.begin(), owners.begin() + i);
+	}
+};
+
+// begin() のラベル。番号 % 表の大きさの位置に置き、番号が一致するものだけを使う。
+// 上書きされたラベルの区間は export でラベルなしになる
+struct Label {
+	uint32_t index = 0;
+	std::string text;
+};
+
+// スレッドが終了してもイベントを export できるよう、リングはここで保持し続ける。
+// 終了したスレッドのリングは次に作られるスレッドが再利用するので、
+// リングの数は同時に存在したスレッドの数を超えない
+struct Registry {
+	std::mutex mutex;
+	std::vector<std::shared_ptr<Ring>> rings;
+	size_t capacity = 1 << 14;
+	int next_tid = 1;
+	std::vector<Label> labels = std::vector<Label>(capacity);
+	uint32_t next_label = 1; // 0 はラベルなし
+	std::atomic<uint64_t> next_id { 1 };
+};
+
+Registry &registry()
+{
+	static Registry *r = new Registry; // スレッドの終了処理から参照されうるので解放しない
+	return *r;
+}
+
+// スレッドの終了時にリングを手放す。イベントは再利用されて上書きされるまで export できる
+struct RingHolder {
+	Ring *ring = nullptr;
+	~RingHolder()
+	{
+		if (ring) {
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			ring->in_use = false;
+		}
+	}
+};
+
+thread_local RingHolder t_ring;
+thread_local std::string t_name;
+
+Ring *thread_ring()
+{
+	if (!t_ring.ring) {
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		Ring *ring = nullptr;
+		for (auto &p : r.rings) {
+			if (!p->in_use && p->mask + 1 == r.capacity) {
+				ring = p.get();
+				ring->prune_owners();
+				break;
+			}
+		}
+		if (!ring) {
+			r.rings.push_back(std::make_shared<Ring>(r.capacity));
+			ring = r.rings.back().get();
+		}
+		ring->in_use = true;
+		ring->owners.push_back({ ring->head.load(std::memory_order_relaxed), r.next_tid++, t_name });
+		t_ring.ring = ring;
+	}
+	return t_ring.ring;
+}
+
+char const *event_name(ProcessTrace::Event event)
+{
+	switch (event) {
+	case ProcessTrace::Event::Spawn: return "spawn";
+	case ProcessTrace::Event::Exec: return "exec";
+	case ProcessTrace::Event::FirstByte: return "first-byte";
+	case ProcessTrace::Event::Read: return "read";
+	case ProcessTrace::Event::StdinWrite: return "stdin-write";
+	case ProcessTrace::Event::Exit: return "exit";
+	case ProcessTrace::Event::Reap: return "reap";
+	case ProcessTrace::Event::Callback: return "callback";
+	case ProcessTrace::Event::Begin:
+	case ProcessTrace::Event::End: return "process";
+	}
+	return "unknown";
+}
+
+void append_json_string(std::string *out, std::string_view s)
+{
+	out->push_back('"');
+	for (char c : s) {
+		switch (c) {
+		case '"': *out += "\\\""; break;
+		case '\\': *out += "\\\\"; break;
+		case '\n': *out += "\\n"; break;
+		case '\r': *out += "\\r"; break;
+		case '\t': *out += "\\t"; break;
+		default:
+			if ((unsigned char)c < 0x20) {
+				char tmp[8];
+				snprintf(tmp, sizeof(tmp), "\\u%04x", (unsigned char)c);
+				*out += tmp;
+			} else {
+				out->push_back(c);
+			}
+		}
+	}
+	out->push_back('"');
+}
+
+struct Entry {
+	uint64_t ts;
+	uint64_t dur;
+	uint64_t id;
+	uint64_t value;
+	int32_t pid;
+	uint32_t label;
+	ProcessTrace::Event event;
+	int tid;
+};
+
+} // namespace
+
+void ProcessTrace::enable(size_t events_per_thread)
+{
+	Registry &r = registry();
+	{
+		std::lock_guard<std::mutex> lock(r.mutex);
+		size_t n = 16;
+		while (n < events_per_thread) n <<= 1;
+		if (r.capacity != n) {
+			r.capacity = n;
+			r.labels.assign(n, Label());
+		}
+	}
+	enabled_.store(true, std::memory_order_relaxed);
+}
+
+void ProcessTrace::disable()
+{
+	enabled_.store(false, std::memory_order_relaxed);
+}
+
+uint64_t ProcessTrace::now_ns()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t ProcessTrace::new_id()
+{
+	return registry().next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ProcessTrace::write(Event event, uint64_t id, int pid, uint64_t value, uint64_t ts, uint64_t dur, uint32_t label)
+{
+	thread_ring()->push(event, id, pid, value, ts, dur, label);
+}
+
+void ProcessTrace::begin(uint64_t id, std::string_view label)
+{
+	if (!enabled()) return;
+	uint32_t index;
+	{
+		Registry &r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		index = r.next_label++;
+		if (r.next_label == 0) r.next_label = 1;
+		Label &l = r.labels[index % r.labels.size()];
+		l.index = index;
+		l.text.assign(label.data(), label.size()); // 確保済みの領域を使い回す
+	}
+	write(Event::Begin, id, 0, 0, now_ns(), 0, index);
+}
+
+void ProcessTrace::end(uint64_t id, int exit_code)
+{
+	if (enabled()) {
+		write(Event::End, id, 0, (uint64_t)(int64_t)exit_code, now_ns(), 0, 0);
+	}
+}
+
+void ProcessTrace::set_thread_name(std::string_view name)
+{
+	t_name = std::string(name);
+	if (t_ring.ring) {
+		std::lock_guard<std::mutex> lock(registry().mutex);
+		t_ring.ring->owners.back().name = t_name;
+	}
+}
+
+void ProcessTrace::clear()
+{
+	Registry &r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	for (auto &ring : r.rings) {
+		ring->base.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+		ring->prune_owners();
+	}
+	for (Label &l : r.labels) {
+		l.index = 0;
+		l.text.clear();
+	}
+}
+
+std::string ProcessTrace::export_chrome_json()
+{
+	Registry &r = registry();
+	std::vector<Entry> entries;
+	std::vector<std::pair<int, std::string>> threads;
+	std::map<uint32_t, std::string> labels;
+	{
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (auto &ring : r.rings) {
+			ring->prune_owners();
+			for (Owner const &o : ring->owners) {
+				if (!o.name.empty()) {
+					threads.emplace_back(o.tid, o.name);
+				}
+			}
+			uint64_t from = ring->oldest();
+			uint64_t head = ring->head.load(std::memory_order_acquire);
+			size_t owner = 0;
+			for (uint64_t n = from; n < head; n++) {
+				while (owner + 1 < ring->owners.size() && ring->owners[owner + 1].from <= n) owner++;
+				Slot &s = ring->slots[n & ring->mask];
+				uint64_t seq = s.seq.load(std::memory_order_acquire);
+				if (seq != 2 * n + 2) continue; // 上書きされた
+				Entry e;
+				e.ts = s.ts.load(std::memory_order_relaxed);
+				e.dur = s.dur.load(std::memory_order_relaxed);
+				e.id = s.id.load(std::memory_order_relaxed);
+				e.value = s.value.load(std::memory_order_relaxed);
+				e.pid = s.pid.load(std::memory_order_relaxed);
+				e.label = s.label.load(std::memory_order_relaxed);
+				e.event = (Event)s.event.load(std::memory_order_relaxed);
+				e.tid = ring->owners[owner].tid;
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (s.seq.load(std::memory_order_relaxed) != seq) continue; // 読んでいる間に上書きされた
+				if (e.event == Event::Begin && e.label != 0) {
+					Label const &l = r.labels[e.label % r.labels.size()];
+					if (l.index == e.label) {
+						labels[e.label] = l.text;
+					}
+				}
+				entries.push_back(e);
+			}
+		}
+	}
+	std::sort(entries.begin(), entries.end(), [](Entry const &a, Entry const &b) {
+		return a.ts < b.ts;
+	});
+
+	// ts/dur はマイクロ秒。ナノ秒の精度を残すため小数点以下3桁まで書く
+	uint64_t origin = entries.empty() ? 0 : entries.front().ts;
+	int const host_pid = (int)getpid();
+	char buf[256];
+	auto micros = [&](uint64_t ns) {
+		snprintf(buf, sizeof(buf), "%llu.%03u", (unsigned long long)(ns / 1000), (unsigned)(ns % 1000));
+		return std::string(buf);
+	};
+
+	std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	bool first = true;
+	auto separator = [&]() {
+		if (!first) out += ",";
+		out += "\n";
+		first = false;
+	};
+	for (auto const &t : threads) {
+		separator();
+		snprintf(buf, sizeof(buf), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", host_pid, t.first);
+		out += buf;
+		append_json_string(&out, t.second);
+		out += "}}";
+	}
+	for (Entry const &e : entries) {
+		separator();
+		out += "{\"name\":\"";
+		out += event_name(e.event);
+		out += "\",\"cat\":\"process\",\"ts\":";
+		out += micros(e.ts - origin);
+		snprintf(buf, sizeof(buf), ",\"pid\":%d,\"tid\":%d", host_pid, e.tid);
+		out += buf;
+		switch (e.event) {
+		case Event::Begin:
+		case Event::End:
+			// 始まりと終わりのスレッドが異なるので、id で対応付ける非同期イベントにする
+			snprintf(buf, sizeof(buf), ",\"ph\":\"%c\",\"id\":\"0x%llx\"", e.event == Event::Begin ? 'b' : 'e', (unsigned long long)e.id);
+			out += buf;
+			break;
+		case Event::Callback:
+			out += ",\"ph\":\"X\",\"dur\":";
+			out += micros(e.dur);
+			break;
+		default:
+			out += ",\"ph\":\"i\",\"s\":\"t\"";
+			break;
+		}
+		snprintf(buf, sizeof(buf), ",\"args\":{\"id\":%llu", (unsigned long long)e.id);
+		out += buf;
+		if (e.pid != 0) {
+			snprintf(buf, sizeof(buf), ",\"pid\":%d", e.pid);
+			out += buf;
+		}
+		switch (e.event) {
+		case Event::Read:
+		case Event::StdinWrite:
+			snprintf(buf, sizeof(buf), ",\"bytes\":%llu", (unsigned long long)e.value);
+			out += buf;
+			break;
+		case Event::Exit:
+			snprintf(buf, sizeof(buf), ",\"status\":%d", (int)e.value);
+			out += buf;
+			break;
+		case Event::Reap:
+		case Event::End:
+			snprintf(buf, sizeof(buf), ",\"exit_code\":%d", (int)(int64_t)e.value);
+			out += buf;
+			break;
+		case Event::Begin:
+			{
+				auto it = labels.find(e.label);
+				if (it != labels.end()) {
+					out += ",\"command\":";
+					append_json_string(&out, it->second);
+				}
+			}
+			break;
+		default:
+			break;
+		}
+		out += "}}";
+	}
+	out += "\n]}\n";
+	return out;
+}
+
+bool ProcessTrace::write_chrome_json(std::string const &path)
+{
+	std::string json = export_chrome_json();
+	FILE *fp = fopen(path.c_str(), "wb");
+	if (!fp) return false;
+	bool ok = fwrite(json.data(), 1, json.size(), fp) == json.size();
+	if (fclose(fp) != 0) ok = false;
+	return ok;
+}
@@ -0,0 +1,91 @@
+#ifndef PROCESSTRACE_H
+#define PROCESSTRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// 子プロセスの一生 (起動、exec、最初の出力、読み取り、stdin への書き込み、終了、回収、
+// 完了コールバック) をナノ秒単位で記録するトレーサ。
+// イベントはスレッドごとのリングバッファへロックなしで書き込み (一杯になったら古いものから
+// 上書きする)、export_chrome_json() で Chrome の trace_event 形式の JSON にする。
+// 終了したスレッドのリングは次に作られるスレッドが引き継ぐので、メモリはリングの大きさ
+// × 同時に存在したスレッドの数で頭打ちになる。区間のラベルも同じ大きさの表を使い回す。
+// chrome://tracing や Perfetto で開けば、プロセスごとの区間とイベントが時系列に並ぶ。
+// 無効な間、record() は atomic<bool> を1回読むだけで戻る。
+//
+//   ProcessTrace::enable();
+//   ... プロセスを実行する ...
+//   ProcessTrace::write_chrome_json("trace.json");
+class ProcessTrace {
+public:
+	enum class Event : uint8_t {
+		Spawn, // 子の起動を始めた
+		Exec, // 起動処理から戻った (posix_spawn では子が exec した後、fork では fork の直後)
+		FirstByte, // 最初の出力を読み取った
+		Read, // 出力の塊を読み取った (value = バイト数)
+		StdinWrite, // 子の stdin へ書き込んだ (value = バイト数)
+		Exit, // リアクタが子の終了を検出した (value = wait4 の status)
+		Reap, // 終了コードを受け取った (value = 終了コード)
+		Callback, // 完了コールバック (所要時間を持つ)
+		Begin, // プロセスの区間の始まり (begin())
+		End, // プロセスの区間の終わり (end())
+	};
+
+private:
+	static inline std::atomic<bool> enabled_ { false };
+	static void write(Event event, uint64_t id, int pid, uint64_t value, uint64_t ts, uint64_t dur, uint32_t label);
+
+public:
+	// events_per_thread はこれ以降に作られるスレッドごとのリングの大きさ (2 のべき乗に切り上げる)
+	static void enable(size_t events_per_thread = 1 << 14);
+	static void disable();
+	static bool enabled()
+	{
+		return enabled_.load(std::memory_order_relaxed);
+	}
+
+	// 単調増加の時計 (ナノ秒)
+	static uint64_t now_ns();
+	// プロセスの1回分の実行を表す ID (0 は使わない)
+	static uint64_t new_id();
+
+	// id は new_id() で得た値、pid は分かっていれば子の pid
+	static void record(Event event, uint64_t id, int pid = 0, uint64_t value = 0)
+	{
+		if (enabled()) {
+			write(event, id, pid, value, now_ns(), 0, 0);
+		}
+	}
+
+	// begin_ns (now_ns() の値) から今までを所要時間とするイベント。begin_ns が 0 なら記録しない
+	static void complete(Event event, uint64_t id, uint64_t begin_ns)
+	{
+		if (begin_ns != 0 && enabled()) {
+			uint64_t t = now_ns();
+			write(event, id, 0, 0, begin_ns, t - begin_ns, 0);
+		}
+	}
+	// 計測を始める時刻。無効なら 0
+	static uint64_t start_ns()
+	{
+		return enabled() ? now_ns() : 0;
+	}
+
+	// プロセスの区間。始まりと終わりは別のスレッドで記録してよい
+	static void begin(uint64_t id, std::string_view label);
+	static void end(uint64_t id, int exit_code);
+
+	// このスレッドのイベントを表示する際の名前 (無効な間に呼んでもよい)
+	static void set_thread_name(std::string_view name);
+
+	// 全てのスレッドのリングに残っているイベントを、時刻順に trace_event 形式の JSON にする
+	static std::string export_chrome_json();
+	static bool write_chrome_json(std::string const &path);
+	// これまでのイベントを捨てる (書き込み中のスレッドがあってもよい)
+	static void clear();
+};
+
+#endif // PROCESSTRACE_H
@@ -1,5 +1,6 @@
 
 #include "ProcessWin.h"
+#include "ProcessHelper.h"
 #include <atomic>
 #include <windows.h>
 #include "ProcessWinHelper.h" // This file must be included after <windows.h>
@@ -11,10 +12,10 @@ private:
 	HANDLE hRead_;
 	std::thread thread_;
 	std::mutex *mutex_;
-	std::deque<char> *buffer_;
+	std::vector<char> *buffer_;
 
 public:
-	OutputReaderThread(HANDLE hRead, std::mutex *mutex, std::deque<char> *buffer)
+	OutputReaderThread(HANDLE hRead, std::mutex *mutex, std::vector<char> *buffer)
 		: hRead_(hRead)
 		, mutex_(mutex)
 		, buffer_(buffer)
@@ -60,13 +61,18 @@ public:
 	DWORD error_code_ = ERROR_SUCCESS;
 	std::string error_message_;
 	std::vector<char> input_;
-	std::deque<char> outq_;
-	std::deque<char> errq_;
+	// wait() でそのまま結果へ move するので、チャンク列ではなく連続領域に溜める
+	std::vector<char> outq_;
+	std::vector<char> errq_;
 	bool use_input_ = false;
 	AutoHandle hInputWrite_;
 	std::atomic<bool> close_input_later_ { false };
 	std::mutex snap_mutex_;
 	HANDLE hProcess_snap_ = nullptr;
+	// スレッドの処理を終えたら true (wait_for() 用)
+	std::mutex done_mutex_;
+	std::condition_variable done_cond_;
+	bool done_ = false;
 
 	// 環境変数をキャッシュして再利用 (初回起動時の環境を使い続けることに注意)
 	static std::vector<wchar_t> cached_env_;
@@ -125,7 +131,22 @@ public:
 	}
 	void start()
 	{
+		{
+			std::lock_guard<std::mutex> lock(done_mutex_);
+			done_ = false;
+		}
 		thread_ = std::thread([this]() {
+			// どの経路で抜けても、ハンドルを閉じ終えた最後に終了を知らせる
+			struct Finished {
+				ProcessWinThread *self;
+				~Finished()
+				{
+					std::lock_guard<std::mutex> lock(self->done_mutex_);
+					self->done_ = true;
+					self->done_cond_.notify_all();
+				}
+			} finished { this };
+
 			hInputWrite_.close();
 			error_code_ = ERROR_SUCCESS;
 			error_message_.clear();
@@ -304,6 +325,13 @@ public:
 	{
 		stop();
 	}
+	bool wait_for(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(done_mutex_);
+		return process::helper::wait_until(done_cond_, lock, timeout, [this]() {
+			return done_;
+		});
+	}
 };
 
 // 静的メンバーの定義
@@ -359,10 +387,8 @@ int ProcessWin::wait()
 {
 	m->th.wait();
 
-	m->stdout_bytes.clear();
-	m->stderr_bytes.clear();
-	m->stdout_bytes.insert(m->stdout_bytes.end(), m->th.outq_.begin(), m->th.outq_.end());
-	m->stderr_bytes.insert(m->stderr_bytes.end(), m->th.errq_.begin(), m->th.errq_.end());
+	m->stdout_bytes = std::move(m->th.outq_);
+	m->stderr_bytes = std::move(m->th.errq_);
 	m->exit_code = m->th.exit_code_;
 	m->error_code = static_cast<int>(m->th.error_code_);
 	m->error_message = std::move(m->th.error_message_);
@@ -370,6 +396,14 @@ int ProcessWin::wait()
 	return m->exit_code;
 }
 
+bool ProcessWin::wait_for(std::chrono::milliseconds timeout)
+{
+	if (!is_running()) return true;
+	if (!m->th.wait_for(timeout)) return false;
+	wait();
+	return true;
+}
+
 bool ProcessWin::is_running() const
 {
 	return m->th.thread_.joinable();
@@ -424,3 +458,17 @@ std::vector<char> const &ProcessWin::stderr_bytes() const
 {
 	return m->stderr_bytes;
 }
+
+std::vector<char> ProcessWin::take_stdout()
+{
+	std::vector<char> v;
+	v.swap(m->stdout_bytes);
+	return v;
+}
+
+std::vector<char> ProcessWin::take_stderr()
+{
+	std::vector<char> v;
+	v.swap(m->stderr_bytes);
+	return v;
+}
@@ -19,12 +19,15 @@ public:
 	void start(std::string const &command, bool use_input);
 	void stop();
 	int wait();
+	bool wait_for(std::chrono::milliseconds timeout) override;
 	int get_exit_code() const;
 	int get_error_code() const;
 	std::string const &get_error_message() const;
 
 	std::vector<char> const &stdout_bytes() const;
 	std::vector<char> const &stderr_bytes() const;
+	std::vector<char> take_stdout();
+	std::vector<char> take_stderr();
 };
 
 #endif // PROCESSWIN_H
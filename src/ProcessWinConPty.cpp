@@ -83,13 +83,34 @@ int ProcessWinConPty::wait()
 	auto result = m->conpty.wait();
 	std::lock_guard<std::mutex> lock(m->state_mutex);
 	m->running = false;
-	std::vector<char> const &out = m->conpty.stdout_bytes();
-	stdout_bytes_.assign(out.begin(), out.end());
+	stdout_bytes_ = m->conpty.take_stdout();
 	stderr_bytes_.clear();
 	m->exit_code = result.exit_code;
 	return m->exit_code;
 }
 
+bool ProcessWinConPty::wait_for(std::chrono::milliseconds timeout)
+{
+	{
+		// 終了を待つ間は op_mutex を保持し、wait()/stop() がハンドルを閉じないようにする。
+		// stop() は op_mutex を取る前に子を終了させるので、待機はすぐに解除される
+		std::unique_lock<std::mutex> op(m->op_mutex);
+		{
+			std::lock_guard<std::mutex> lock(m->state_mutex);
+			if (!m->running) {
+				return true;
+			}
+		}
+		long long ms = timeout.count();
+		DWORD wait_ms = ms <= 0 ? 0 : ms >= INFINITE ? INFINITE : static_cast<DWORD>(ms);
+		if (!m->conpty.wait_for_exit(wait_ms)) {
+			return false;
+		}
+	}
+	wait();
+	return true;
+}
+
 void ProcessWinConPty::stop()
 {
 	{
@@ -112,8 +133,7 @@ void ProcessWinConPty::stop()
 	m->conpty.wait();
 	std::lock_guard<std::mutex> lock(m->state_mutex);
 	m->running = false;
-	std::vector<char> const &out = m->conpty.stdout_bytes();
-	stdout_bytes_.assign(out.begin(), out.end());
+	stdout_bytes_ = m->conpty.take_stdout();
 	stderr_bytes_.clear();
 	m->exit_code = m->conpty.get_exit_code();
 }
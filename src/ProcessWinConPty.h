@@ -15,6 +15,7 @@ public:
 	~ProcessWinConPty() override;
 	void start(std::string const &command, std::string const &env, bool use_input) override;
 	int wait() override;
+	bool wait_for(std::chrono::milliseconds timeout) override;
 	void stop() override;
 	bool is_running() const override;
 	int get_exit_code() const override;
@@ -241,103 +241,6 @@ public:
 	}
 };
 
-// ReadFileの境界をまたぐVTシーケンスも除去できるよう、解析状態を保持する。
-class VtStripper {
-public:
-	std::string append(std::string_view input)
-	{
-		std::string output;
-		for (unsigned char c : input) {
-			switch (state_) {
-			case State::Text:
-				if (c == 0x1b) {
-					state_ = State::Escape;
-				} else {
-					output.push_back(static_cast<char>(c));
-				}
-				break;
-
-			case State::Escape:
-				if (c == '[') {
-					state_ = State::Csi;
-				} else if (c == ']') {
-					state_ = State::Osc;
-				} else if (c == 'P' || c == 'X' || c == '^' || c == '_') {
-					state_ = State::String;
-				} else if (c >= 0x20 && c <= 0x2f) {
-					state_ = State::EscapeIntermediate;
-				} else if (c == 0x1b) {
-					state_ = State::Escape;
-				} else {
-					state_ = State::Text;
-				}
-				break;
-
-			case State::EscapeIntermediate:
-				if (c >= 0x30 && c <= 0x7e) {
-					state_ = State::Text;
-				} else if (c == 0x1b) {
-					state_ = State::Escape;
-				}
-				break;
-
-			case State::Csi:
-				if (c >= 0x40 && c <= 0x7e) {
-					state_ = State::Text;
-				} else if (c == 0x1b) {
-					state_ = State::Escape;
-				}
-				break;
-
-			case State::Osc:
-				if (c == 0x07) {
-					state_ = State::Text;
-				} else if (c == 0x1b) {
-					state_ = State::OscEscape;
-				}
-				break;
-
-			case State::OscEscape:
-				if (c == '\\') {
-					state_ = State::Text;
-				} else if (c != 0x1b) {
-					state_ = State::Osc;
-				}
-				break;
-
-			case State::String:
-				if (c == 0x1b) {
-					state_ = State::StringEscape;
-				}
-				break;
-
-			case State::StringEscape:
-				if (c == '\\') {
-					state_ = State::Text;
-				} else if (c != 0x1b) {
-					state_ = State::String;
-				}
-				break;
-			}
-		}
-		return output;
-	}
-
-private:
-	enum class State {
-		Text,
-		Escape,
-		EscapeIntermediate,
-		Csi,
-		Osc,
-		OscEscape,
-		String,
-		StringEscape,
-	};
-
-	State state_ = State::Text;
-};
-
 }
 
 #endif // PROCESSWINHELPER_H
@@ -88,6 +88,7 @@ struct ProcessWinPty::Private {
 	AutoHandle hOutput;
 	AutoHandle hInput;
 	DWORD exit_code = 0;
+	bool done = false; // run() を終えた (mutex の下で読み書きする)
 };
 
 ProcessWinPty::ProcessWinPty()
@@ -272,19 +273,39 @@ void ProcessWinPty::start(std::string const &cmdline, std::string const &env, bo
 	m->env = env;
 	m->error_message.clear();
 	m->interrupted = false;
+	m->done = false;
+	begin_output();
 	m->thread = std::thread([&]() {
 		run();
+		std::lock_guard<std::mutex> lock(m->mutex);
+		m->done = true;
+		m->cv.notify_all();
 	});
 }
 
+bool ProcessWinPty::wait_for(std::chrono::milliseconds timeout)
+{
+	if (!m->thread.joinable()) return true;
+	{
+		std::unique_lock<std::mutex> lock(m->mutex);
+		if (!process::helper::wait_until(m->cv, lock, timeout, [this] { return m->done; })) return false;
+	}
+	wait();
+	return true;
+}
+
+bool ProcessWinPty::wait(unsigned long time)
+{
+	if (!m->thread.joinable()) return false;
+	if (!wait_for(std::chrono::milliseconds(time))) return false;
+	return m->exit_code == 0;
+}
+
 int ProcessWinPty::wait()
 {
 	if (m->thread.joinable()) {
 		m->thread.join();
-		{
-			std::lock_guard<std::mutex> lock(mutex_);
-			stdout_bytes_ = output_vector_;
-		}
+		finish_output();
 		stderr_bytes_ = { };
 		return static_cast<int>(m->exit_code);
 	}
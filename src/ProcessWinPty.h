@@ -21,16 +21,15 @@ public:
 	void start(std::string const &cmdline, std::string const &env, bool use_input) override;
 	void stop() override;
 	int wait();
+	bool wait_for(std::chrono::milliseconds timeout) override;
 	int get_exit_code() const override;
 	std::string const &get_error_message() const;
 
 	// AbstractPtyProcess interface
 public:
-	bool wait(unsigned long time)
-	{
-		(void)time;
-		return wait() == 0;
-	}
+	// 従来どおり、終了コードが 0 なら true。time はミリ秒で、それまでに終了しなければ false
+	// (終了したかどうかだけを知りたい場合は wait_for() を使う)
+	bool wait(unsigned long time);
 };
 
 #endif // PROCESSWINPTY_H
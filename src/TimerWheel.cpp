@@ -0,0 +1,189 @@
+#include "TimerWheel.h"
+
+namespace {
+
+int const SlotMask = TimerWheel::SlotCount - 1;
+
+// bits の中で pos より上にある最初の立っているビット。なければ -1
+int next_set_bit(uint64_t const *bits, int pos)
+{
+	int i = pos + 1;
+	while (i < TimerWheel::SlotCount) {
+		uint64_t w = bits[i / 64] >> (i % 64);
+		if (w) return i + __builtin_ctzll(w);
+		i = (i / 64 + 1) * 64;
+	}
+	return -1;
+}
+
+} // namespace
+
+void TimerWheel::link(int32_t i, int list)
+{
+	Node &n = nodes_[i];
+	List &l = lists_[list];
+	n.list = list;
+	n.prev = l.tail;
+	n.next = -1;
+	if (l.tail >= 0) {
+		nodes_[l.tail].next = i;
+	} else {
+		l.head = i;
+		if (list < OverflowList) {
+			int slot = list % SlotCount;
+			occupied_[list / SlotCount][slot / 64] |= uint64_t(1) << (slot % 64);
+		}
+	}
+	l.tail = i;
+}
+
+void TimerWheel::unlink(int32_t i)
+{
+	Node &n = nodes_[i];
+	List &l = lists_[n.list];
+	if (n.prev >= 0) {
+		nodes_[n.prev].next = n.next;
+	} else {
+		l.head = n.next;
+	}
+	if (n.next >= 0) {
+		nodes_[n.next].prev = n.prev;
+	} else {
+		l.tail = n.prev;
+	}
+	if (l.head < 0 && n.list < OverflowList) {
+		int slot = n.list % SlotCount;
+		occupied_[n.list / SlotCount][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+	}
+	n.prev = n.next = -1;
+	n.list = -1;
+}
+
+// 期限と現在の tick で最初に異なる 8 ビットの段に入れる。その段のスロットは必ず現在の位置より先になる
+void TimerWheel::place(int32_t i)
+{
+	uint64_t expire = nodes_[i].expire;
+	if (expire <= current_) {
+		link(i, ExpiredList);
+		return;
+	}
+	uint64_t diff = expire ^ current_;
+	if (diff >> (LevelBits * Levels)) {
+		link(i, OverflowList);
+		return;
+	}
+	int level = 0;
+	while (diff >> (LevelBits * (level + 1))) {
+		level++;
+	}
+	int slot = (int)(expire >> (LevelBits * level)) & SlotMask;
+	link(i, level * SlotCount + slot);
+}
+
+// リストの中身を現在の tick に対して振り分け直す。同じリストへ戻るもの (2^32 tick より先の期限) が
+// あるので、先にリストを切り離してから辿る
+void TimerWheel::cascade(int list)
+{
+	int32_t i = lists_[list].head;
+	if (i < 0) return;
+	lists_[list] = List();
+	if (list < OverflowList) {
+		int slot = list % SlotCount;
+		occupied_[list / SlotCount][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+	}
+	while (i >= 0) {
+		int32_t next = nodes_[i].next;
+		nodes_[i].prev = nodes_[i].next = -1;
+		place(i);
+		i = next;
+	}
+}
+
+// current_ より後で、何かを処理する必要がある最初の tick
+uint64_t TimerWheel::next_event() const
+{
+	// 下の段のスロットは全て上の段のスロットより先に来るので、下から探せばよい
+	for (int level = 0; level < Levels; level++) {
+		int shift = LevelBits * level;
+		int pos = (int)(current_ >> shift) & SlotMask;
+		int slot = next_set_bit(occupied_[level], pos);
+		if (slot >= 0) {
+			uint64_t upper = current_ >> (shift + LevelBits) << (shift + LevelBits);
+			return upper | ((uint64_t)slot << shift);
+		}
+	}
+	if (lists_[OverflowList].head >= 0) {
+		return ((current_ >> (LevelBits * Levels)) + 1) << (LevelBits * Levels);
+	}
+	return Never;
+}
+
+void TimerWheel::add(uint64_t id, uint64_t expire, Fn fn)
+{
+	cancel(id);
+	int32_t i;
+	if (free_ >= 0) {
+		i = free_;
+		free_ = nodes_[i].next;
+	} else {
+		i = (int32_t)nodes_.size();
+		nodes_.emplace_back();
+	}
+	Node &n = nodes_[i];
+	n.id = id;
+	n.expire = expire > current_ ? expire : current_ + 1;
+	n.fn = std::move(fn);
+	index_[id] = i;
+	place(i);
+}
+
+bool TimerWheel::cancel(uint64_t id)
+{
+	auto it = index_.find(id);
+	if (it == index_.end()) return false;
+	int32_t i = it->second;
+	index_.erase(it);
+	unlink(i);
+	nodes_[i].fn = { };
+	nodes_[i].next = free_;
+	free_ = i;
+	return true;
+}
+
+void TimerWheel::advance(uint64_t now)
+{
+	while (current_ < now) {
+		// 間の tick には何もないので、次に処理が必要な tick まで一気に進める
+		uint64_t next = next_event();
+		if (next > now) {
+			current_ = now;
+			break;
+		}
+		current_ = next;
+		if ((current_ & ((uint64_t(1) << (LevelBits * Levels)) - 1)) == 0) {
+			cascade(OverflowList);
+		}
+		// 上の段から順に、桁上がりした段の現在のスロットを下の段へ繰り下げる
+		for (int level = Levels - 1; level > 0; level--) {
+			int shift = LevelBits * level;
+			if (current_ & ((uint64_t(1) << shift) - 1)) continue;
+			cascade(level * SlotCount + ((int)(current_ >> shift) & SlotMask));
+		}
+		cascade((int)current_ & SlotMask);
+	}
+}
+
+bool TimerWheel::pop_expired(Fn *fn)
+{
+	int32_t i = lists_[ExpiredList].head;
+	if (i < 0) return false;
+	*fn = std::move(nodes_[i].fn);
+	cancel(nodes_[i].id);
+	return true;
+}
+
+uint64_t TimerWheel::next_tick() const
+{
+	if (lists_[ExpiredList].head >= 0) return current_;
+	return next_event();
+}
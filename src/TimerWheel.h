@@ -0,0 +1,90 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// 階層型タイマーホイール。時刻は呼び出し側が決める整数の tick (ProcessPosixReactor では 1ms)。
+// 256 スロットの段を 4 段重ね、期限と現在時刻の差が最初に現れる 8 ビットの位置で段を選ぶ。
+// 登録と取り消しは O(1)、期限切れの取り出しは1件あたり O(1) (上の段から下の段への繰り下げを
+// 含めても、1件あたり高々 4 回の付け替え)。2^32 tick より先の期限は別のリストに置いておき、
+// その桁に達したときに振り分け直す。スレッドセーフではない。
+class TimerWheel {
+public:
+	typedef std::function<void()> Fn;
+
+	static constexpr int LevelBits = 8;
+	static constexpr int Levels = 4;
+	static constexpr int SlotCount = 1 << LevelBits;
+	static constexpr uint64_t Never = UINT64_MAX;
+
+private:
+	struct Node {
+		uint64_t id = 0;
+		uint64_t expire = 0;
+		Fn fn;
+		int32_t prev = -1;
+		int32_t next = -1;
+		int32_t list = -1; // 入っているリスト。-1 なら空きノード
+	};
+	struct List {
+		int32_t head = -1;
+		int32_t tail = -1;
+	};
+	enum {
+		OverflowList = Levels * SlotCount,
+		ExpiredList,
+		ListCount
+	};
+
+	uint64_t current_ = 0; // ここまでの tick は処理済み
+	std::vector<Node> nodes_;
+	int32_t free_ = -1;
+	List lists_[ListCount];
+	uint64_t occupied_[Levels][SlotCount / 64] = { }; // 空でないスロットのビットマップ
+	std::unordered_map<uint64_t, int32_t> index_; // id -> ノード
+
+	void link(int32_t i, int list);
+	void unlink(int32_t i);
+	void place(int32_t i);
+	void cascade(int list);
+	uint64_t next_event() const;
+
+public:
+	explicit TimerWheel(uint64_t now = 0)
+		: current_(now)
+	{
+	}
+
+	// expire の tick に期限が来るタイマーを id で登録する。同じ id があれば置き換える。
+	// 現在以前の期限は次の tick に切り上げる (advance() と pop_expired() の途中で登録しても、
+	// その回には取り出されない)。
+	void add(uint64_t id, uint64_t expire, Fn fn);
+	// 期限切れで取り出し待ちになっているものも取り消せる
+	bool cancel(uint64_t id);
+	// now までの時間を経過させ、期限が来たタイマーを取り出し待ちにする
+	void advance(uint64_t now);
+	// 取り出し待ちのタイマーを期限の順に1つ取り出す。なければ false
+	bool pop_expired(Fn *fn);
+	// 次に advance() すべき tick (期限、または上の段からの繰り下げが必要になる時刻)。
+	// 取り出し待ちがあれば現在の tick、タイマーがなければ Never
+	uint64_t next_tick() const;
+
+	uint64_t current() const
+	{
+		return current_;
+	}
+	size_t size() const
+	{
+		return index_.size();
+	}
+	bool empty() const
+	{
+		return index_.empty();
+	}
+};
+
+#endif // TIMERWHEEL_H
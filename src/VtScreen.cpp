@@ -0,0 +1,743 @@
+#include "VtScreen.h"
+#include <algorithm>
+
+namespace {
+
+// 表示幅。結合文字などの幅 0 の文字は保持しない
+int char_width(char32_t c)
+{
+	if (c < 0x300) return 1;
+	if ((c >= 0x300 && c <= 0x36f) || (c >= 0x1ab0 && c <= 0x1aff) || (c >= 0x200b && c <= 0x200f) || (c >= 0x20d0 && c <= 0x20ff) || (c >= 0x3099 && c <= 0x309a) || (c >= 0xfe00 && c <= 0xfe0f) || (c >= 0xe0100 && c <= 0xe01ef)) {
+		return 0;
+	}
+	if ((c >= 0x1100 && c <= 0x115f) || (c >= 0x2e80 && c <= 0x303e) || (c >= 0x3041 && c <= 0x33ff) || (c >= 0x3400 && c <= 0x4dbf) || (c >= 0x4e00 && c <= 0x9fff) || (c >= 0xa000 && c <= 0xa4cf) || (c >= 0xac00 && c <= 0xd7a3) || (c >= 0xf900 && c <= 0xfaff) || (c >= 0xfe30 && c <= 0xfe4f) || (c >= 0xff00 && c <= 0xff60) || (c >= 0xffe0 && c <= 0xffe6) || (c >= 0x1f300 && c <= 0x1f64f) || (c >= 0x1f900 && c <= 0x1f9ff) || (c >= 0x20000 && c <= 0x3fffd)) {
+		return 2;
+	}
+	return 1;
+}
+
+void append_utf8(std::string *out, char32_t c)
+{
+	if (c < 0x80) {
+		out->push_back((char)c);
+	} else if (c < 0x800) {
+		out->push_back((char)(0xc0 | (c >> 6)));
+		out->push_back((char)(0x80 | (c & 0x3f)));
+	} else if (c < 0x10000) {
+		out->push_back((char)(0xe0 | (c >> 12)));
+		out->push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+		out->push_back((char)(0x80 | (c & 0x3f)));
+	} else {
+		out->push_back((char)(0xf0 | (c >> 18)));
+		out->push_back((char)(0x80 | ((c >> 12) & 0x3f)));
+		out->push_back((char)(0x80 | ((c >> 6) & 0x3f)));
+		out->push_back((char)(0x80 | (c & 0x3f)));
+	}
+}
+
+void trim_trailing_newlines(std::string *s)
+{
+	while (!s->empty() && s->back() == '\n') {
+		s->pop_back();
+	}
+}
+
+} // namespace
+
+std::string VtScreen::Line::text(bool trim) const
+{
+	std::string s;
+	size_t n = cells.size();
+	if (trim) {
+		while (n > 0 && cells[n - 1] == U' ') n--;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (cells[i] != 0) { // 全角文字の後ろ半分は飛ばす
+			append_utf8(&s, cells[i]);
+		}
+	}
+	return s;
+}
+
+std::string VtScreen::Snapshot::text() const
+{
+	std::string s;
+	for (auto const &line : lines) {
+		s += line->text();
+		s += '\n';
+	}
+	trim_trailing_newlines(&s);
+	return s;
+}
+
+VtScreen::VtScreen(int rows, int cols, size_t scrollback_limit)
+	: rows_(std::max(rows, 1))
+	, cols_(std::max(cols, 1))
+	, scrollback_limit_(scrollback_limit)
+{
+	reset();
+}
+
+void VtScreen::init_buffer(Buffer *b)
+{
+	b->lines.assign(rows_, blank_);
+	b->cursor = Cursor();
+	b->saved = Cursor();
+}
+
+VtScreen::Line &VtScreen::line(int row)
+{
+	std::shared_ptr<Line> &p = buf_->lines[row];
+	if (p.use_count() > 1) {
+		p = std::make_shared<Line>(*p);
+	}
+	return *p;
+}
+
+void VtScreen::mark_dirty(int row)
+{
+	dirty_[row] = 1;
+	any_dirty_ = true;
+}
+
+void VtScreen::mark_dirty(int from, int to)
+{
+	for (int r = from; r <= to; r++) {
+		dirty_[r] = 1;
+	}
+	any_dirty_ = true;
+}
+
+int VtScreen::param(size_t i, int def) const
+{
+	return i < params_.size() && params_[i] > 0 ? params_[i] : def;
+}
+
+void VtScreen::terminal_reset()
+{
+	state_ = State::Ground;
+	utf8_need_ = 0;
+	blank_ = std::make_shared<Line>();
+	blank_->cells.assign(cols_, U' ');
+	init_buffer(&main_);
+	init_buffer(&alt_);
+	buf_ = &main_;
+	top_ = 0;
+	bottom_ = rows_ - 1;
+	autowrap_ = true;
+	dirty_.assign(rows_, 1);
+	any_dirty_ = true;
+}
+
+void VtScreen::reset()
+{
+	terminal_reset();
+	scrollback_.clear();
+	scrolled_ = 0;
+}
+
+void VtScreen::resize(int rows, int cols)
+{
+	rows = std::max(rows, 1);
+	cols = std::max(cols, 1);
+	if (rows == rows_ && cols == cols_) return;
+	blank_ = std::make_shared<Line>();
+	blank_->cells.assign(cols, U' ');
+	for (Buffer *b : { &main_, &alt_ }) {
+		if (cols != cols_) {
+			for (auto &p : b->lines) {
+				auto l = std::make_shared<Line>(*p);
+				l->cells.resize(cols, U' ');
+				if (l->cells.back() != 0 && cols < cols_ && p->cells[cols] == 0) {
+					l->cells.back() = U' '; // 全角文字の前半だけが残った
+				}
+				p = l;
+			}
+		}
+		if (rows < rows_) {
+			// カーソルが画面に残るように上の行を押し出し、残りは下から削る
+			int excess = rows_ - rows;
+			int from_top = std::min(excess, std::max(0, b->cursor.row - (rows - 1)));
+			for (int i = 0; i < from_top; i++) {
+				if (b == &main_) push_scrollback(*b->lines[i]);
+			}
+			b->lines.erase(b->lines.begin(), b->lines.begin() + from_top);
+			b->lines.resize(rows);
+			b->cursor.row -= from_top;
+			b->saved.row = std::max(0, b->saved.row - from_top);
+		} else {
+			b->lines.resize(rows, blank_);
+		}
+		for (Cursor *c : { &b->cursor, &b->saved }) {
+			c->row = std::min(c->row, rows - 1);
+			c->col = std::min(c->col, cols - 1);
+			c->pending_wrap = false;
+		}
+	}
+	rows_ = rows;
+	cols_ = cols;
+	top_ = 0;
+	bottom_ = rows_ - 1;
+	dirty_.assign(rows_, 1);
+	any_dirty_ = true;
+}
+
+void VtScreen::push_scrollback(Line const &line)
+{
+	scrolled_++;
+	if (scrollback_limit_ == 0) return;
+	ScrollbackLine s;
+	s.wrapped = line.wrapped;
+	s.text = line.text(!line.wrapped); // 折り返した行の末尾の空白は内容の一部
+	scrollback_.push_back(std::move(s));
+	if (scrollback_.size() > scrollback_limit_) {
+		scrollback_.pop_front();
+	}
+}
+
+void VtScreen::scroll_up(int top, int bottom, int n, bool to_scrollback)
+{
+	n = std::min(n, bottom - top + 1);
+	if (n <= 0) return;
+	auto &lines = buf_->lines;
+	if (to_scrollback && top == 0 && buf_ == &main_) {
+		for (int i = 0; i < n; i++) {
+			push_scrollback(*lines[i]);
+		}
+	}
+	std::rotate(lines.begin() + top, lines.begin() + top + n, lines.begin() + bottom + 1);
+	std::fill(lines.begin() + bottom + 1 - n, lines.begin() + bottom + 1, blank_);
+	mark_dirty(top, bottom);
+}
+
+void VtScreen::scroll_down(int top, int bottom, int n)
+{
+	n = std::min(n, bottom - top + 1);
+	if (n <= 0) return;
+	auto &lines = buf_->lines;
+	std::rotate(lines.begin() + top, lines.begin() + bottom + 1 - n, lines.begin() + bottom + 1);
+	std::fill(lines.begin() + top, lines.begin() + top + n, blank_);
+	mark_dirty(top, bottom);
+}
+
+void VtScreen::move_to(int row, int col)
+{
+	Cursor &c = cur();
+	c.row = std::clamp(row, 0, rows_ - 1);
+	c.col = std::clamp(col, 0, cols_ - 1);
+	c.pending_wrap = false;
+}
+
+void VtScreen::index()
+{
+	Cursor &c = cur();
+	c.pending_wrap = false;
+	if (c.row == bottom_) {
+		scroll_up(top_, bottom_, 1, true);
+	} else if (c.row < rows_ - 1) {
+		c.row++;
+	}
+}
+
+void VtScreen::reverse_index()
+{
+	Cursor &c = cur();
+	c.pending_wrap = false;
+	if (c.row == top_) {
+		scroll_down(top_, bottom_, 1);
+	} else if (c.row > 0) {
+		c.row--;
+	}
+}
+
+void VtScreen::erase_cells(int row, int from, int to)
+{
+	from = std::max(from, 0);
+	to = std::min(to, cols_);
+	if (from >= to) return;
+	Line &l = line(row);
+	// 全角文字の片側だけを消す場合は、残る側も空白にする
+	if (from > 0 && l.cells[from] == 0) l.cells[from - 1] = U' ';
+	if (to < cols_ && l.cells[to] == 0) l.cells[to] = U' ';
+	std::fill(l.cells.begin() + from, l.cells.begin() + to, U' ');
+	if (to == cols_) l.wrapped = false;
+	mark_dirty(row);
+}
+
+void VtScreen::erase_display(int mode)
+{
+	Cursor &c = cur();
+	switch (mode) {
+	case 0:
+		erase_cells(c.row, c.col, cols_);
+		for (int r = c.row + 1; r < rows_; r++) {
+			buf_->lines[r] = blank_;
+		}
+		mark_dirty(c.row, rows_ - 1);
+		break;
+	case 1:
+		for (int r = 0; r < c.row; r++) {
+			buf_->lines[r] = blank_;
+		}
+		erase_cells(c.row, 0, c.col + 1);
+		mark_dirty(0, c.row);
+		break;
+	case 2:
+		std::fill(buf_->lines.begin(), buf_->lines.end(), blank_);
+		mark_dirty(0, rows_ - 1);
+		break;
+	case 3:
+		scrollback_.clear();
+		break;
+	}
+}
+
+void VtScreen::put(char32_t ch)
+{
+	int w = char_width(ch);
+	if (w == 0 || w > cols_) return;
+	Cursor &c = cur();
+	if (c.pending_wrap && autowrap_) {
+		line(c.row).wrapped = true;
+		index();
+		c.col = 0;
+	}
+	if (c.col + w > cols_) {
+		// 右端に全角文字が入らない
+		if (!autowrap_) return;
+		line(c.row).wrapped = true;
+		index();
+		c.col = 0;
+	}
+	Line &l = line(c.row);
+	if (l.cells[c.col] == 0 && c.col > 0) l.cells[c.col - 1] = U' ';
+	int end = c.col + w;
+	if (end < cols_ && l.cells[end] == 0) l.cells[end] = U' ';
+	l.cells[c.col] = ch;
+	if (w == 2) l.cells[c.col + 1] = 0;
+	mark_dirty(c.row);
+	if (end >= cols_) {
+		c.col = cols_ - 1;
+		c.pending_wrap = true;
+	} else {
+		c.col = end;
+		c.pending_wrap = false;
+	}
+}
+
+void VtScreen::put_ascii(char const *ptr, size_t len)
+{
+	Cursor &c = cur();
+	while (len > 0) {
+		if (c.pending_wrap) {
+			put((unsigned char)*ptr++); // 折り返しは put() に任せる
+			len--;
+			continue;
+		}
+		size_t n = std::min(len, (size_t)(cols_ - c.col));
+		Line &l = line(c.row);
+		int end = c.col + (int)n;
+		if (l.cells[c.col] == 0 && c.col > 0) l.cells[c.col - 1] = U' ';
+		if (end < cols_ && l.cells[end] == 0) l.cells[end] = U' ';
+		std::copy(reinterpret_cast<unsigned char const *>(ptr), reinterpret_cast<unsigned char const *>(ptr) + n, l.cells.begin() + c.col);
+		mark_dirty(c.row);
+		ptr += n;
+		len -= n;
+		if (end >= cols_) {
+			c.col = cols_ - 1;
+			c.pending_wrap = true;
+		} else {
+			c.col = end;
+		}
+	}
+}
+
+void VtScreen::control(unsigned char c)
+{
+	Cursor &cu = cur();
+	switch (c) {
+	case 0x08: // BS
+		if (cu.col > 0) cu.col--;
+		cu.pending_wrap = false;
+		break;
+	case 0x09: // HT
+		cu.col = std::min((cu.col / 8 + 1) * 8, cols_ - 1);
+		cu.pending_wrap = false;
+		break;
+	case 0x0a: // LF
+	case 0x0b: // VT
+	case 0x0c: // FF
+		index();
+		if (newline_mode_) cu.col = 0;
+		break;
+	case 0x0d: // CR
+		cu.col = 0;
+		cu.pending_wrap = false;
+		break;
+	}
+}
+
+void VtScreen::esc_dispatch(unsigned char c)
+{
+	Cursor &cu = cur();
+	switch (c) {
+	case '7': // DECSC
+		buf_->saved = cu;
+		break;
+	case '8': // DECRC
+		cu = buf_->saved;
+		move_to(cu.row, cu.col);
+		break;
+	case 'D': // IND
+		index();
+		break;
+	case 'E': // NEL
+		index();
+		cu.col = 0;
+		break;
+	case 'M': // RI
+		reverse_index();
+		break;
+	case 'c': // RIS (スクロールバックは残す)
+		terminal_reset();
+		break;
+	}
+}
+
+void VtScreen::set_mode(bool dec, int mode, bool on)
+{
+	if (!dec) {
+		if (mode == 20) newline_mode_ = on; // LNM
+		return;
+	}
+	switch (mode) {
+	case 6: // DECOM
+		cur().origin_mode = on;
+		move_to(on ? top_ : 0, 0);
+		break;
+	case 7: // DECAWM
+		autowrap_ = on;
+		break;
+	case 47:
+	case 1047:
+	case 1049:
+		if (on == (buf_ == &alt_)) break;
+		if (on) {
+			if (mode == 1049) main_.saved = main_.cursor;
+			Cursor c = main_.cursor;
+			if (mode != 47) init_buffer(&alt_);
+			alt_.cursor = c;
+			buf_ = &alt_;
+		} else {
+			buf_ = &main_;
+			if (mode == 1049) main_.cursor = main_.saved;
+		}
+		mark_dirty(0, rows_ - 1);
+		break;
+	}
+}
+
+void VtScreen::csi_dispatch(unsigned char c)
+{
+	Cursor &cu = cur();
+	if (private_marker_ == '?') {
+		if (c == 'h' || c == 'l') {
+			for (int p : params_) {
+				set_mode(true, p, c == 'h');
+			}
+		}
+		return;
+	}
+	if (private_marker_ != 0) return; // 二次 DA などの問い合わせ
+	int n = param(0, 1);
+	switch (c) {
+	case '@': { // ICH
+		Line &l = line(cu.row);
+		n = std::min(n, cols_ - cu.col);
+		l.cells.insert(l.cells.begin() + cu.col, n, U' ');
+		l.cells.resize(cols_);
+		if (char_width(l.cells.back()) == 2) l.cells.back() = U' '; // 押し出された全角文字の前半
+		cu.pending_wrap = false;
+		mark_dirty(cu.row);
+		break;
+	}
+	case 'A': // CUU
+		move_to(std::max(cu.row - n, cu.row >= top_ ? top_ : 0), cu.col);
+		break;
+	case 'B': // CUD
+	case 'e': // VPR
+		move_to(std::min(cu.row + n, cu.row <= bottom_ ? bottom_ : rows_ - 1), cu.col);
+		break;
+	case 'C': // CUF
+	case 'a': // HPR
+		move_to(cu.row, cu.col + n);
+		break;
+	case 'D': // CUB
+		move_to(cu.row, cu.col - n);
+		break;
+	case 'E': // CNL
+		move_to(std::min(cu.row + n, cu.row <= bottom_ ? bottom_ : rows_ - 1), 0);
+		break;
+	case 'F': // CPL
+		move_to(std::max(cu.row - n, cu.row >= top_ ? top_ : 0), 0);
+		break;
+	case 'G': // CHA
+	case '`': // HPA
+		move_to(cu.row, n - 1);
+		break;
+	case 'H': // CUP
+	case 'f': // HVP
+	case 'd': { // VPA
+		int row = param(0, 1) - 1;
+		int col = c == 'd' ? cu.col : param(1, 1) - 1;
+		if (cu.origin_mode) {
+			row = std::min(row + top_, bottom_);
+		}
+		move_to(row, col);
+		break;
+	}
+	case 'J': // ED
+		erase_display(param(0, 0));
+		break;
+	case 'K': // EL
+		switch (param(0, 0)) {
+		case 0:
+			erase_cells(cu.row, cu.col, cols_);
+			break;
+		case 1:
+			erase_cells(cu.row, 0, cu.col + 1);
+			break;
+		case 2:
+			erase_cells(cu.row, 0, cols_);
+			break;
+		}
+		break;
+	case 'L': // IL
+		if (cu.row >= top_ && cu.row <= bottom_) {
+			scroll_down(cu.row, bottom_, n);
+			move_to(cu.row, 0);
+		}
+		break;
+	case 'M': // DL
+		if (cu.row >= top_ && cu.row <= bottom_) {
+			scroll_up(cu.row, bottom_, n, false);
+			move_to(cu.row, 0);
+		}
+		break;
+	case 'P': { // DCH
+		Line &l = line(cu.row);
+		n = std::min(n, cols_ - cu.col);
+		if (l.cells[cu.col] == 0 && cu.col > 0) l.cells[cu.col - 1] = U' ';
+		l.cells.erase(l.cells.begin() + cu.col, l.cells.begin() + cu.col + n);
+		l.cells.resize(cols_, U' ');
+		if (l.cells[cu.col] == 0) l.cells[cu.col] = U' ';
+		cu.pending_wrap = false;
+		mark_dirty(cu.row);
+		break;
+	}
+	case 'S': // SU
+		scroll_up(top_, bottom_, n, true);
+		break;
+	case 'T': // SD
+		scroll_down(top_, bottom_, n);
+		break;
+	case 'X': // ECH
+		erase_cells(cu.row, cu.col, cu.col + n);
+		cu.pending_wrap = false;
+		break;
+	case 'h':
+	case 'l':
+		for (int p : params_) {
+			set_mode(false, p, c == 'h');
+		}
+		break;
+	case 'r': { // DECSTBM
+		int top = param(0, 1) - 1;
+		int bottom = param(1, rows_) - 1;
+		if (top < bottom && bottom < rows_) {
+			top_ = top;
+			bottom_ = bottom;
+			move_to(cu.origin_mode ? top_ : 0, 0);
+		}
+		break;
+	}
+	case 's': // SCOSC
+		buf_->saved = cu;
+		break;
+	case 'u': // SCORC
+		cu = buf_->saved;
+		move_to(cu.row, cu.col);
+		break;
+	}
+	// SGR (m) や問い合わせ (n, c) などは無視する
+}
+
+void VtScreen::feed(char const *ptr, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)ptr[i];
+		switch (state_) {
+		case State::Ground:
+			if (utf8_need_ > 0) {
+				if ((c & 0xc0) == 0x80) {
+					utf8_cp_ = (utf8_cp_ << 6) | (c & 0x3f);
+					if (--utf8_need_ == 0) put(utf8_cp_);
+					break;
+				}
+				// 途中で切れた UTF-8。このバイトは改めて解釈する
+				utf8_need_ = 0;
+				put(0xfffd);
+			}
+			if (c >= 0x20 && c < 0x7f) {
+				// 平文は行ごとにまとめて書く
+				size_t j = i + 1;
+				while (j < len && (unsigned char)(ptr[j] - 0x20) < 0x5f) {
+					j++;
+				}
+				put_ascii(ptr + i, j - i);
+				i = j - 1;
+			} else if (c == 0x1b) {
+				state_ = State::Escape;
+			} else if (c < 0x20) {
+				control(c);
+			} else if (c >= 0xc2 && c <= 0xdf) {
+				utf8_cp_ = c & 0x1f;
+				utf8_need_ = 1;
+			} else if (c >= 0xe0 && c <= 0xef) {
+				utf8_cp_ = c & 0x0f;
+				utf8_need_ = 2;
+			} else if (c >= 0xf0 && c <= 0xf4) {
+				utf8_cp_ = c & 0x07;
+				utf8_need_ = 3;
+			} else if (c != 0x7f) {
+				put(0xfffd);
+			}
+			break;
+
+		case State::Escape:
+			if (c == '[') {
+				state_ = State::Csi;
+				params_.clear();
+				param_started_ = false;
+				private_marker_ = 0;
+			} else if (c == ']') {
+				state_ = State::Osc;
+			} else if (c == 'P' || c == 'X' || c == '^' || c == '_') {
+				state_ = State::String;
+			} else if (c >= 0x20 && c <= 0x2f) {
+				state_ = State::EscapeIntermediate; // 文字集合の指定など
+			} else if (c == 0x1b) {
+				state_ = State::Escape;
+			} else if (c < 0x20) {
+				control(c);
+			} else {
+				state_ = State::Ground;
+				esc_dispatch(c);
+			}
+			break;
+
+		case State::EscapeIntermediate:
+			if (c >= 0x30 && c <= 0x7e) {
+				state_ = State::Ground;
+			} else if (c == 0x1b) {
+				state_ = State::Escape;
+			}
+			break;
+
+		case State::Csi:
+			if (c >= '0' && c <= '9') {
+				if (!param_started_) {
+					params_.push_back(0);
+					param_started_ = true;
+				}
+				int &p = params_.back();
+				p = std::min(p * 10 + (c - '0'), 65535);
+			} else if (c == ';' || c == ':') {
+				if (!param_started_) params_.push_back(-1); // 省略された引数
+				param_started_ = false;
+			} else if (c >= 0x3c && c <= 0x3f) {
+				private_marker_ = (char)c;
+			} else if (c >= 0x40 && c <= 0x7e) {
+				state_ = State::Ground;
+				csi_dispatch(c);
+			} else if (c == 0x1b) {
+				state_ = State::Escape;
+			} else if (c < 0x20) {
+				control(c); // シーケンスの途中の制御文字も実行する
+			}
+			break;
+
+		case State::Osc:
+			if (c == 0x07) {
+				state_ = State::Ground;
+			} else if (c == 0x1b) {
+				state_ = State::OscEscape;
+			}
+			break;
+
+		case State::OscEscape:
+			if (c == '\\') {
+				state_ = State::Ground;
+			} else if (c != 0x1b) {
+				state_ = State::Osc;
+			}
+			break;
+
+		case State::String:
+			if (c == 0x1b) {
+				state_ = State::StringEscape;
+			}
+			break;
+
+		case State::StringEscape:
+			if (c == '\\') {
+				state_ = State::Ground;
+			} else if (c != 0x1b) {
+				state_ = State::String;
+			}
+			break;
+		}
+	}
+}
+
+VtScreen::Snapshot VtScreen::snapshot() const
+{
+	Snapshot s;
+	s.rows = rows_;
+	s.cols = cols_;
+	s.cursor_row = buf_->cursor.row;
+	s.cursor_col = buf_->cursor.col;
+	s.scrolled = scrolled_;
+	s.lines.assign(buf_->lines.begin(), buf_->lines.end());
+	return s;
+}
+
+std::vector<int> VtScreen::take_dirty_rows()
+{
+	std::vector<int> rows;
+	if (!any_dirty_) return rows;
+	for (int r = 0; r < rows_; r++) {
+		if (dirty_[r]) {
+			rows.push_back(r);
+			dirty_[r] = 0;
+		}
+	}
+	any_dirty_ = false;
+	return rows;
+}
+
+std::string VtScreen::rendered_text() const
+{
+	std::string s;
+	for (ScrollbackLine const &line : scrollback_) {
+		s += line.text;
+		if (!line.wrapped) s += '\n';
+	}
+	for (auto const &line : main_.lines) {
+		s += line->text(!line->wrapped);
+		if (!line->wrapped) s += '\n';
+	}
+	trim_trailing_newlines(&s);
+	if (!s.empty()) s += '\n';
+	return s;
+}
@@ -0,0 +1,193 @@
+#ifndef VTSCREEN_H
+#define VTSCREEN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+// PTY の出力を解釈して画面の内容を再現する、インクリメンタルな端末エミュレータ。
+// VtStripper ではカーソル移動が失われ、git の進捗表示 (\r による上書き) や TUI の出力が
+// 崩れたログになるが、こちらは画面 (行 × 桁のセル) とスクロールバックを保持するので、
+// 最終的に表示されていたテキストが得られる。
+// 出力は塊ごとに feed() すればよく、塊の境界をまたぐシーケンスや UTF-8 も扱える。
+// 色などの文字属性は保持しない。スレッドセーフではない。
+class VtScreen {
+public:
+	// 1行分のセル。全角文字は2セルを使い、後ろのセルは 0 になる
+	struct Line {
+		std::vector<char32_t> cells;
+		bool wrapped = false; // 右端で折り返して次の行へ続いている
+
+		// UTF-8。trim なら行末の空白を除く
+		std::string text(bool trim = true) const;
+	};
+
+	// 画面のある時点の内容。行は書き換えられるときに複製される (コピーオンライト) ので、
+	// 作るのは行数分のポインタのコピーだけで済み、後から feed() しても変わらない。
+	struct Snapshot {
+		int rows = 0;
+		int cols = 0;
+		int cursor_row = 0;
+		int cursor_col = 0;
+		uint64_t scrolled = 0; // この時点までにスクロールバックへ送られた行数の累計
+		std::vector<std::shared_ptr<Line const>> lines;
+
+		std::string text(int row) const
+		{
+			return row >= 0 && row < (int)lines.size() ? lines[row]->text() : std::string();
+		}
+		std::string text() const; // 全ての行を \n でつなぐ (末尾の空行は除く)
+	};
+
+private:
+	enum class State {
+		Ground,
+		Escape,
+		EscapeIntermediate,
+		Csi,
+		Osc,
+		OscEscape,
+		String,
+		StringEscape,
+	};
+
+	struct Cursor {
+		int row = 0;
+		int col = 0;
+		bool pending_wrap = false; // 右端に書いた直後。次の文字で折り返す
+		bool origin_mode = false;
+	};
+
+	struct Buffer {
+		std::vector<std::shared_ptr<Line>> lines;
+		Cursor cursor;
+		Cursor saved;
+	};
+
+	struct ScrollbackLine {
+		std::string text;
+		bool wrapped = false;
+	};
+
+	int rows_;
+	int cols_;
+	size_t scrollback_limit_;
+	Buffer main_;
+	Buffer alt_;
+	Buffer *buf_ = &main_; // 代替画面 (?1049h など) に切り替えると &alt_
+	int top_ = 0; // スクロール領域 (DECSTBM)
+	int bottom_ = 0;
+	bool autowrap_ = true;
+	bool newline_mode_ = false;
+	std::deque<ScrollbackLine> scrollback_;
+	uint64_t scrolled_ = 0;
+	std::vector<uint8_t> dirty_;
+	bool any_dirty_ = false;
+
+	State state_ = State::Ground;
+	std::vector<int> params_;
+	bool param_started_ = false;
+	char private_marker_ = 0;
+	char32_t utf8_cp_ = 0;
+	int utf8_need_ = 0;
+
+	std::shared_ptr<Line> blank_; // 空行は書き換えるまで全ての行で共有する
+	void init_buffer(Buffer *b);
+	Line &line(int row); // 書き換える前に、スナップショットと共有していれば複製する
+	void mark_dirty(int row);
+	void mark_dirty(int from, int to);
+	Cursor &cur()
+	{
+		return buf_->cursor;
+	}
+	int param(size_t i, int def) const;
+
+	void put(char32_t ch);
+	void put_ascii(char const *ptr, size_t len); // 表示可能な ASCII の連続をまとめて書く
+	void control(unsigned char c);
+	void esc_dispatch(unsigned char c);
+	void csi_dispatch(unsigned char c);
+	void set_mode(bool dec, int mode, bool on);
+	void terminal_reset();
+
+	void move_to(int row, int col);
+	void index();
+	void reverse_index();
+	// to_scrollback なら、画面の最上行から押し出された行をスクロールバックへ送る
+	void scroll_up(int top, int bottom, int n, bool to_scrollback);
+	void scroll_down(int top, int bottom, int n);
+	void erase_cells(int row, int from, int to);
+	void erase_display(int mode);
+	void push_scrollback(Line const &line);
+
+public:
+	explicit VtScreen(int rows = 25, int cols = 80, size_t scrollback_limit = 10000);
+	VtScreen(VtScreen const &) = delete;
+	VtScreen &operator=(VtScreen const &) = delete;
+
+	void feed(char const *ptr, size_t len);
+	// 画面とスクロールバックを消して、初期状態に戻す
+	void reset();
+	// 画面の大きさを変える。減った行は上からスクロールバックへ送る
+	void resize(int rows, int cols);
+	// LF で行頭にも戻る (LNM)。cfmakeraw した PTY (ProcessPosixPty) では ONLCR が無く、
+	// 子が \n だけを書くので、ログとして読むときは true にする。既定は false
+	void set_newline_mode(bool on)
+	{
+		newline_mode_ = on;
+	}
+
+	int rows() const
+	{
+		return rows_;
+	}
+	int cols() const
+	{
+		return cols_;
+	}
+	int cursor_row() const
+	{
+		return buf_->cursor.row;
+	}
+	int cursor_col() const
+	{
+		return buf_->cursor.col;
+	}
+	bool alternate_screen() const
+	{
+		return buf_ == &alt_;
+	}
+
+	Snapshot snapshot() const;
+
+	// 前回の take_dirty_rows() 以降に変化した画面の行番号を昇順で返し、記録を消す。
+	// スクロールした場合は領域内の全ての行が変化したものとして扱う
+	std::vector<int> take_dirty_rows();
+	bool dirty() const
+	{
+		return any_dirty_;
+	}
+
+	size_t scrollback_size() const
+	{
+		return scrollback_.size();
+	}
+	std::string const &scrollback_line(size_t i) const
+	{
+		return scrollback_[i].text;
+	}
+	// これまでにスクロールバックへ送られた行数の累計 (上限で捨てた分も含む)
+	uint64_t scrolled_lines() const
+	{
+		return scrolled_;
+	}
+
+	// スクロールバックと通常画面を上から順に並べた、最終的に表示されているテキスト。
+	// 折り返した行はつなぎ、末尾の空行は除く
+	std::string rendered_text() const;
+};
+
+#endif // VTSCREEN_H
@@ -0,0 +1,172 @@
+#include "VtStripper.h"
+#include <cstring>
+
+#if defined(__AVX2__)
+#define VTS_USE_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VTS_USE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define VTS_USE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if (defined(VTS_USE_AVX2) || defined(VTS_USE_SSE2)) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+#if defined(VTS_USE_AVX2) || defined(VTS_USE_SSE2)
+inline unsigned lowest_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+#endif
+
+// 最初の ESC の位置を返す (無ければ end)
+char const *find_escape(char const *ptr, char const *end)
+{
+	// シーケンスの間の平文は短いことが多いので、先頭はそのまま調べる
+	for (int i = 0; i < 16; i++) {
+		if (ptr == end || *ptr == 0x1b) return ptr;
+		ptr++;
+	}
+#if defined(VTS_USE_AVX2)
+	__m256i const esc = _mm256_set1_epi8(0x1b);
+	while (end - ptr >= 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(ptr));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, esc));
+		if (mask) return ptr + lowest_bit(mask);
+		ptr += 32;
+	}
+#elif defined(VTS_USE_SSE2)
+	__m128i const esc = _mm_set1_epi8(0x1b);
+	while (end - ptr >= 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(ptr));
+		unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, esc));
+		if (mask) return ptr + lowest_bit(mask);
+		ptr += 16;
+	}
+#elif defined(VTS_USE_NEON)
+	uint8x16_t const esc = vdupq_n_u8(0x1b);
+	while (end - ptr >= 16) {
+		uint8x16_t v = vld1q_u8(reinterpret_cast<uint8_t const *>(ptr));
+		if (vmaxvq_u8(vceqq_u8(v, esc))) break; // この16バイトの中にある。位置は下で求める
+		ptr += 16;
+	}
+#endif
+	void const *p = memchr(ptr, 0x1b, end - ptr);
+	return p ? static_cast<char const *>(p) : end;
+}
+
+} // namespace
+
+void VtStripper::append(char const *ptr, size_t len, std::string *out)
+{
+	// 出力は入力より長くならないので、先に広げておいて直接書き込む
+	size_t base = out->size();
+	out->resize(base + len);
+	char *dst = &(*out)[base];
+	char *const dst_begin = dst;
+	char const *end = ptr + len;
+	State state = state_; // dst への書き込みと別名にならないよう、ローカルで回す
+	while (ptr < end) {
+		if (state == State::Text) {
+			// 平文は次の ESC までまとめてコピーする
+			char const *esc = find_escape(ptr, end);
+			memcpy(dst, ptr, esc - ptr);
+			dst += esc - ptr;
+			if (esc == end) break;
+			state = State::Escape;
+			ptr = esc + 1;
+			continue;
+		}
+
+		if (state == State::Csi) {
+			// パラメータと中間バイト (0x20-0x3f) は状態を変えないので読み飛ばす
+			while (ptr < end && (unsigned char)(*ptr - 0x20) < 0x20) {
+				ptr++;
+			}
+			if (ptr == end) break;
+		}
+
+		// シーケンスの中は短いので1バイトずつ状態を進める
+		unsigned char c = (unsigned char)*ptr++;
+		switch (state) {
+		case State::Text:
+			break;
+
+		case State::Escape:
+			if (c == '[') {
+				state = State::Csi;
+			} else if (c == ']') {
+				state = State::Osc;
+			} else if (c == 'P' || c == 'X' || c == '^' || c == '_') {
+				state = State::String;
+			} else if (c >= 0x20 && c <= 0x2f) {
+				state = State::EscapeIntermediate;
+			} else if (c == 0x1b) {
+				state = State::Escape;
+			} else {
+				state = State::Text;
+			}
+			break;
+
+		case State::EscapeIntermediate:
+			if (c >= 0x30 && c <= 0x7e) {
+				state = State::Text;
+			} else if (c == 0x1b) {
+				state = State::Escape;
+			}
+			break;
+
+		case State::Csi:
+			if (c >= 0x40 && c <= 0x7e) {
+				state = State::Text;
+			} else if (c == 0x1b) {
+				state = State::Escape;
+			}
+			break;
+
+		case State::Osc:
+			if (c == 0x07) {
+				state = State::Text;
+			} else if (c == 0x1b) {
+				state = State::OscEscape;
+			}
+			break;
+
+		case State::OscEscape:
+			if (c == '\\') {
+				state = State::Text;
+			} else if (c != 0x1b) {
+				state = State::Osc;
+			}
+			break;
+
+		case State::String:
+			if (c == 0x1b) {
+				state = State::StringEscape;
+			}
+			break;
+
+		case State::StringEscape:
+			if (c == '\\') {
+				state = State::Text;
+			} else if (c != 0x1b) {
+				state = State::String;
+			}
+			break;
+		}
+	}
+	state_ = state;
+	out->resize(base + (dst - dst_begin));
+}
@@ -0,0 +1,44 @@
+#ifndef VTSTRIPPER_H
+#define VTSTRIPPER_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// 端末の出力から VT (ANSI) エスケープシーケンスを取り除く。
+// 読み取りの境界をまたぐシーケンスも除去できるよう、解析状態を保持する。
+// シーケンスの外 (Text 状態) では ESC を SIMD (AVX2/SSE2/NEON) で探し、
+// 間の平文はまとめてコピーする。スレッドセーフではない。
+class VtStripper {
+public:
+	// ptr[0, len) からシーケンスを除いたものを out の末尾に追加する
+	void append(char const *ptr, size_t len, std::string *out);
+
+	std::string append(std::string_view input)
+	{
+		std::string output;
+		append(input.data(), input.size(), &output);
+		return output;
+	}
+
+	void reset()
+	{
+		state_ = State::Text;
+	}
+
+private:
+	enum class State {
+		Text,
+		Escape,
+		EscapeIntermediate,
+		Csi,
+		Osc,
+		OscEscape,
+		String,
+		StringEscape,
+	};
+
+	State state_ = State::Text;
+};
+
+#endif // VTSTRIPPER_H
@@ -0,0 +1,16 @@
+TARGET = vtstripper-bench
+DESTDIR = $$PWD/_bin
+TEMPLATE = app
+CONFIG -= qt
+CONFIG += console
+CONFIG += c++17
+CONFIG += release
+
+INCLUDEPATH += $$PWD/src
+
+HEADERS += \
+	src/VtStripper.h
+
+SOURCES += \
+	benchmark/vtstripper_bench.cpp \
+	src/VtStripper.cpp